@@ -10,8 +10,6 @@ typedef void (*log_data_func)(const char*);
 
 typedef struct log_t
 {
-    char* buffer;
-    int buffer_length;
     log_info_func info;
     log_data_func data;
 } log_t;
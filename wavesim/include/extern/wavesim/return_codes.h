@@ -18,6 +18,13 @@ typedef enum wsret
     WS_ERR_TOO_FEW_INDICES          = -8,
     WS_ERR_INDICES_ARENT_A_TRI      = -9,
     WS_ERR_VERTEX_INDEX_NOT_FOUND   = -10,
+    WS_ERR_THREAD_CREATE_FAILED     = -11,
+    WS_ERR_TOO_MANY_MATERIALS       = -12,
+    WS_ERR_EMPTY_MEDIUM             = -13,
+    WS_ERR_NOT_PREPARED             = -14,
+    WS_ERR_OUTSIDE_MEDIUM           = -15,
+    WS_ERR_INVALID_SOUND_SPEED      = -16,
+    WS_ERR_GRID_TOO_COARSE          = -17,
 } wsret;
 
 WAVESIM_PUBLIC_API const char*
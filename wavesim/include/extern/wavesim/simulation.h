@@ -1,3 +1,52 @@
+/*!
+ * @file simulation.h
+ * @brief Time domain wave simulation using adaptive rectangular decomposition.
+ * @page simulation Simulation
+ *
+ * The medium is made of box shaped partitions (see medium.h). Inside a box
+ * with rigid walls, the wave equation has a closed form solution: the
+ * pressure field is a sum of cosine modes, which are exactly the basis
+ * functions of the DCT, and each mode oscillates independently at its own
+ * eigenfrequency. Every step transforms the source terms of each partition
+ * into modal space, advances every mode with
+ *
+ *     m(t+dt) = 2cos(w*dt) * m(t) - m(t-dt) + 2(1 - cos(w*dt))/w^2 * f(t)
+ *
+ * and transforms the modes back into pressure (see dct.h). The update is
+ * exact (free of numerical dispersion) for any time step, so the grid only
+ * needs a few cells per wavelength at the highest frequency of interest
+ * (see simulation_t::max_frequency).
+ *
+ * Partitions are coupled through the source term. Near a shared face, the
+ * rigid wall solution differs from the wave equation over both partitions
+ * by the part of a finite difference Laplacian that reaches across the face.
+ * The cells within reach of a 6th order stencil (three on each side) receive
+ * that difference as forcing before every step:
+ *
+ *     f[j] += c^2/h^2 * sum(a[d+e+1] * (p_neighbour[e] - p_own[e]))
+ *
+ * where d and e are the depths of the cells counted from the face and
+ * a = (-490, 270, -27, 2)/180 are the stencil's coefficients.
+ *
+ * Faces of the medium's boundary that cut through open space can be made
+ * non-reflecting with a perfectly matched layer (PML). The layer is a shell
+ * of extra cells outside the boundary, updated with a split field finite
+ * difference scheme. Each axis' share of the pressure obeys
+ *
+ *     (d/dt + sigma)^2 p_x = c^2 * d^2p/dx^2
+ *
+ * where the absorption sigma grows with the depth into the layer. The
+ * medium sees the layer through the same interface terms as a neighbouring
+ * partition.
+ *
+ * Each step runs in phases separated by barriers, the tasks within a phase
+ * run in parallel on a thread pool (see thread_pool.h). First, all interface
+ * terms and the PML are evaluated, which only read pressure. Then every
+ * partition is updated, which only touches the partition's own cells.
+ * Partitions that are too large for a single task are split into slabs of
+ * cell layers and their transforms into one phase per group of axes.
+ */
+
 #ifndef SIMULATION_H
 #define SIMULATION_H
 
@@ -7,11 +56,151 @@
 
 C_BEGIN
 
+/* The transforms and the threads are internal, see dct.h and thread_pool.h */
+struct dct_plan_t;
+struct dct_cache_t;
+struct thread_pool_t;
+
+/*!
+ * @brief Where the cells of a medium partition are stored in the field
+ * arrays of the simulation. The cells of a partition are stored contiguously,
+ * Z varying fastest, then Y, then X.
+ */
+typedef struct simulation_partition_t
+{
+    int32_t                  dims[3]; /* Number of cells along each axis */
+    size_t                   offset;  /* Index of the partition's first cell */
+    size_t                   count;   /* dims[0] * dims[1] * dims[2] */
+    const struct dct_plan_t* dct;     /* Owned by simulation_t::dct_cache */
+} simulation_partition_t;
+
+/*! Faces of the medium's boundary, used to select where a PML is placed */
+typedef enum simulation_face_e
+{
+    SIMULATION_FACE_NEG_X = 0x01,
+    SIMULATION_FACE_POS_X = 0x02,
+    SIMULATION_FACE_NEG_Y = 0x04,
+    SIMULATION_FACE_POS_Y = 0x08,
+    SIMULATION_FACE_NEG_Z = 0x10,
+    SIMULATION_FACE_POS_Z = 0x20,
+    SIMULATION_FACE_ALL   = 0x3F
+} simulation_face_e;
+
+typedef struct simulation_pml_params_t
+{
+    unsigned faces;         /* simulation_face_e flags, 0 disables the PML */
+    int32_t  thickness;     /* Cells */
+    wsreal_t profile_order; /* Absorption grows with (depth/thickness)^profile_order */
+    wsreal_t reflection;    /* Theoretical reflection coefficient at normal incidence, sets the maximum absorption */
+} simulation_pml_params_t;
+
+/*!
+ * @brief A box of PML cells outside of the medium's boundary. The box is in
+ * cell coordinates of the medium's grid, so it extends past 0 or grid_dims.
+ */
+typedef struct simulation_pml_slab_t
+{
+    int32_t box[6];
+    size_t  offset;         /* Index of the first cell, relative to the first PML cell */
+} simulation_pml_slab_t;
+
+/*!
+ * @brief State of the PML cells. The pressure of PML cell i is stored in
+ * simulation_t::pressure[simulation_t::cell_count + i].
+ */
+typedef struct simulation_pml_t
+{
+    vector_t  slabs;        /* simulation_pml_slab_t */
+    size_t    cell_count;
+    wsreal_t  courant2[3];  /* (c*dt/h)^2 along each axis */
+    size_t*   neighbours;   /* 6 per cell, pressure indices of the -X,+X,-Y,+Y,-Z,+Z neighbours */
+    wsreal_t* split;        /* 3 per cell, the share of the pressure of each axis */
+    wsreal_t* split_prev;   /* 3 per cell, the same one step earlier */
+    wsreal_t* gain;         /* 3 per cell, 1/(1 + sigma*dt) */
+    wsreal_t* decay;        /* 3 per cell, (1 - sigma*dt)/(1 + sigma*dt) */
+    wsreal_t* restore;      /* 3 per cell, 2 - (sigma*dt)^2 */
+} simulation_pml_t;
+
+/*!
+ * @brief The interface forcing of all partitions as one flat list of terms.
+ * Term i adds coefficient[i] * (pressure[source[i]] - pressure[mirror[i]])
+ * to forcing[target[i]], where source is a cell across the face and mirror
+ * is the cell at the same depth on the target's side. The terms are sorted
+ * by the partition the target belongs to.
+ */
+typedef struct simulation_interface_terms_t
+{
+    size_t    count;
+    size_t*   target;
+    size_t*   source;
+    size_t*   mirror;
+    wsreal_t* coefficient;
+    size_t*   offsets;      /* One per partition plus one, the terms of partition p are [offsets[p], offsets[p+1]) */
+} simulation_interface_terms_t;
+
+/*! The phases of a step, in order. See simulation_step() */
+typedef enum simulation_phase_e
+{
+    SIMULATION_PHASE_INTERFACES = 0,
+    SIMULATION_PHASE_FORWARD,
+    SIMULATION_PHASE_MODES,
+    SIMULATION_PHASE_INVERSE,
+
+    SIMULATION_PHASE_COUNT
+} simulation_phase_e;
+
+typedef enum simulation_task_e
+{
+    SIMULATION_TASK_INTERFACE_TERMS, /* Terms [begin, end) */
+    SIMULATION_TASK_PML_FIELDS,      /* Split fields of the PML cells [begin, end) */
+    SIMULATION_TASK_PML_PRESSURE,    /* Pressure of the PML cells [begin, end) */
+    SIMULATION_TASK_PARTITION,       /* Complete update of a partition */
+    SIMULATION_TASK_SLAB_FORWARD,    /* Forward transform along X of a partition's Y layers [begin, end) */
+    SIMULATION_TASK_SLAB_MODES,      /* Transforms along Y and Z and the mode update of a partition's X layers [begin, end) */
+    SIMULATION_TASK_SLAB_INVERSE     /* Inverse transform along X of a partition's Y layers [begin, end) */
+} simulation_task_e;
+
+/*!
+ * @brief A unit of work of one phase of a step. Tasks are set up by
+ * simulation_prepare() and submitted to the thread pool on every step.
+ */
+typedef struct simulation_task_t
+{
+    struct simulation_t* simulation;
+    simulation_task_e    type;
+    size_t               partition; /* Index into simulation_t::partitions, if any */
+    size_t               begin;
+    size_t               end;
+} simulation_task_t;
+
 typedef struct simulation_t
 {
-    wsreal_t max_frequency;
-    int spatial_samples;
+    wsreal_t max_frequency; /* Hz, 0 disables the grid size check of simulation_prepare() */
+    int spatial_samples;    /* Cells per wavelength required at max_frequency, 3 by default */
+    int thread_count;       /* 0 means one thread per hardware thread */
     medium_t medium;
+    struct dct_cache_t* dct_cache; /* Created by the first simulation_prepare() and kept across calls */
+
+    /* Everything below is set up by simulation_prepare() */
+    wsreal_t  time_step;    /* Seconds */
+    uint64_t  step_count;   /* Steps taken since simulation_prepare() */
+    size_t    cell_count;   /* Cells in all partitions */
+    vector_t  partitions;   /* simulation_partition_t, same order as medium.partitions */
+    wsreal_t* pressure;     /* One value per cell */
+    wsreal_t* forcing;      /* Source term of every cell for the next step */
+    wsreal_t* modes;        /* Modal coefficients at the current step */
+    wsreal_t* modes_prev;   /* Modal coefficients at the previous step */
+    wsreal_t* mode_cos;     /* 2cos(w*dt) of every mode */
+    wsreal_t* mode_forcing; /* 2(1 - cos(w*dt))/w^2 of every mode */
+    wsreal_t* scratch;      /* Working memory of the transforms, scratch_size values per worker */
+    size_t    scratch_size; /* Largest dct_plan_t::work_size of all partitions */
+    int32_t*  cell_partitions; /* Partition of every grid cell, -1 if none, Z varying fastest */
+    int32_t   cell_partition_dims[3];
+    simulation_interface_terms_t interface_terms;
+    simulation_pml_params_t pml_params;
+    simulation_pml_t pml;
+    struct thread_pool_t* thread_pool; /* NULL when running on a single thread */
+    vector_t tasks[SIMULATION_PHASE_COUNT]; /* simulation_task_t */
 } simulation_t;
 
 WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
@@ -26,6 +215,109 @@ simulation_construct(simulation_t* simulation);
 WAVESIM_PUBLIC_API void
 simulation_destruct(simulation_t* simulation);
 
+/*!
+ * @brief Sets up the solver for the partitions of simulation->medium, which
+ * must have been built beforehand. Allocates the pressure and modal fields,
+ * precomputes the update coefficients of every mode and the interface terms
+ * of every pair of adjacent partitions, and starts the threads. The medium's
+ * adjacency is rebuilt if it is out of date. The time step is the largest
+ * one that is stable for coupling partitions with the 6th order stencil,
+ * 2 * min(grid_size) / (c_max * sqrt(3 * 1088/180)), or about
+ * 0.47 * min(grid_size) / c_max. All pressures start at 0.
+ *
+ * If simulation->max_frequency is set, the wavelength of that frequency in
+ * the slowest partition must span at least simulation->spatial_samples cells
+ * along every axis, i.e. max(grid_size) <= c_min / (max_frequency *
+ * spatial_samples).
+ *
+ * Call this again after changing the medium.
+ * @return Returns WS_OK on success, WS_ERR_EMPTY_MEDIUM if the medium has no
+ * partitions, WS_ERR_INVALID_SOUND_SPEED if a partition's sound speed isn't
+ * positive, WS_ERR_GRID_TOO_COARSE if the grid can't resolve max_frequency,
+ * WS_ERR_THREAD_CREATE_FAILED or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
+simulation_prepare(simulation_t* simulation);
+
+/*!
+ * @brief Fills in PML parameters for all six faces with a thickness of 8
+ * cells, a quadratic absorption profile and a theoretical reflection
+ * coefficient of 1e-3. Clear bits in params->faces to keep walls rigid.
+ */
+WAVESIM_PUBLIC_API void
+simulation_pml_params_default(simulation_pml_params_t* params);
+
+/*!
+ * @brief Places perfectly matched layers around the selected faces of the
+ * medium's boundary. This takes effect the next time simulation_prepare() is
+ * called. By default, no faces have a PML and all of the boundary reflects
+ * like a rigid wall.
+ *
+ * Slabs along X cover the edges and corners shared with selected Y and Z
+ * faces, slabs along Y the edges shared with selected Z faces, so every PML
+ * cell belongs to exactly one slab. The layer uses the sound speed of the
+ * fastest partition. Boundary cells that aren't part of any partition (e.g.
+ * excluded solid cells) reflect waves inside the layer like a rigid wall.
+ *
+ * The layer absorbs the waves that reach it through the air outside of the
+ * mesh. medium_build_from_mesh() excludes that air by default, so call
+ * medium_set_keep_exterior_air() on simulation->medium before building it
+ * from a mesh, otherwise the layer has nothing to attach to.
+ */
+WAVESIM_PUBLIC_API void
+simulation_set_pml(simulation_t* simulation, const simulation_pml_params_t* params);
+
+/*!
+ * @brief Sets how many threads simulation_step() uses. This takes effect the
+ * next time simulation_prepare() is called. The default is 1. Pass 0 to use
+ * one thread per hardware thread.
+ *
+ * Results don't depend on the number of threads, every value is computed
+ * with the same operations in the same order.
+ */
+WAVESIM_PUBLIC_API void
+simulation_set_thread_count(simulation_t* simulation, int thread_count);
+
+/*!
+ * @brief Advances the simulation by step_count time steps.
+ * @return Returns WS_OK on success, WS_ERR_NOT_PREPARED if
+ * simulation_prepare() wasn't called, or WS_ERR_OUT_OF_MEMORY if the tasks
+ * of a step could not be queued. In the latter case, the step is
+ * incomplete and the simulation should be prepared again.
+ */
+WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
+simulation_step(simulation_t* simulation, int step_count);
+
+/*!
+ * @brief Replaces the pressure field with an initial condition at rest (zero
+ * particle velocity) and resets the step counter.
+ * @param[in] pressure Called with the world space center of every cell,
+ * returns the pressure of that cell.
+ */
+WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
+simulation_set_initial_pressure(simulation_t* simulation,
+                                wsreal_t (*pressure)(void* user_data, const wsreal_t position[3]),
+                                void* user_data);
+
+/*!
+ * @brief Adds a point source sample to the cell containing position. The
+ * amplitude is added to the source term f of the wave equation
+ * p_tt - c^2 * laplace(p) = f for the next step only, so call this once per
+ * step to feed in a signal.
+ * @return Returns WS_OK on success, WS_ERR_OUTSIDE_MEDIUM if position doesn't
+ * lie within any partition, or WS_ERR_NOT_PREPARED.
+ */
+WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
+simulation_add_impulse(simulation_t* simulation, const wsreal_t position[3], wsreal_t amplitude);
+
+/*!
+ * @brief Reads the pressure of the cell containing position.
+ * @return Returns WS_OK on success, WS_ERR_OUTSIDE_MEDIUM if position doesn't
+ * lie within any partition, or WS_ERR_NOT_PREPARED.
+ */
+WAVESIM_PUBLIC_API wsret WS_WARN_UNUSED
+simulation_pressure_at(const simulation_t* simulation, const wsreal_t position[3], wsreal_t* pressure);
+
 C_END
 
 #endif /* SIMULATION_H */
@@ -0,0 +1,90 @@
+/*!
+ * @file bitset.h
+ * @brief Fixed size array of bits.
+ * @page bitset Bitset
+ *
+ * Stores one bit per element, packed into 64-bit words. Besides testing and
+ * setting single bits, contiguous ranges of bits can be tested and set a word
+ * at a time.
+ */
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#include "wavesim/config.h"
+
+C_BEGIN
+
+typedef struct bitset_t
+{
+    size_t    count;  /* number of bits */
+    uint64_t* data;   /* (count+63)/64 words */
+} bitset_t;
+
+/*!
+ * @brief Initialises an existing bitset object. The bitset holds no bits
+ * until bitset_resize() is called.
+ */
+WAVESIM_PRIVATE_API void
+bitset_construct(bitset_t* bitset);
+
+/*!
+ * @brief Frees all memory of the bitset. The bitset can be re-used by calling
+ * bitset_resize().
+ */
+WAVESIM_PRIVATE_API void
+bitset_clear_free(bitset_t* bitset);
+
+/*!
+ * @brief Reallocates the bitset so it holds exactly **count** bits. All bits
+ * are reset to 0.
+ * @return Returns WS_OK on success, WS_ERR_OUT_OF_MEMORY on failure, in which
+ * case the bitset is left empty.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+bitset_resize(bitset_t* bitset, size_t count);
+
+/*!
+ * @brief Resets all bits to 0 without reallocating.
+ */
+WAVESIM_PRIVATE_API void
+bitset_reset(bitset_t* bitset);
+
+/*!
+ * @brief Sets all bits in the range [begin, end) to 1.
+ */
+WAVESIM_PRIVATE_API void
+bitset_set_range(bitset_t* bitset, size_t begin, size_t end);
+
+/*!
+ * @brief Returns non-zero if any bit in the range [begin, end) is 1.
+ */
+WAVESIM_PRIVATE_API int
+bitset_any_in_range(const bitset_t* bitset, size_t begin, size_t end);
+
+/*!
+ * @brief Searches for the first bit that is 0, starting at **begin**.
+ * @return Returns the index of the bit, or bitset_count() if all bits from
+ * **begin** onwards are set.
+ */
+WAVESIM_PRIVATE_API size_t
+bitset_find_unset(const bitset_t* bitset, size_t begin);
+
+#define bitset_count(x) ((x)->count)
+
+/*!
+ * @brief Returns non-zero if the specified bit is set.
+ * @note The index is not bounds checked.
+ */
+#define bitset_test(x, idx) \
+    (((x)->data[(idx) >> 6] >> ((idx) & 63)) & 1u)
+
+#define bitset_set(x, idx) \
+    ((x)->data[(idx) >> 6] |= ((uint64_t)1 << ((idx) & 63)))
+
+#define bitset_unset(x, idx) \
+    ((x)->data[(idx) >> 6] &= ~((uint64_t)1 << ((idx) & 63)))
+
+C_END
+
+#endif /* BITSET_H */
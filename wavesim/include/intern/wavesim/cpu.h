@@ -0,0 +1,29 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "wavesim/config.h"
+
+C_BEGIN
+
+/*!
+ * @brief SIMD instruction sets, ordered so a higher value implies support for
+ * all lower values.
+ */
+typedef enum cpu_simd_e
+{
+    CPU_SIMD_NONE = 0,
+    CPU_SIMD_SSE2,
+    CPU_SIMD_AVX
+} cpu_simd_e;
+
+/*!
+ * @brief Returns the best SIMD instruction set the CPU (and OS) supports.
+ * Always returns CPU_SIMD_NONE if the library was built without SIMD support
+ * (WAVESIM_SIMD) or for a platform other than x86.
+ */
+WAVESIM_PRIVATE_API cpu_simd_e
+cpu_detect_simd(void);
+
+C_END
+
+#endif /* CPU_H */
@@ -0,0 +1,176 @@
+/*!
+ * @file dct.h
+ * @brief Orthonormal 3D DCT-II/DCT-III of box shaped blocks of cells.
+ * @page dct DCT
+ *
+ * The modes of a box with rigid walls are the basis functions of the DCT-II,
+ * so the simulation transforms every partition between pressure and modal
+ * space twice per step. The 3D transform is separable and done as 1D
+ * transforms of every line along X, Y and Z.
+ *
+ * Everything that only depends on the size of a transform (basis matrices,
+ * FFT factorizations and twiddle factors) is precomputed in a plan. Plans are
+ * immutable once created and are shared through a dct_cache_t, since a
+ * medium typically consists of thousands of partitions but only a handful of
+ * distinct sizes.
+ *
+ * Short lines and lines whose length has large prime factors are transformed
+ * by multiplying with the precomputed basis matrix. All other lengths use
+ * Makhoul's algorithm, which maps the DCT-II onto a complex FFT of the same
+ * length. The FFT is a mixed radix decimation in time FFT with a dedicated
+ * radix-2 butterfly.
+ */
+
+#ifndef DCT_H
+#define DCT_H
+
+#include "wavesim/config.h"
+#include "wavesim/vector.h"
+
+C_BEGIN
+
+/*! Lines up to this length are always transformed with the basis matrix */
+#define DCT_DIRECT_MAX_LENGTH 8
+
+/*! Lengths with a prime factor larger than this use the basis matrix */
+#define DCT_FFT_MAX_RADIX 7
+
+/*! Enough for any length that fits into an int32_t */
+#define DCT_MAX_FACTORS 32
+
+typedef enum dct_method_e
+{
+    DCT_AUTO = 0,
+    DCT_DIRECT,
+    DCT_FFT
+} dct_method_e;
+
+/*!
+ * @brief Precomputed data for transforming lines of a single length.
+ */
+typedef struct dct_plan_1d_t
+{
+    int32_t      length;
+    dct_method_e method;     /* DCT_DIRECT or DCT_FFT, never DCT_AUTO */
+    wsreal_t*    scale;      /* length entries, sqrt(1/n) for k=0 and sqrt(2/n) otherwise */
+    /* DCT_DIRECT */
+    wsreal_t*    basis;      /* length*length entries, basis[k*n+i] = scale[k]*cos(pi*k*(i+1/2)/n) */
+    /* DCT_FFT */
+    wsreal_t*    twiddles;   /* 2*length entries, exp(-2*pi*i*j/n) as interleaved re,im */
+    wsreal_t*    rotations;  /* 2*length entries, exp(-pi*i*k/(2n)) as interleaved re,im */
+    int32_t      factors[2*DCT_MAX_FACTORS]; /* Pairs of radix and remaining length */
+    int32_t      max_radix;
+} dct_plan_1d_t;
+
+/*!
+ * @brief Precomputed data for transforming blocks of nx*ny*nz values, stored
+ * with Z varying fastest, then Y, then X.
+ */
+typedef struct dct_plan_t
+{
+    int32_t              dims[3];
+    const dct_plan_1d_t* axes[3];   /* Owned by the cache */
+    size_t               work_size; /* Number of wsreal_t the transforms need as working memory */
+} dct_plan_t;
+
+/*!
+ * @brief Owns all plans created so far. Plans are never freed or moved until
+ * the cache is destroyed, so pointers to them remain valid.
+ */
+typedef struct dct_cache_t
+{
+    vector_t plans_1d; /* dct_plan_1d_t*, sorted by length */
+    vector_t plans;    /* dct_plan_t*, sorted by dims */
+} dct_cache_t;
+
+/*!
+ * @brief Precomputes the transform of lines of the specified length.
+ * @param[in] method DCT_AUTO picks the fastest method for the length. The
+ * other values force a specific method, which is mostly useful for testing.
+ * A length of 1 always uses DCT_DIRECT.
+ * @return Returns WS_OK on success or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+dct_plan_1d_construct(dct_plan_1d_t* plan, int32_t length, dct_method_e method);
+
+WAVESIM_PRIVATE_API void
+dct_plan_1d_destruct(dct_plan_1d_t* plan);
+
+/*!
+ * @brief Returns the number of wsreal_t dct_1d_forward() and
+ * dct_1d_inverse() need as working memory.
+ */
+WAVESIM_PRIVATE_API size_t
+dct_plan_1d_work_size(const dct_plan_1d_t* plan);
+
+/*!
+ * @brief Orthonormal DCT-II of a single line. in and out must not overlap.
+ */
+WAVESIM_PRIVATE_API void
+dct_1d_forward(const dct_plan_1d_t* plan, const wsreal_t* in, wsreal_t* out, wsreal_t* work);
+
+/*!
+ * @brief Orthonormal DCT-III of a single line, the inverse of
+ * dct_1d_forward(). in and out must not overlap.
+ */
+WAVESIM_PRIVATE_API void
+dct_1d_inverse(const dct_plan_1d_t* plan, const wsreal_t* in, wsreal_t* out, wsreal_t* work);
+
+WAVESIM_PRIVATE_API void
+dct_cache_construct(dct_cache_t* cache);
+
+/*!
+ * @brief Frees all plans. Pointers previously returned by
+ * dct_cache_get_plan() become invalid.
+ */
+WAVESIM_PRIVATE_API void
+dct_cache_clear_free(dct_cache_t* cache);
+
+/*!
+ * @brief Looks up the plan for blocks of the specified size and creates it
+ * if it doesn't exist yet. 1D plans are shared between all 3D plans with
+ * the same line length.
+ * @return Returns WS_OK on success or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+dct_cache_get_plan(dct_cache_t* cache, const int32_t dims[3], const dct_plan_t** plan);
+
+/*!
+ * @brief In-place orthonormal 3D DCT-II of a block.
+ * @param[in] work At least plan->work_size values. Threads transforming
+ * blocks concurrently need separate working memory but can share the plan.
+ */
+WAVESIM_PRIVATE_API void
+dct_forward(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work);
+
+/*!
+ * @brief In-place orthonormal 3D DCT-III of a block, the inverse of
+ * dct_forward(). The axes are transformed in reverse order, Z first.
+ */
+WAVESIM_PRIVATE_API void
+dct_inverse(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work);
+
+/*!
+ * @brief In-place 1D DCT-II of some of the lines of a block along one axis.
+ * Only lines in the layers [begin, end) are transformed, where layers are
+ * taken along Y for lines along X and along X for lines along Y or Z.
+ *
+ * This lets several threads share the transform of a large block: lines of
+ * one axis are independent of each other, but all of them must be done
+ * before the next axis starts. Doing the axes in the order X, Y, Z gives
+ * exactly the same result as dct_forward().
+ */
+WAVESIM_PRIVATE_API void
+dct_forward_axis(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work, int axis, int32_t begin, int32_t end);
+
+/*!
+ * @brief In-place 1D DCT-III of some of the lines of a block along one axis,
+ * see dct_forward_axis(). Doing the axes in the order Z, Y, X gives exactly
+ * the same result as dct_inverse().
+ */
+WAVESIM_PRIVATE_API void
+dct_inverse_axis(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work, int axis, int32_t begin, int32_t end);
+
+C_END
+
+#endif /* DCT_H */
@@ -0,0 +1,178 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "wavesim/config.h"
+#include "wavesim/aabb.h"
+#include "wavesim/attribute.h"
+#include "wavesim/material.h"
+
+C_BEGIN
+
+typedef struct mesh_t mesh_t;
+
+/*!
+ * @brief Per cell flags.
+ */
+typedef enum grid_cell_flags_e
+{
+    GRID_CELL_SURFACE  = 0x01, /* At least one face of the mesh touches the cell */
+    GRID_CELL_INSIDE   = 0x02, /* The cell's center lies inside of the closed mesh */
+    GRID_CELL_EXTERIOR = 0x04, /* Air connected to the boundary of the grid */
+    GRID_CELL_EXCLUDED = 0x08  /* Exterior or solid cell, doesn't need simulating */
+} grid_cell_flags_e;
+
+/*!
+ * @brief Dense 3D array of cells spanning a bounding box.
+ *
+ * Every cell is classified exactly once when the grid is built. Cells store
+ * the ID of their material in the grid's material table, so comparing two
+ * cells is a single integer comparison. Cells are
+ * addressed with integer coordinates (x,y,z), where (0,0,0) is the cell in
+ * the minimum (left, bottom, front) corner of the grid.
+ */
+typedef struct grid_t
+{
+    vec3_t           origin;    /* World position of the minimum corner of cell (0,0,0) */
+    vec3_t           cell_size; /* x,y,z dimensions of a single cell */
+    int32_t          dims[3];   /* Number of cells along each axis */
+    material_id_t*   cells;     /* dims[0]*dims[1]*dims[2] material IDs */
+    uint8_t*         flags;     /* dims[0]*dims[1]*dims[2] combinations of grid_cell_flags_e */
+    size_t           excluded_count; /* Number of cells flagged GRID_CELL_EXCLUDED */
+    material_table_t materials; /* Every distinct attribute of the grid's cells */
+} grid_t;
+
+/*!
+ * @brief Calculates the linear index of a cell in the cell array.
+ */
+#define GRID_INDEX(grid, x, y, z) \
+    (((size_t)(x) * (size_t)(grid)->dims[1] + (size_t)(y)) * (size_t)(grid)->dims[2] + (size_t)(z))
+
+/*!
+ * @brief Returns the total number of cells in the grid.
+ */
+#define grid_cell_count(grid) \
+    ((size_t)(grid)->dims[0] * (size_t)(grid)->dims[1] * (size_t)(grid)->dims[2])
+
+WAVESIM_PRIVATE_API void
+grid_construct(grid_t* grid);
+
+WAVESIM_PRIVATE_API void
+grid_destruct(grid_t* grid);
+
+WAVESIM_PRIVATE_API void
+grid_clear(grid_t* grid);
+
+/*!
+ * @brief Subdivides the specified bounding box into cells and allocates them,
+ * without classifying them. See grid_classify_cells().
+ *
+ * Cells that would only partially fit into the bounding box are not part of
+ * the grid.
+ * @param[in] grid The grid to allocate. Any previous data is cleared.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+grid_allocate(grid_t* grid,
+              const wsreal_t boundary[6],
+              const wsreal_t cell_size[3]);
+
+/*!
+ * @brief Determines the attribute of every cell with an x coordinate in the
+ * range [x_begin, x_end). Different ranges of the same grid can be classified
+ * concurrently.
+ *
+ * Instead of searching for the faces touching each cell, every face of the
+ * mesh is conservatively rasterized into the cells it touches. These cells
+ * are flagged with GRID_CELL_SURFACE and receive the Shepard weighted
+ * (inverse squared distance) average of the face's vertex attributes. All
+ * other cells are air. The work done scales with the surface area of the
+ * mesh instead of the volume of the grid. The resulting attributes are
+ * interned into the grid's material table.
+ * @note Ranges classified concurrently must use separate grids (e.g. views
+ * into the same cell array), since they all add to the material table.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+grid_classify_cells(grid_t* grid,
+                    const mesh_t* mesh,
+                    int32_t x_begin,
+                    int32_t x_end);
+
+/*!
+ * @brief Subdivides the specified bounding box into cells and determines the
+ * attribute of every cell by rasterizing the faces of the mesh into it.
+ *
+ * Cells that would only partially fit into the bounding box are not part of
+ * the grid.
+ * @param[in] grid The grid to build. Any previous data is cleared.
+ * @param[in] mesh The mesh to classify.
+ * @param[in] boundary The volume to subdivide into cells.
+ * @param[in] cell_size The x,y,z dimensions of a single cell.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+grid_build_from_mesh(grid_t* grid,
+                     const mesh_t* mesh,
+                     const wsreal_t boundary[6],
+                     const wsreal_t cell_size[3]);
+
+/*!
+ * @brief Flags cells that don't need to be simulated with
+ * GRID_CELL_EXCLUDED. The mesh is assumed to be closed.
+ *
+ * The mesh must model the solid volume of the scene: walls have a thickness
+ * and the air of a room is a cavity in the mesh, bounded by the inner faces
+ * of its walls. Cells whose center lies inside of the mesh are solid, unless
+ * a face touches them. The air outside of the mesh that is connected to the
+ * boundary of the grid is found with a flood fill and is excluded as well.
+ * What remains are the surface cells and the cavities, e.g. the rooms of a
+ * building.
+ * @note A room modelled as a single closed shell doesn't follow this
+ * convention. Its air lies inside of the mesh and is excluded as solid.
+ * @note The grid must have been classified first.
+ * @param[in] keep_exterior If non-zero, the exterior air is flagged with
+ * GRID_CELL_EXTERIOR but not excluded. Waves can then travel through it to
+ * the boundary of the grid, e.g. into a perfectly matched layer.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+grid_exclude_cells(grid_t* grid, const mesh_t* mesh, int keep_exterior);
+
+/*!
+ * @brief Calculates the world space bounding box of a cell.
+ */
+WAVESIM_PRIVATE_API aabb_t
+grid_cell_aabb(const grid_t* grid, int32_t x, int32_t y, int32_t z);
+
+/*!
+ * @brief Determines which cell a point in world space falls into. Points
+ * lying on a cell boundary are rounded to the nearest cell corner, which
+ * makes this safe to use on cell bounding boxes that have accumulated small
+ * floating point errors.
+ * @param[out] cell The x,y,z coordinates of the cell are written to this
+ * parameter. These can lie outside of the grid.
+ * @param[in] point The world space position of a cell's minimum corner.
+ */
+WAVESIM_PRIVATE_API void
+grid_cell_at(const grid_t* grid, int32_t cell[3], const wsreal_t point[3]);
+
+/*!
+ * @brief Returns the material ID of the specified cell.
+ * @note The coordinates are not bounds checked.
+ */
+#define grid_cell_material(grid, x, y, z) \
+    ((grid)->cells[GRID_INDEX(grid, x, y, z)])
+
+/*!
+ * @brief Returns the attribute of the specified cell.
+ * @note The coordinates are not bounds checked.
+ */
+#define grid_cell_attribute(grid, x, y, z) \
+    material_table_get(&(grid)->materials, grid_cell_material(grid, x, y, z))
+
+/*!
+ * @brief Returns a pointer to the flags of the specified cell.
+ * @note The coordinates are not bounds checked.
+ */
+#define grid_cell_flags(grid, x, y, z) \
+    (&(grid)->flags[GRID_INDEX(grid, x, y, z)])
+
+C_END
+
+#endif /* GRID_H */
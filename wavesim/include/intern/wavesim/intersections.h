@@ -2,6 +2,7 @@
 #define INTERSECTIONS_H
 
 #include "wavesim/config.h"
+#include "wavesim/cpu.h"
 #include "wavesim/vec3.h"
 
 C_BEGIN
@@ -28,6 +29,42 @@ intersect_point_aabb_test(const wsreal_t point[3], const wsreal_t aabb[6]);
 WAVESIM_PRIVATE_API int
 intersect_aabb_aabb_test(const wsreal_t aabb1[6], const wsreal_t aabb2[6]);
 
+/*!
+ * @brief Eight bounding boxes in structure-of-arrays layout, so all of them
+ * can be tested against another box in one go. min[a][i] and max[a][i] are
+ * the bounds of box i along axis a.
+ */
+typedef struct aabb8_t
+{
+    wsreal_t min[3][8];
+    wsreal_t max[3][8];
+} aabb8_t;
+
+/*!
+ * @brief Tests eight bounding boxes against another bounding box at once.
+ * @param[in] boxes The eight boxes to test.
+ * @param[in] aabb x1,y1,z1,x2,y2,z2 coordinates of the box to test against.
+ * @param[in] inclusive If 0, boxes that only touch don't count as
+ * intersecting, same as intersect_aabb_aabb_test(). If non-zero they do.
+ * @return Returns a mask with bit i set if box i intersects aabb.
+ * @note Uses SSE2 or AVX if enabled with intersect_select_simd().
+ */
+WAVESIM_PRIVATE_API unsigned
+intersect_aabb8_aabb_mask(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive);
+
+/*!
+ * @brief Selects which instruction set intersect_aabb8_aabb_mask() uses. The
+ * default is CPU_SIMD_NONE. wavesim_init() selects the best one the CPU
+ * supports.
+ * @param[in] simd The highest instruction set to use. It is lowered to what
+ * the CPU and the build support: SIMD is only available for float and double
+ * precision on x86 with GCC or Clang.
+ * @return Returns the instruction set that is actually used.
+ * @note This is not thread safe. Call it before starting any queries.
+ */
+WAVESIM_PRIVATE_API cpu_simd_e
+intersect_select_simd(cpu_simd_e simd);
+
 /*!
  * @brief Calculates the intersection point of a line and a plane.
  * @param[out] result x,y,z coordinates of the point of intersection.
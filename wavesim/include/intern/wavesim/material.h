@@ -0,0 +1,90 @@
+/*!
+ * @file material.h
+ * @brief Palette of unique attributes, referenced by 16-bit IDs.
+ * @page material Material Table
+ *
+ * Cells and partitions don't store their acoustic attributes directly.
+ * Instead, every distinct attribute is interned into a material table once
+ * and referred to by its material ID. Two cells share a material if and only
+ * if they have the same ID, which turns attribute comparisons into integer
+ * comparisons.
+ *
+ * Attributes are quantized before they are interned, so values that only
+ * differ by floating point noise (e.g. after interpolation) map to the same
+ * material.
+ */
+
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "wavesim/config.h"
+#include "wavesim/attribute.h"
+#include "wavesim/vector.h"
+
+C_BEGIN
+
+typedef uint16_t material_id_t;
+
+/*! Maximum number of materials a table can hold */
+#define MATERIAL_MAX_COUNT 65536
+
+/*! Attributes are rounded to multiples of 1/MATERIAL_QUANTIZATION */
+#define MATERIAL_QUANTIZATION 1024
+
+typedef struct material_table_t
+{
+    vector_t  materials;  /* attribute_t, indexed by material ID */
+    vector_t  keys;       /* material_key_t, quantized attributes in the same order */
+    uint32_t* slots;      /* Open addressing hash table, 0 = empty, otherwise material ID + 1 */
+    size_t    slot_count; /* Always a power of 2 */
+} material_table_t;
+
+/*!
+ * @brief Initialises an existing material table. The table is empty.
+ */
+WAVESIM_PRIVATE_API void
+material_table_construct(material_table_t* table);
+
+/*!
+ * @brief Frees all memory held by the table. The table can be re-used.
+ */
+WAVESIM_PRIVATE_API void
+material_table_clear_free(material_table_t* table);
+
+/*!
+ * @brief Looks up the material ID of an attribute, adding it to the table if
+ * it doesn't exist yet.
+ * @param[out] id The ID of the material is written to this parameter.
+ * @return Returns WS_OK on success, WS_ERR_TOO_MANY_MATERIALS if the table
+ * already holds MATERIAL_MAX_COUNT materials or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+material_table_intern(material_table_t* table, const attribute_t* attribute, material_id_t* id);
+
+/*!
+ * @brief Interns every material of source into table.
+ * @param[out] remap If not NULL, remap[i] receives the ID in table of material
+ * i of source. Must have room for material_table_count(source) entries.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+material_table_merge(material_table_t* table, const material_table_t* source, material_id_t* remap);
+
+/*!
+ * @brief Rounds every component of the attribute to the precision the table
+ * distinguishes materials at.
+ */
+WAVESIM_PRIVATE_API void
+material_quantize(attribute_t* attribute);
+
+#define material_table_count(table) vector_count(&(table)->materials)
+
+/*!
+ * @brief Returns a pointer to the (quantized) attribute of a material.
+ * @note The ID is not bounds checked.
+ */
+#define material_table_get(table, id) \
+    ((const attribute_t*)(table)->materials.data + (id))
+
+C_END
+
+#endif /* MATERIAL_H */
@@ -4,29 +4,65 @@
 #include "wavesim/config.h"
 #include "wavesim/vector.h"
 #include "wavesim/aabb.h"
+#include "wavesim/bitset.h"
+#include "wavesim/material.h"
 
 C_BEGIN
 
+typedef struct grid_t grid_t;
 typedef struct mesh_t mesh_t;
 typedef struct medium_t medium_t;
-typedef struct octree_t octree_t;
-typedef wsret (*medium_decomposition_func)(medium_t*, const octree_t*, const medium_t*);
+typedef wsret (*medium_decomposition_func)(medium_t*, const grid_t*, const medium_t*);
 
 typedef struct medium_t
 {
     aabb_t                       boundary;
     vec3_t                       grid_size;
+    int32_t                      grid_dims[3]; /* Number of cells along each axis */
     vector_t                     partitions; /* medium_partition_t */
+    material_table_t             materials;  /* Materials referenced by the partitions */
+    vector_t                     adjacency_offsets; /* size_t, partition count + 1 entries, see medium_build_adjacency() */
+    vector_t                     interfaces; /* medium_interface_t */
+    bitset_t                     occupied;   /* One bit per cell, set if a partition covers it or it is excluded */
+    size_t                       excluded_cell_count; /* Solid and, unless kept, exterior cells, see grid_exclude_cells() */
     medium_decomposition_func    decompose;
+    uint64_t                     decomposition_seed; /* Used by randomized decomposition methods */
+    int                          thread_count; /* 0 means one thread per hardware thread */
+    int                          keep_exterior_air; /* See medium_set_keep_exterior_air() */
+    wsreal_t                     sound_speed; /* Of partitions built from a mesh, see medium_set_sound_speed() */
 } medium_t;
 
+/*!
+ * @brief A box shaped region of the medium in which all cells share the same
+ * material. The material's attributes are stored in medium_t::materials.
+ *
+ * The box is stored in integer cell coordinates of the medium's grid (see
+ * medium_t::grid_size). The minimum coordinates are inclusive and the maximum
+ * coordinates are exclusive, i.e. the partition covers box[3]-box[0] cells
+ * along the X axis. Use medium_partition_aabb() to get the box in world space.
+ */
 typedef struct medium_partition_t
 {
-    aabb_t aabb;
-    wsreal_t sound_speed;
-    vector_t adcacent_partitions; /* int32_t (indices into medium->partitions) */
+    int32_t       box[6];
+    material_id_t material;
+    wsreal_t      sound_speed;
 } medium_partition_t;
 
+/*!
+ * @brief The face shared by two adjacent partitions, as seen from one of
+ * them.
+ *
+ * The rectangle is stored as a degenerate box in cell coordinates, where the
+ * minimum and maximum coordinates along the interface's normal axis are equal.
+ */
+typedef struct medium_interface_t
+{
+    int32_t partition; /* Index of the neighbouring partition */
+    int32_t rect[6];   /* The shared rectangle, rect[axis] == rect[axis+3] */
+    int32_t axis;      /* Axis normal to the interface, 0=X, 1=Y, 2=Z */
+    int32_t side;      /* 1 if the neighbour lies in positive direction along the axis, -1 otherwise */
+} medium_interface_t;
+
 WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
 medium_create(medium_t** medium);
 
@@ -42,23 +78,99 @@ medium_destruct(medium_t* medium);
 WAVESIM_PRIVATE_API void
 medium_clear(medium_t* medium);
 
-WAVESIM_PRIVATE_API int
-medium_add_partition(medium_t* medium, const wsreal_t bounding_box[6], wsreal_t sound_speed);
+WAVESIM_PRIVATE_API wsret
+medium_add_partition(medium_t* medium, const int32_t box[6], material_id_t material, wsreal_t sound_speed);
+
+/*!
+ * @brief Calculates the world space bounding box of a partition.
+ */
+WAVESIM_PRIVATE_API aabb_t
+medium_partition_aabb(const medium_t* medium, const medium_partition_t* partition);
 
 WAVESIM_PRIVATE_API void
 medium_set_decomposition_method(medium_t* medium,
                                 medium_decomposition_func method);
 
+/*!
+ * @brief Seeds the random number generator of randomized decomposition
+ * methods. Building the same mesh with the same seed always produces the same
+ * partitions.
+ */
+WAVESIM_PRIVATE_API void
+medium_set_decomposition_seed(medium_t* medium, uint64_t seed);
+
+/*!
+ * @brief Sets how many threads medium_build_from_mesh() uses. The default is
+ * 1. Pass 0 to use one thread per hardware thread.
+ *
+ * With more than one thread, the grid is split into bricks of whole cell
+ * layers along the X axis. Each brick is classified and decomposed on its own
+ * thread. Afterwards, partitions cut in two by a brick seam are merged again.
+ */
+WAVESIM_PRIVATE_API void
+medium_set_thread_count(medium_t* medium, int thread_count);
+
+/*!
+ * @brief Sets whether medium_build_from_mesh() keeps the air outside of the
+ * mesh that is connected to the medium's boundary. It is excluded by
+ * default, since it is of no interest inside of a closed building. It is
+ * needed if waves are to leave the medium, e.g. through a perfectly matched
+ * layer, which can only attach to partitions touching the boundary.
+ */
+WAVESIM_PRIVATE_API void
+medium_set_keep_exterior_air(medium_t* medium, int keep);
+
+/*!
+ * @brief Sets the sound speed in m/s that medium_build_from_mesh() assigns to
+ * every partition. The default is 343, the speed of sound in air at 20 C.
+ */
+WAVESIM_PRIVATE_API void
+medium_set_sound_speed(medium_t* medium, wsreal_t sound_speed);
+
 WAVESIM_PRIVATE_API wsret
 medium_decompose_systematic(medium_t* medium,
-                            const octree_t* octree,
+                            const grid_t* grid,
                             const medium_t* mediumdef);
 
+/*!
+ * @brief Repeatedly picks a random cell that isn't covered by a partition yet
+ * and greedily grows it into the largest box of uniform cells it can. Every
+ * cell ends up in exactly one partition. Runtime is close to linear in the
+ * number of cells, at the cost of producing more partitions than
+ * medium_decompose_systematic(). See medium_set_decomposition_seed().
+ */
 WAVESIM_PRIVATE_API wsret
 medium_decompose_greedy_random(medium_t* medium,
-                               const octree_t* octree,
+                               const grid_t* grid,
                                const medium_t* mediumdef);
 
+/*!
+ * @brief Finds every pair of partitions sharing part of a face and stores
+ * the shared rectangles in compressed sparse row layout. The interfaces of
+ * partition i are interfaces[adjacency_offsets[i]] up to (excluding)
+ * interfaces[adjacency_offsets[i+1]], sorted by neighbour index. The graph
+ * is symmetric, i.e. every interface is stored once for each side.
+ *
+ * This is called by medium_build_from_mesh(). Call it again if partitions
+ * were added manually.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+medium_build_adjacency(medium_t* medium);
+
+/*!
+ * @brief Returns the interfaces of a partition and writes their number to
+ * count. See medium_build_adjacency().
+ */
+WAVESIM_PRIVATE_API const medium_interface_t*
+medium_partition_interfaces(const medium_t* medium, size_t partition_idx, size_t* count);
+
+/*!
+ * @brief Classifies the cells of the medium's boundary and decomposes them
+ * into partitions. The solid volume of the (closed) mesh is excluded and not
+ * covered by any partition, so rooms must be cavities in the mesh. Exterior
+ * air is excluded as well, unless medium_set_keep_exterior_air() was called.
+ * See grid_exclude_cells().
+ */
 WAVESIM_PRIVATE_API wsret
 medium_build_from_mesh(medium_t* medium,
                        const medium_t* mediumdef,
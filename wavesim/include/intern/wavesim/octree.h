@@ -9,20 +9,120 @@ C_BEGIN
 
 typedef struct mesh_t mesh_t;
 
+/*!
+ * @brief A node of the octree. Nodes don't store their bounding box, it is
+ * derived from the root's bounding box while traversing, see
+ * octree_child_aabb().
+ */
 typedef struct octree_node_t
 {
-    struct octree_node_t* children;
-    struct octree_node_t* parent;
-    aabb_t                aabb;
-    vector_t              index_buffer;
+    uint32_t first_child; /* Index of the first of 8 consecutive children, 0 if this is a leaf */
+    uint32_t face_offset; /* First entry in octree_t::face_ids */
+    uint32_t face_count;  /* Number of faces stored with this node. Always 0 for inner nodes unless the octree is loose */
 } octree_node_t;
 
+/*!
+ * @brief Controls when octree_build_from_mesh_params() stops subdividing. A
+ * node becomes a leaf as soon as any of the following holds:
+ *   - It has max_faces_per_leaf faces or less.
+ *   - It is max_depth levels below the root.
+ *   - Its children would be smaller than min_node_extent along every axis.
+ *   - cost_heuristic is set and subdividing is estimated to make queries
+ *     more expensive, see below.
+ *
+ * The cost heuristic compares the cost of testing every face of the node
+ * against the cost of visiting the node plus testing the faces of the
+ * children a query is expected to reach. The latter is weighted by the
+ * surface area of each child relative to its parent, which is 1/4 for an
+ * octant. Faces straddling the children's boundaries are counted once per
+ * child, so splits that mostly duplicate faces are rejected.
+ *
+ * With a looseness of 0, a face is stored in every leaf it overlaps. Large
+ * faces end up in many leaves this way. A looseness > 0 builds a loose
+ * octree instead: the bounds of every node are grown by looseness/2 times
+ * its size on each side (see octree_loose_aabb()), and each face is stored
+ * exactly once, in the deepest node whose grown bounds contain it. This
+ * means inner nodes hold faces too. 1 is a common choice, which makes the
+ * grown bounds twice as large as the node.
+ */
+typedef struct octree_build_params_t
+{
+    int      max_depth;
+    uint32_t max_faces_per_leaf;
+    wsreal_t min_node_extent;
+    int      cost_heuristic;
+    wsreal_t traversal_cost;     /* Cost of visiting a node relative to testing one face */
+    wsreal_t looseness;          /* 0 for a regular octree */
+} octree_build_params_t;
+
+/*!
+ * @brief Cumulative counters of all queries done on an octree since it was
+ * built, or since octree_reset_query_counters().
+ */
+typedef struct octree_query_counters_t
+{
+    uint64_t queries;            /* Number of box and point-in-mesh queries */
+    uint64_t nodes_visited;
+    uint64_t face_references;    /* Face IDs read from the visited nodes */
+    uint64_t duplicates_skipped; /* References to faces the same query had already seen */
+} octree_query_counters_t;
+
+/*!
+ * @brief Linearized octree over the faces of a mesh.
+ *
+ * All nodes live in one contiguous array with the root at index 0. The 8
+ * children of a node are stored next to each other in Morton order (see
+ * octree_child_aabb()), and nodes are laid out level by level. The face lists
+ * of all leaves are packed into a single array of face indices. Building or
+ * clearing the tree only (re)allocates these two arrays, plus one visited
+ * mark per face of the mesh used to deduplicate query results. Subtrees built
+ * in parallel (see octree_set_parallel_build()) are stored level by level
+ * after the nodes above them.
+ */
 typedef struct octree_t
 {
     const mesh_t*    mesh;
-    octree_node_t    root;
+    aabb_t           aabb;       /* Bounding box of the root node */
+    vector_t         nodes;      /* octree_node_t */
+    vector_t         face_ids;   /* wsib_t, index of a face in the mesh */
+    uint32_t*        face_marks; /* One per face of the mesh, equal to query_epoch if visited by the current query */
+    uint32_t         query_epoch;
+    wsreal_t         looseness;      /* See octree_build_params_t */
+    octree_query_counters_t counters;
+    int              thread_count;   /* 0 means one thread per hardware thread */
+    int              parallel_depth; /* Depth at which the tree is split into subtrees */
 } octree_t;
 
+#define OCTREE_STATS_DEPTHS       32
+#define OCTREE_STATS_FACE_BUCKETS 16
+
+/*!
+ * @brief Describes the shape of an octree, see octree_stats().
+ */
+typedef struct octree_stats_t
+{
+    uint32_t node_count;
+    uint32_t leaf_count;
+    uint32_t depth;                /* Number of levels, 1 if the root is a leaf */
+    uint32_t max_faces_per_leaf;
+    uint32_t mesh_face_count;
+    uint64_t face_references;      /* Entries in the face ID array, i.e. faces summed over all nodes */
+    wsreal_t duplication;          /* face_references / mesh_face_count, 1 if no face is stored twice */
+    size_t   memory_bytes;         /* Memory allocated by the octree, including the octree_t itself */
+
+    /* Number of nodes per level. The last entry also counts all deeper levels */
+    uint32_t nodes_per_depth[OCTREE_STATS_DEPTHS];
+
+    /*
+     * Number of leaves per face count in power of two buckets: entry 0 counts
+     * empty leaves, entry b counts leaves holding [2^(b-1), 2^b) faces. The
+     * last entry also counts all larger leaves.
+     */
+    uint32_t leaves_per_face_count[OCTREE_STATS_FACE_BUCKETS];
+
+    octree_query_counters_t counters;
+} octree_stats_t;
+
 WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
 octree_create(octree_t** octree);
 
@@ -38,47 +138,172 @@ octree_destruct(octree_t* octree);
 WAVESIM_PRIVATE_API void
 octree_clear(octree_t* octree);
 
-WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
-octree_subdivide(octree_t* octree, octree_node_t* node);
+/*!
+ * @brief Calculates the bounding box of a child from its parent's bounding
+ * box. Children are numbered in Morton order, i.e. child_idx = x*4 + y*2 + z
+ * where x, y and z are 0 for the lower half and 1 for the upper half along
+ * each axis.
+ */
+WAVESIM_PRIVATE_API aabb_t
+octree_child_aabb(const aabb_t* parent, int child_idx);
 
-#define octree_face(octree, idx) \
-    *(face_t**)vector_get_element(&octree->faces, idx)
+/*!
+ * @brief Returns the bounds that the faces of a node are contained in. For a
+ * loose octree these are the node's bounds, grown by looseness/2 times the
+ * node's size on each side. For a regular octree (looseness 0) they are
+ * the node's bounds.
+ */
+WAVESIM_PRIVATE_API aabb_t
+octree_loose_aabb(const aabb_t* node_bb, wsreal_t looseness);
+
+#define octree_node(octree, idx) \
+    ((const octree_node_t*)(octree)->nodes.data + (idx))
+
+#define octree_node_is_leaf(node) \
+    ((node)->first_child == 0)
 
 #define octree_face_count(octree) \
     octree->mesh->ib_count / 3
 
+/*!
+ * @brief Fills in build parameters suited to the size of the mesh.
+ *
+ * Leaves hold up to 8 faces and the cost heuristic is enabled. The maximum
+ * depth grows with the face count: the faces of a typical scene lie on
+ * surfaces, so every level divides the faces per node by about 4, not 8.
+ * @param[in] min_node_extent Nodes aren't subdivided into children smaller
+ * than this. Pass the grid size of the simulation, as no query is finer than
+ * a single cell, or 0 to not limit the node size.
+ */
+WAVESIM_PRIVATE_API void
+octree_build_params_default(octree_build_params_t* params,
+                            const mesh_t* mesh,
+                            wsreal_t min_node_extent);
+
+/*!
+ * @brief Builds the octree from a mesh, subdividing nodes until they hold a
+ * single face or max_depth is reached.
+ */
 WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
 octree_build_from_mesh(octree_t* octree, const mesh_t* mesh, int max_depth);
 
+/*!
+ * @brief Builds the octree from a mesh, see octree_build_params_t for how
+ * the parameters affect subdividing.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+octree_build_from_mesh_params(octree_t* octree,
+                              const mesh_t* mesh,
+                              const octree_build_params_t* params);
+
+/*!
+ * @brief Sets how many threads octree_build_from_mesh() uses. The default is
+ * 1. Pass 0 to use one thread per hardware thread.
+ *
+ * With more than one thread, the levels down to parallel_depth are built
+ * first. Every node at parallel_depth that needs further subdividing becomes
+ * an independent subtree (up to 8^parallel_depth of them), and the subtrees
+ * are spread over the threads. Each subtree is built into memory of its own,
+ * so the threads don't share any data until the subtrees are grafted onto the
+ * tree. The result is the same tree as a single threaded build, apart from
+ * the order the nodes are stored in.
+ */
+WAVESIM_PRIVATE_API void
+octree_set_parallel_build(octree_t* octree, int thread_count, int parallel_depth);
+
+/*!
+ * @brief Gathers statistics about the structure of the octree, how much
+ * memory it uses, and the query counters. Walks the whole tree, so this is
+ * meant for diagnostics, not for calling in between queries.
+ */
+WAVESIM_PRIVATE_API void
+octree_stats(const octree_t* octree, octree_stats_t* stats);
+
+/*!
+ * @brief Resets octree_t::counters. Building the octree resets them too.
+ */
+WAVESIM_PRIVATE_API void
+octree_reset_query_counters(octree_t* octree);
+
 /*!
  * @brief Queries the octree for which faces intersect the specified bounding
  * box.
  * @param[in] octree The octree instance.
- * @param[out] result A list of indices describing the faces that *may*
- * intersect the specified bounding box are pushed into this vector. "May"
- * because the test is a simple AABB test, not a proper intersection test. The
- * faces need to be further evaluated to check whether they actually intersect
- * or not. The type of data in the the vector is identical to the mesh's index
- * buffer that was used to build the octree. In other words, in order to get
- * index data out of this list, use:
- *
- *   mesh_get_index(retval->data, index, mesh->ib_type);
- *
+ * @param[out] result The indices (wsib_t) of the faces that *may* intersect
+ * the specified bounding box are pushed into this vector, each face exactly
+ * once. "May" because the test is a simple AABB test, not a proper
+ * intersection test. The faces need to be further evaluated to check whether
+ * they actually intersect or not. Use mesh_get_face() to retrieve a face.
  * Note that the returned list can be empty.
  * @param[in] aabb The area in the octree to query.
  * @return Returns 0 on success. -1 if an error occurred. 1 if the query was
  * outside of the octree boundary.
+ * @note Faces are deduplicated by stamping them with the octree's current
+ * query epoch, so concurrent queries on the same octree are not allowed.
  */
 WAVESIM_PRIVATE_API int
-octree_query_potential_faces(const octree_t* octree, vector_t* result, const double aabb[6]);
+octree_query_potential_faces(octree_t* octree, vector_t* result, const wsreal_t aabb[6]);
+
+/*!
+ * @brief Called by octree_visit_potential_faces() for every face that may
+ * intersect the queried bounding box.
+ * @return Return 0 to continue with the next face. Any other value stops the
+ * query and is returned by octree_visit_potential_faces().
+ */
+typedef int (*octree_face_visitor)(void* user_data, wsib_t face_id);
+
+/*!
+ * @brief Streaming version of octree_query_potential_faces(). Instead of
+ * collecting the faces into a vector, the visitor is called for each face,
+ * again exactly once per face. Nothing is allocated, and the visitor can stop
+ * the query early, e.g. to check whether there is any face in a region at
+ * all.
+ * @return Returns 0 if all faces were visited (or there were none), otherwise
+ * the non-zero value the visitor returned to stop the query.
+ * @note Uses the octree's query epoch, so the visitor must not start another
+ * query on the same octree.
+ */
+WAVESIM_PRIVATE_API int
+octree_visit_potential_faces(octree_t* octree,
+                             const wsreal_t aabb[6],
+                             octree_face_visitor visitor,
+                             void* user_data);
 
 /*!
  * @brief Checks whether a point is located inside or outside of the 3D mesh.
+ *
+ * A ray is cast from the point towards +Z. Only the nodes the ray passes
+ * through are visited, so the cost is proportional to the number of faces
+ * along the ray rather than the number of faces in the mesh. Faces are
+ * identified by their index, so every face along the ray is tested exactly
+ * once.
+ * @return Returns the number of faces the ray crosses, which is odd if the
+ * point is inside of the mesh.
  * @note The mesh must be a closed mesh (i.e. no holes) for this check to have
  * any meaning.
+ * @note Like octree_query_potential_faces(), this uses the octree's query
+ * epoch, so concurrent queries on the same octree are not allowed.
  */
 WAVESIM_PRIVATE_API int
-octree_query_point_is_inside_mesh(const octree_t* octree, const wsreal_t p[3]);
+octree_query_point_is_inside_mesh(octree_t* octree, const wsreal_t p[3]);
+
+/*!
+ * @brief Checks many points at once, see
+ * octree_query_point_is_inside_mesh().
+ *
+ * Points with the same X and Y coordinates share a single ray, cast from the
+ * lowest of them, so checking a column of points (e.g. the cell centers of a
+ * grid) costs about as much as checking one.
+ * @param[out] inside Receives 1 for every point inside of the mesh and 0 for
+ * every point outside. Must have room for count entries.
+ * @param[in] points count x,y,z triplets.
+ * @return Returns WS_OK or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+octree_query_points_are_inside_mesh(octree_t* octree,
+                                    uint8_t* inside,
+                                    const wsreal_t* points,
+                                    size_t count);
 
 C_END
 
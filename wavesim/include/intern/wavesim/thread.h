@@ -0,0 +1,87 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "wavesim/config.h"
+
+C_BEGIN
+
+typedef struct thread_t thread_t;
+typedef struct mutex_t mutex_t;
+typedef struct cond_t cond_t;
+typedef void (*thread_func)(void* arg);
+
+/*!
+ * @brief Starts a new thread executing func(arg).
+ * @note Every thread must be joined with thread_join(), which also frees it.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+thread_start(thread_t** thread, thread_func func, void* arg);
+
+/*!
+ * @brief Blocks until the thread has finished and frees it.
+ */
+WAVESIM_PRIVATE_API void
+thread_join(thread_t* thread);
+
+/*!
+ * @brief Returns the number of threads the hardware can execute
+ * concurrently. Always returns at least 1.
+ */
+WAVESIM_PRIVATE_API int
+thread_hardware_concurrency(void);
+
+/*!
+ * @brief Creates a recursive mutex, i.e. the thread holding the lock may
+ * lock it again.
+ * @note Mutexes are allocated with malloc() instead of MALLOC(), so the
+ * memory tracker can use them to protect itself.
+ * @return Returns NULL if the mutex could not be created.
+ */
+WAVESIM_PRIVATE_API mutex_t*
+mutex_create(void);
+
+WAVESIM_PRIVATE_API void
+mutex_destroy(mutex_t* mutex);
+
+WAVESIM_PRIVATE_API void
+mutex_lock(mutex_t* mutex);
+
+WAVESIM_PRIVATE_API void
+mutex_unlock(mutex_t* mutex);
+
+/*!
+ * @brief Creates a condition variable. Like mutexes, these are allocated
+ * with malloc().
+ * @return Returns NULL if the condition variable could not be created.
+ */
+WAVESIM_PRIVATE_API cond_t*
+cond_create(void);
+
+WAVESIM_PRIVATE_API void
+cond_destroy(cond_t* cond);
+
+/*!
+ * @brief Unlocks the mutex, blocks until the condition variable is signalled
+ * and locks the mutex again. The calling thread must hold the mutex exactly
+ * once. The wait can end without a signal, so always check the condition
+ * again in a loop.
+ */
+WAVESIM_PRIVATE_API void
+cond_wait(cond_t* cond, mutex_t* mutex);
+
+/*!
+ * @brief Wakes up at least one of the threads waiting on the condition
+ * variable, if there are any.
+ */
+WAVESIM_PRIVATE_API void
+cond_signal(cond_t* cond);
+
+/*!
+ * @brief Wakes up all threads waiting on the condition variable.
+ */
+WAVESIM_PRIVATE_API void
+cond_broadcast(cond_t* cond);
+
+C_END
+
+#endif /* THREAD_H */
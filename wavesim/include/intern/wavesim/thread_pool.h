@@ -0,0 +1,99 @@
+/*!
+ * @file thread_pool.h
+ * @brief Fixed set of worker threads running batches of tasks.
+ * @page thread_pool Thread pool
+ *
+ * The owner of the pool submits a batch of tasks and then waits for all of
+ * them to finish. The thread that waits runs tasks as well, it counts as
+ * worker 0.
+ *
+ * Every worker has its own double ended queue. Submitted tasks are dealt
+ * out to the queues round robin. A worker takes tasks from the back of its
+ * own queue and, once that runs empty, steals from the front of the other
+ * workers' queues. Tasks of very different sizes thus balance out without
+ * all threads contending for a single queue. The queues are protected by a
+ * mutex each, which is cheap compared to the tasks they hold.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "wavesim/config.h"
+#include "wavesim/thread.h"
+#include "wavesim/vector.h"
+
+C_BEGIN
+
+/*!
+ * @brief A task. worker is the index of the worker running it, in the range
+ * [0, worker_count), and can be used to select per worker working memory.
+ */
+typedef void (*thread_pool_func)(void* arg, int worker);
+
+typedef struct thread_pool_task_t
+{
+    thread_pool_func func;
+    void*            arg;
+} thread_pool_task_t;
+
+typedef struct thread_pool_queue_t
+{
+    struct thread_pool_t* pool;
+    mutex_t*              lock;
+    vector_t              tasks; /* thread_pool_task_t, the entries from head onwards are queued */
+    size_t                head;
+} thread_pool_queue_t;
+
+typedef struct thread_pool_t
+{
+    int                  worker_count;
+    thread_pool_queue_t* queues;       /* One per worker */
+    thread_t**           threads;      /* One per worker, the entry of worker 0 is unused */
+    int                  next_queue;   /* Queue receiving the next submitted task */
+    mutex_t*             lock;         /* Protects everything below */
+    cond_t*              batch_started;
+    cond_t*              batch_done;
+    size_t               pending;      /* Tasks submitted but not finished yet */
+    unsigned             batch;        /* Incremented by every thread_pool_wait() */
+    int                  shutdown;
+} thread_pool_t;
+
+/*!
+ * @brief Creates a pool of worker_count workers, which starts
+ * worker_count - 1 threads. The calling thread is worker 0.
+ * @return Returns WS_OK on success, WS_ERR_OUT_OF_MEMORY or
+ * WS_ERR_THREAD_CREATE_FAILED.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+thread_pool_create(thread_pool_t** pool, int worker_count);
+
+/*!
+ * @brief Stops all threads and frees the pool. There must not be any tasks
+ * left, i.e. every batch must have been waited for.
+ */
+WAVESIM_PRIVATE_API void
+thread_pool_destroy(thread_pool_t* pool);
+
+/*!
+ * @brief Adds a task to the current batch. Workers that are still busy may
+ * start on it right away, all others only pick up work in
+ * thread_pool_wait().
+ * @note Only the thread owning the pool may submit tasks, and tasks must not
+ * submit further tasks.
+ * @return Returns WS_OK on success or WS_ERR_OUT_OF_MEMORY.
+ */
+WAVESIM_PRIVATE_API wsret WS_WARN_UNUSED
+thread_pool_submit(thread_pool_t* pool, thread_pool_func func, void* arg);
+
+/*!
+ * @brief Wakes up all workers, runs tasks on the calling thread until all
+ * queues are empty and then blocks until every submitted task has finished.
+ * This acts as a barrier: no task of the next batch starts before all tasks
+ * of this one are done.
+ */
+WAVESIM_PRIVATE_API void
+thread_pool_wait(thread_pool_t* pool);
+
+C_END
+
+#endif /* THREAD_POOL_H */
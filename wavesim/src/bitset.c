@@ -0,0 +1,136 @@
+#include "wavesim/bitset.h"
+#include "wavesim/memory.h"
+#include <string.h>
+
+#define WORD_COUNT(bits) (((bits) + 63) / 64)
+
+/* Mask with all bits in [begin, end) of a single word set, 0 <= begin < end <= 64 */
+static uint64_t
+word_mask(size_t begin, size_t end)
+{
+    uint64_t upper = (end == 64 ? ~(uint64_t)0 : (((uint64_t)1 << end) - 1));
+    uint64_t lower = (((uint64_t)1 << begin) - 1);
+    return upper & ~lower;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+bitset_construct(bitset_t* bitset)
+{
+    bitset->count = 0;
+    bitset->data = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+bitset_clear_free(bitset_t* bitset)
+{
+    if (bitset->data != NULL)
+        FREE(bitset->data);
+    bitset_construct(bitset);
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+bitset_resize(bitset_t* bitset, size_t count)
+{
+    bitset_clear_free(bitset);
+    if (count == 0)
+        return WS_OK;
+
+    bitset->data = MALLOC(WORD_COUNT(count) * sizeof(uint64_t));
+    if (bitset->data == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    bitset->count = count;
+    bitset_reset(bitset);
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+bitset_reset(bitset_t* bitset)
+{
+    if (bitset->data != NULL)
+        memset(bitset->data, 0, WORD_COUNT(bitset->count) * sizeof(uint64_t));
+}
+
+/* ------------------------------------------------------------------------- */
+void
+bitset_set_range(bitset_t* bitset, size_t begin, size_t end)
+{
+    size_t first_word = begin >> 6;
+    size_t last_word = (end - 1) >> 6;
+    size_t w;
+
+    if (begin >= end)
+        return;
+
+    if (first_word == last_word)
+    {
+        bitset->data[first_word] |= word_mask(begin & 63, ((end - 1) & 63) + 1);
+        return;
+    }
+
+    bitset->data[first_word] |= word_mask(begin & 63, 64);
+    for (w = first_word + 1; w < last_word; ++w)
+        bitset->data[w] = ~(uint64_t)0;
+    bitset->data[last_word] |= word_mask(0, ((end - 1) & 63) + 1);
+}
+
+/* ------------------------------------------------------------------------- */
+int
+bitset_any_in_range(const bitset_t* bitset, size_t begin, size_t end)
+{
+    size_t first_word = begin >> 6;
+    size_t last_word = (end - 1) >> 6;
+    size_t w;
+
+    if (begin >= end)
+        return 0;
+
+    if (first_word == last_word)
+        return (bitset->data[first_word] & word_mask(begin & 63, ((end - 1) & 63) + 1)) != 0;
+
+    if (bitset->data[first_word] & word_mask(begin & 63, 64))
+        return 1;
+    for (w = first_word + 1; w < last_word; ++w)
+        if (bitset->data[w])
+            return 1;
+    return (bitset->data[last_word] & word_mask(0, ((end - 1) & 63) + 1)) != 0;
+}
+
+/* ------------------------------------------------------------------------- */
+size_t
+bitset_find_unset(const bitset_t* bitset, size_t begin)
+{
+    size_t w;
+    uint64_t word;
+
+    if (begin >= bitset->count)
+        return bitset->count;
+
+    /* Pretend the bits before "begin" are set so they are skipped */
+    w = begin >> 6;
+    word = bitset->data[w] | word_mask(0, begin & 63);
+    while (word == ~(uint64_t)0)
+    {
+        if (++w >= WORD_COUNT(bitset->count))
+            return bitset->count;
+        word = bitset->data[w];
+    }
+
+    /* Find lowest 0 bit in word */
+    {
+        size_t bit = 0;
+        word = ~word;
+        while ((word & 1u) == 0)
+        {
+            word >>= 1;
+            ++bit;
+        }
+        w = (w << 6) + bit;
+    }
+
+    return w < bitset->count ? w : bitset->count;
+}
@@ -0,0 +1,15 @@
+#include "wavesim/cpu.h"
+
+/* ------------------------------------------------------------------------- */
+cpu_simd_e
+cpu_detect_simd(void)
+{
+#if defined(WAVESIM_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        return CPU_SIMD_AVX;
+    if (__builtin_cpu_supports("sse2"))
+        return CPU_SIMD_SSE2;
+#endif
+    return CPU_SIMD_NONE;
+}
@@ -0,0 +1,529 @@
+#include "wavesim/dct.h"
+#include "wavesim/memory.h"
+#include <string.h>
+#include <math.h>
+
+#define PI 3.14159265358979323846
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Splits the length into radices, preferring 2 and then the smallest primes.
+ * Returns the largest radix, which is the length itself if it is prime.
+ */
+static int32_t
+factorize(int32_t length, int32_t factors[2*DCT_MAX_FACTORS])
+{
+    int32_t p = 2;
+    int32_t max_radix = 1;
+    int i = 0;
+
+    while (length > 1)
+    {
+        while (length % p != 0)
+        {
+            p = (p == 2 ? 3 : p + 2);
+            if (p * p > length)
+                p = length;
+        }
+        length /= p;
+        factors[i++] = p;
+        factors[i++] = length;
+        if (p > max_radix)
+            max_radix = p;
+    }
+
+    return max_radix;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+dct_plan_1d_construct(dct_plan_1d_t* plan, int32_t length, dct_method_e method)
+{
+    int32_t n = length;
+    int32_t k, i;
+
+    memset(plan, 0, sizeof *plan);
+    plan->length = length;
+    plan->max_radix = factorize(length, plan->factors);
+
+    if (method == DCT_AUTO)
+        method = (length <= DCT_DIRECT_MAX_LENGTH || plan->max_radix > DCT_FFT_MAX_RADIX) ? DCT_DIRECT : DCT_FFT;
+    if (length == 1)
+        method = DCT_DIRECT; /* Nothing to factorize */
+    plan->method = method;
+
+    plan->scale = MALLOC(sizeof(wsreal_t) * (size_t)n);
+    if (plan->scale == NULL)
+        goto out_of_memory;
+    for (k = 0; k != n; ++k)
+        plan->scale[k] = (wsreal_t)sqrt((k == 0 ? 1.0 : 2.0) / n);
+
+    if (method == DCT_DIRECT)
+    {
+        plan->basis = MALLOC(sizeof(wsreal_t) * (size_t)n * (size_t)n);
+        if (plan->basis == NULL)
+            goto out_of_memory;
+        for (k = 0; k != n; ++k)
+            for (i = 0; i != n; ++i)
+                plan->basis[k*n + i] = plan->scale[k] * (wsreal_t)cos(PI * k * (i + 0.5) / n);
+    }
+    else
+    {
+        plan->twiddles = MALLOC(sizeof(wsreal_t) * 2 * (size_t)n);
+        plan->rotations = MALLOC(sizeof(wsreal_t) * 2 * (size_t)n);
+        if (plan->twiddles == NULL || plan->rotations == NULL)
+            goto out_of_memory;
+        for (k = 0; k != n; ++k)
+        {
+            plan->twiddles[2*k+0] = (wsreal_t)cos(-2 * PI * k / n);
+            plan->twiddles[2*k+1] = (wsreal_t)sin(-2 * PI * k / n);
+            plan->rotations[2*k+0] = (wsreal_t)cos(-PI * k / (2 * n));
+            plan->rotations[2*k+1] = (wsreal_t)sin(-PI * k / (2 * n));
+        }
+    }
+
+    return WS_OK;
+
+    out_of_memory : dct_plan_1d_destruct(plan);
+    WSRET(WS_ERR_OUT_OF_MEMORY);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_plan_1d_destruct(dct_plan_1d_t* plan)
+{
+    if (plan->scale != NULL)     FREE(plan->scale);
+    if (plan->basis != NULL)     FREE(plan->basis);
+    if (plan->twiddles != NULL)  FREE(plan->twiddles);
+    if (plan->rotations != NULL) FREE(plan->rotations);
+    plan->scale = NULL;
+    plan->basis = NULL;
+    plan->twiddles = NULL;
+    plan->rotations = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+size_t
+dct_plan_1d_work_size(const dct_plan_1d_t* plan)
+{
+    if (plan->method == DCT_DIRECT)
+        return 0;
+
+    /* FFT input and output, plus scratch space for the generic butterfly */
+    return 4 * (size_t)plan->length + 2 * (size_t)plan->max_radix;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+butterfly_2(const dct_plan_1d_t* plan, wsreal_t* out, size_t fstride, int32_t m)
+{
+    const wsreal_t* tw = plan->twiddles;
+    wsreal_t* a = out;
+    wsreal_t* b = out + 2*m;
+    int32_t k;
+
+    for (k = 0; k != m; ++k)
+    {
+        size_t t = 2 * fstride * (size_t)k;
+        wsreal_t re = b[2*k] * tw[t] - b[2*k+1] * tw[t+1];
+        wsreal_t im = b[2*k] * tw[t+1] + b[2*k+1] * tw[t];
+        b[2*k]   = a[2*k] - re;
+        b[2*k+1] = a[2*k+1] - im;
+        a[2*k]   += re;
+        a[2*k+1] += im;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+butterfly_generic(const dct_plan_1d_t* plan, wsreal_t* out, size_t fstride, int32_t m, int32_t p, wsreal_t* scratch)
+{
+    const wsreal_t* tw = plan->twiddles;
+    size_t n = (size_t)plan->length;
+    int32_t u, q, q1;
+
+    for (u = 0; u != m; ++u)
+    {
+        int32_t k = u;
+        for (q1 = 0; q1 != p; ++q1, k += m)
+        {
+            scratch[2*q1]   = out[2*k];
+            scratch[2*q1+1] = out[2*k+1];
+        }
+
+        k = u;
+        for (q1 = 0; q1 != p; ++q1, k += m)
+        {
+            size_t t = 0;
+            wsreal_t re = scratch[0];
+            wsreal_t im = scratch[1];
+            for (q = 1; q != p; ++q)
+            {
+                t += fstride * (size_t)k;
+                if (t >= n)
+                    t -= n;
+                re += scratch[2*q] * tw[2*t] - scratch[2*q+1] * tw[2*t+1];
+                im += scratch[2*q] * tw[2*t+1] + scratch[2*q+1] * tw[2*t];
+            }
+            out[2*k]   = re;
+            out[2*k+1] = im;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Recursive decimation in time FFT of interleaved complex values. Every
+ * level splits the input into p interleaved subsequences of length m, whose
+ * transforms are written to consecutive ranges of out and combined with one
+ * radix-p butterfly.
+ */
+static void
+fft(const dct_plan_1d_t* plan, wsreal_t* out, const wsreal_t* in, size_t fstride, const int32_t* factors, wsreal_t* scratch)
+{
+    int32_t p = factors[0];
+    int32_t m = factors[1];
+    int32_t j;
+
+    if (m == 1)
+    {
+        for (j = 0; j != p; ++j)
+        {
+            out[2*j]   = in[2 * fstride * (size_t)j];
+            out[2*j+1] = in[2 * fstride * (size_t)j + 1];
+        }
+    }
+    else
+    {
+        for (j = 0; j != p; ++j)
+            fft(plan, out + 2*j*m, in + 2 * fstride * (size_t)j, fstride * (size_t)p, factors + 2, scratch);
+    }
+
+    if (p == 2)
+        butterfly_2(plan, out, fstride, m);
+    else
+        butterfly_generic(plan, out, fstride, m, p, scratch);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_1d_forward(const dct_plan_1d_t* plan, const wsreal_t* in, wsreal_t* out, wsreal_t* work)
+{
+    int32_t n = plan->length;
+    int32_t i, k;
+
+    if (plan->method == DCT_DIRECT)
+    {
+        for (k = 0; k != n; ++k)
+        {
+            const wsreal_t* basis = plan->basis + k*n;
+            wsreal_t sum = 0;
+            for (i = 0; i != n; ++i)
+                sum += basis[i] * in[i];
+            out[k] = sum;
+        }
+    }
+    else
+    {
+        /*
+         * Makhoul: Reorder to even samples ascending followed by odd samples
+         * descending, then X[k] = Re(exp(-i*pi*k/(2n)) * FFT(v)[k])
+         */
+        wsreal_t* v = work;
+        wsreal_t* f = work + 2*n;
+        const wsreal_t* rot = plan->rotations;
+        for (i = 0; 2*i < n; ++i)
+        {
+            v[2*i] = in[2*i];
+            v[2*i+1] = 0;
+        }
+        for (i = 0; 2*i+1 < n; ++i)
+        {
+            v[2*(n-1-i)] = in[2*i+1];
+            v[2*(n-1-i)+1] = 0;
+        }
+
+        fft(plan, f, v, 1, plan->factors, work + 4*n);
+
+        for (k = 0; k != n; ++k)
+            out[k] = plan->scale[k] * (f[2*k] * rot[2*k] - f[2*k+1] * rot[2*k+1]);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_1d_inverse(const dct_plan_1d_t* plan, const wsreal_t* in, wsreal_t* out, wsreal_t* work)
+{
+    int32_t n = plan->length;
+    int32_t i, k;
+
+    if (plan->method == DCT_DIRECT)
+    {
+        for (i = 0; i != n; ++i)
+            out[i] = 0;
+        for (k = 0; k != n; ++k)
+        {
+            const wsreal_t* basis = plan->basis + k*n;
+            for (i = 0; i != n; ++i)
+                out[i] += basis[i] * in[k];
+        }
+    }
+    else
+    {
+        /*
+         * Reverses the forward transform. With C[k] the unscaled coefficients
+         * and C[n] = 0, the spectrum of the reordered samples is
+         * V[k] = conj(rot[k]) * (C[k] - i*C[n-k]). The inverse FFT is done
+         * as a forward FFT of conj(V), since only the real part is needed.
+         */
+        wsreal_t* v = work;
+        wsreal_t* f = work + 2*n;
+        const wsreal_t* rot = plan->rotations;
+        wsreal_t norm = (wsreal_t)1 / n;
+        for (k = 0; k != n; ++k)
+        {
+            wsreal_t c = in[k] / plan->scale[k];
+            wsreal_t c_mirror = (k == 0 ? 0 : in[n-k] / plan->scale[n-k]);
+            v[2*k]   = rot[2*k] * c - rot[2*k+1] * c_mirror;
+            v[2*k+1] = rot[2*k] * c_mirror + rot[2*k+1] * c;
+        }
+
+        fft(plan, f, v, 1, plan->factors, work + 4*n);
+
+        for (i = 0; 2*i < n; ++i)
+            out[2*i] = f[2*i] * norm;
+        for (i = 0; 2*i+1 < n; ++i)
+            out[2*i+1] = f[2*(n-1-i)] * norm;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_cache_construct(dct_cache_t* cache)
+{
+    vector_construct(&cache->plans_1d, sizeof(dct_plan_1d_t*));
+    vector_construct(&cache->plans, sizeof(dct_plan_t*));
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_cache_clear_free(dct_cache_t* cache)
+{
+    VECTOR_FOR_EACH(&cache->plans_1d, dct_plan_1d_t*, plan)
+        dct_plan_1d_destruct(*plan);
+        FREE(*plan);
+    VECTOR_END_EACH
+    VECTOR_FOR_EACH(&cache->plans, dct_plan_t*, plan)
+        FREE(*plan);
+    VECTOR_END_EACH
+    vector_clear_free(&cache->plans_1d);
+    vector_clear_free(&cache->plans);
+}
+
+/* ------------------------------------------------------------------------- */
+static int
+compare_dims(const int32_t a[3], const int32_t b[3])
+{
+    int i;
+    for (i = 0; i != 3; ++i)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Binary search for the first 1D plan with a length not less than the
+ * specified length.
+ */
+static size_t
+lower_bound_1d(const dct_cache_t* cache, int32_t length)
+{
+    size_t begin = 0, end = vector_count(&cache->plans_1d);
+    while (begin < end)
+    {
+        size_t mid = begin + (end - begin) / 2;
+        if ((*(dct_plan_1d_t**)vector_get_element(&cache->plans_1d, mid))->length < length)
+            begin = mid + 1;
+        else
+            end = mid;
+    }
+    return begin;
+}
+
+/* ------------------------------------------------------------------------- */
+static size_t
+lower_bound(const dct_cache_t* cache, const int32_t dims[3])
+{
+    size_t begin = 0, end = vector_count(&cache->plans);
+    while (begin < end)
+    {
+        size_t mid = begin + (end - begin) / 2;
+        if (compare_dims((*(dct_plan_t**)vector_get_element(&cache->plans, mid))->dims, dims) < 0)
+            begin = mid + 1;
+        else
+            end = mid;
+    }
+    return begin;
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+get_plan_1d(dct_cache_t* cache, int32_t length, const dct_plan_1d_t** plan)
+{
+    size_t idx = lower_bound_1d(cache, length);
+    dct_plan_1d_t* new_plan;
+    wsret result;
+
+    if (idx != vector_count(&cache->plans_1d))
+    {
+        dct_plan_1d_t* existing = *(dct_plan_1d_t**)vector_get_element(&cache->plans_1d, idx);
+        if (existing->length == length)
+        {
+            *plan = existing;
+            return WS_OK;
+        }
+    }
+
+    new_plan = MALLOC(sizeof *new_plan);
+    if (new_plan == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    if ((result = dct_plan_1d_construct(new_plan, length, DCT_AUTO)) != WS_OK)
+    {
+        FREE(new_plan);
+        return result;
+    }
+    if (vector_insert(&cache->plans_1d, idx, &new_plan) != 0)
+    {
+        dct_plan_1d_destruct(new_plan);
+        FREE(new_plan);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    *plan = new_plan;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+dct_cache_get_plan(dct_cache_t* cache, const int32_t dims[3], const dct_plan_t** plan)
+{
+    size_t idx = lower_bound(cache, dims);
+    size_t max_work = 0;
+    int32_t max_length = 1;
+    dct_plan_t* new_plan;
+    wsret result;
+    int i;
+
+    if (idx != vector_count(&cache->plans))
+    {
+        dct_plan_t* existing = *(dct_plan_t**)vector_get_element(&cache->plans, idx);
+        if (compare_dims(existing->dims, dims) == 0)
+        {
+            *plan = existing;
+            return WS_OK;
+        }
+    }
+
+    new_plan = MALLOC(sizeof *new_plan);
+    if (new_plan == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
+    for (i = 0; i != 3; ++i)
+    {
+        size_t work;
+        new_plan->dims[i] = dims[i];
+        if ((result = get_plan_1d(cache, dims[i], &new_plan->axes[i])) != WS_OK)
+        {
+            FREE(new_plan);
+            return result;
+        }
+        work = dct_plan_1d_work_size(new_plan->axes[i]);
+        if (work > max_work)
+            max_work = work;
+        if (dims[i] > max_length)
+            max_length = dims[i];
+    }
+
+    /* Two line buffers plus whatever the 1D transforms need */
+    new_plan->work_size = 2 * (size_t)max_length + max_work;
+
+    if (vector_insert(&cache->plans, idx, &new_plan) != 0)
+    {
+        FREE(new_plan);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    *plan = new_plan;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+transform_axis(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work, int axis,
+               int32_t begin, int32_t end, int inverse)
+{
+    const int32_t* dims = plan->dims;
+    const dct_plan_1d_t* plan_1d = plan->axes[axis];
+    int32_t n = dims[axis];
+    size_t stride = (axis == 0 ? (size_t)dims[1] * (size_t)dims[2] : axis == 1 ? (size_t)dims[2] : 1);
+    wsreal_t* line_in = work;
+    wsreal_t* line_out = work + n;
+    wsreal_t* work_1d = work + 2*n;
+    int32_t a, b, i;
+
+    /* The only basis function of a single cell is the constant 1 */
+    if (n == 1)
+        return;
+
+    /* Visit every line along the axis by varying the other two axes */
+    for (a = begin; a != end; ++a)
+        for (b = 0; b != dims[axis == 2 ? 1 : 2]; ++b)
+        {
+            wsreal_t* line;
+            if (axis == 0)      line = data + (size_t)a * (size_t)dims[2] + (size_t)b;
+            else if (axis == 1) line = data + (size_t)a * (size_t)dims[1] * (size_t)dims[2] + (size_t)b;
+            else                line = data + ((size_t)a * (size_t)dims[1] + (size_t)b) * (size_t)dims[2];
+
+            for (i = 0; i != n; ++i)
+                line_in[i] = line[(size_t)i * stride];
+            if (inverse)
+                dct_1d_inverse(plan_1d, line_in, line_out, work_1d);
+            else
+                dct_1d_forward(plan_1d, line_in, line_out, work_1d);
+            for (i = 0; i != n; ++i)
+                line[(size_t)i * stride] = line_out[i];
+        }
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_forward(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work)
+{
+    transform_axis(plan, data, work, 0, 0, plan->dims[1], 0);
+    transform_axis(plan, data, work, 1, 0, plan->dims[0], 0);
+    transform_axis(plan, data, work, 2, 0, plan->dims[0], 0);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_inverse(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work)
+{
+    transform_axis(plan, data, work, 2, 0, plan->dims[0], 1);
+    transform_axis(plan, data, work, 1, 0, plan->dims[0], 1);
+    transform_axis(plan, data, work, 0, 0, plan->dims[1], 1);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_forward_axis(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work, int axis, int32_t begin, int32_t end)
+{
+    transform_axis(plan, data, work, axis, begin, end, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dct_inverse_axis(const dct_plan_t* plan, wsreal_t* data, wsreal_t* work, int axis, int32_t begin, int32_t end)
+{
+    transform_axis(plan, data, work, axis, begin, end, 1);
+}
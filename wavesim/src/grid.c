@@ -0,0 +1,608 @@
+#include "wavesim/grid.h"
+#include "wavesim/face.h"
+#include "wavesim/intersections.h"
+#include "wavesim/log.h"
+#include "wavesim/memory.h"
+#include "wavesim/mesh.h"
+#include "wavesim/vector.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * While faces are rasterized, every cell accumulates the weighted sum of the
+ * attributes of all vertices of all faces touching it, along with the sum of
+ * the weights. Only once all faces are done is the result interned into the
+ * grid's material table. A cell whose center lies exactly on a vertex takes
+ * that vertex's attribute as is, which is marked with a negative weight so no
+ * other face touches it anymore.
+ */
+#define EXACT_VERTEX_WEIGHT ((wsreal_t)-1)
+
+typedef struct cell_accumulator_t
+{
+    attribute_t attribute;
+    wsreal_t    weight_sum;
+} cell_accumulator_t;
+
+/* ------------------------------------------------------------------------- */
+static void
+accumulate_face(grid_t* grid, cell_accumulator_t* acc, const face_t* face,
+                int32_t x, int32_t y, int32_t z)
+{
+    attribute_t* cell_attribute = &acc->attribute;
+    wsreal_t* weight_sum = &acc->weight_sum;
+    aabb_t cell = grid_cell_aabb(grid, x, y, z);
+    vec3_t cell_center;
+    int v;
+
+    if (*weight_sum == EXACT_VERTEX_WEIGHT)
+        return;
+    if (intersect_triangle_aabb_test(
+            face->vertices[0].position.xyz,
+            face->vertices[1].position.xyz,
+            face->vertices[2].position.xyz,
+            cell.xyzxyz) == 0)
+        return; /* only the bounding boxes overlap */
+
+    *grid_cell_flags(grid, x, y, z) |= GRID_CELL_SURFACE;
+
+    /* Calculate the center of the AABB, required for attribute interpolation */
+    vec3_copy(&cell_center, cell.xyzxyz);
+    vec3_add_vec3(cell_center.xyz, cell.xyzxyz+3);
+    vec3_mul_scalar(cell_center.xyz, 0.5);
+
+    /*
+     * Using Shepard's method, weight all vertex attributes according to
+     * their distance to the cell's AABB center.
+     *
+     * https://en.wikipedia.org/wiki/Inverse_distance_weighting
+     */
+    for (v = 0; v != 3; ++v)
+    {
+        wsreal_t weight;
+        vec3_t distance = face->vertices[v].position;
+        vec3_sub_vec3(distance.xyz, cell_center.xyz);
+        weight = vec3_length_squared(distance.xyz);
+        if (weight == 0.0) /* catch division by 0, if the cell center is right on top of a vertex */
+        {
+            *cell_attribute = face->vertices[v].attr;
+            *weight_sum = EXACT_VERTEX_WEIGHT;
+            return;
+        }
+        weight = 1.0 / weight; /* We're using p=2, since weight is the squared length */
+        cell_attribute->reflection   += face->vertices[v].attr.reflection * weight;
+        cell_attribute->transmission += face->vertices[v].attr.transmission * weight;
+        cell_attribute->absorption   += face->vertices[v].attr.absorption * weight;
+        *weight_sum += weight;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static int32_t
+clamp_cell(wsreal_t cell, int32_t max)
+{
+    if (cell < 0)
+        return 0;
+    if (cell > (wsreal_t)max)
+        return max;
+    return (int32_t)cell;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Conservatively rasterizes a face into all cells with x in [x_begin, x_end)
+ * it touches. The triangle is walked in columns along its dominant normal
+ * axis: for every column of cells (perpendicular to the triangle's
+ * projection plane), only the few cells between the minimum and maximum
+ * height of the triangle's plane over that column are candidates. Every
+ * candidate is then confirmed with an exact triangle/box test, so the work
+ * done is proportional to the triangle's area rather than its bounding box's
+ * volume.
+ */
+static void
+rasterize_face(grid_t* grid, cell_accumulator_t* cells, const face_t* face,
+               int32_t x_begin, int32_t x_end)
+{
+    const wsreal_t eps = 1e-9;
+    aabb_t bb = face_calculate_aabb(face);
+    int32_t lo[3], hi[3];
+    int32_t a, b;
+    int axis_d, axis_a, axis_b, i;
+    vec3_t e1, e2, normal;
+    wsreal_t plane_d;
+
+    /* Inclusive cell range of the face's bounding box. Faces lying exactly on
+     * a cell boundary touch the cells on both sides. */
+    for (i = 0; i != 3; ++i)
+    {
+        lo[i] = clamp_cell(floor((bb.xyzxyz[i]   - grid->origin.xyz[i]) / grid->cell_size.xyz[i] - eps), grid->dims[i] - 1);
+        hi[i] = clamp_cell(floor((bb.xyzxyz[i+3] - grid->origin.xyz[i]) / grid->cell_size.xyz[i] + eps), grid->dims[i] - 1);
+        if (bb.xyzxyz[i+3] < grid->origin.xyz[i] ||
+            bb.xyzxyz[i] > grid->origin.xyz[i] + grid->cell_size.xyz[i] * grid->dims[i])
+            return; /* completely outside of the grid */
+    }
+    if (lo[0] < x_begin) lo[0] = x_begin;
+    if (hi[0] > x_end - 1) hi[0] = x_end - 1;
+    if (lo[0] > hi[0])
+        return;
+
+    /* Walk columns along the axis the triangle's plane is most perpendicular to */
+    e1 = face->vertices[1].position; vec3_sub_vec3(e1.xyz, face->vertices[0].position.xyz);
+    e2 = face->vertices[2].position; vec3_sub_vec3(e2.xyz, face->vertices[0].position.xyz);
+    normal = e1;
+    vec3_cross(normal.xyz, e2.xyz);
+    axis_d = 0;
+    for (i = 1; i != 3; ++i)
+        if (fabs(normal.xyz[i]) > fabs(normal.xyz[axis_d]))
+            axis_d = i;
+    axis_a = (axis_d + 1) % 3;
+    axis_b = (axis_d + 2) % 3;
+    plane_d = vec3_dot(normal.xyz, face->vertices[0].position.xyz);
+
+    for (a = lo[axis_a]; a <= hi[axis_a]; ++a)
+        for (b = lo[axis_b]; b <= hi[axis_b]; ++b)
+        {
+            int32_t cell[3];
+            int32_t d_lo = lo[axis_d], d_hi = hi[axis_d];
+
+            /* Height of the plane at the four corners of the column */
+            if (normal.xyz[axis_d] != 0)
+            {
+                wsreal_t h_min = 0, h_max = 0;
+                int corner;
+                for (corner = 0; corner != 4; ++corner)
+                {
+                    wsreal_t pa = grid->origin.xyz[axis_a] + grid->cell_size.xyz[axis_a] * (a + (corner & 1));
+                    wsreal_t pb = grid->origin.xyz[axis_b] + grid->cell_size.xyz[axis_b] * (b + (corner >> 1));
+                    wsreal_t h = (plane_d - normal.xyz[axis_a] * pa - normal.xyz[axis_b] * pb) / normal.xyz[axis_d];
+                    if (corner == 0 || h < h_min) h_min = h;
+                    if (corner == 0 || h > h_max) h_max = h;
+                }
+                h_min = (h_min - grid->origin.xyz[axis_d]) / grid->cell_size.xyz[axis_d];
+                h_max = (h_max - grid->origin.xyz[axis_d]) / grid->cell_size.xyz[axis_d];
+                if (floor(h_min - eps) > (wsreal_t)d_lo) d_lo = clamp_cell(floor(h_min - eps), d_hi);
+                if (floor(h_max + eps) < (wsreal_t)d_hi) d_hi = clamp_cell(floor(h_max + eps), d_hi);
+            }
+
+            cell[axis_a] = a;
+            cell[axis_b] = b;
+            for (cell[axis_d] = d_lo; cell[axis_d] <= d_hi; ++cell[axis_d])
+            {
+                size_t idx = GRID_INDEX(grid, cell[0] - x_begin, cell[1], cell[2]);
+                accumulate_face(grid, &cells[idx], face, cell[0], cell[1], cell[2]);
+            }
+        }
+}
+
+/* ------------------------------------------------------------------------- */
+void
+grid_construct(grid_t* grid)
+{
+    grid->origin = vec3(0, 0, 0);
+    grid->cell_size = vec3(0, 0, 0);
+    grid->dims[0] = 0;
+    grid->dims[1] = 0;
+    grid->dims[2] = 0;
+    grid->cells = NULL;
+    grid->flags = NULL;
+    grid->excluded_count = 0;
+    material_table_construct(&grid->materials);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+grid_destruct(grid_t* grid)
+{
+    grid_clear(grid);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+grid_clear(grid_t* grid)
+{
+    if (grid->cells != NULL)
+        FREE(grid->cells);
+    if (grid->flags != NULL)
+        FREE(grid->flags);
+    material_table_clear_free(&grid->materials);
+    grid_construct(grid);
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+grid_allocate(grid_t* grid,
+              const wsreal_t boundary[6],
+              const wsreal_t cell_size[3])
+{
+    int i;
+
+    grid_clear(grid);
+
+    /*
+     * Only cells that fit entirely into the boundary are part of the grid.
+     * Allow for some floating point error so boundaries that are an exact
+     * multiple of the cell size don't lose their last layer of cells.
+     */
+    vec3_copy(&grid->origin, boundary);
+    vec3_copy(&grid->cell_size, cell_size);
+    for (i = 0; i != 3; ++i)
+    {
+        wsreal_t count = (boundary[i+3] - boundary[i]) / cell_size[i];
+        grid->dims[i] = count > 0 ? (int32_t)floor(count + 1e-6) : 0;
+    }
+
+    if (grid_cell_count(grid) == 0)
+        return WS_OK;
+
+    grid->cells = MALLOC(sizeof(material_id_t) * grid_cell_count(grid));
+    grid->flags = MALLOC(sizeof(uint8_t) * grid_cell_count(grid));
+    if (grid->cells == NULL || grid->flags == NULL)
+    {
+        grid_clear(grid);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+grid_classify_cells(grid_t* grid,
+                    const mesh_t* mesh,
+                    int32_t x_begin,
+                    int32_t x_end)
+{
+    cell_accumulator_t* accumulators;
+    attribute_t air;
+    material_id_t air_id;
+    size_t cell_begin = GRID_INDEX(grid, x_begin, 0, 0);
+    size_t cell_count = GRID_INDEX(grid, x_end, 0, 0) - cell_begin;
+    size_t i;
+    wsib_t f;
+    wsret result = WS_OK;
+
+    if (cell_count == 0)
+        return WS_OK;
+    if ((accumulators = MALLOC(sizeof(cell_accumulator_t) * cell_count)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (i = 0; i != cell_count; ++i)
+    {
+        attribute_set_zero(&accumulators[i].attribute);
+        accumulators[i].weight_sum = 0;
+        grid->flags[cell_begin + i] = 0;
+    }
+
+    /* Every face is visited once and scattered into the cells it touches */
+    for (f = 0; f != mesh_face_count(mesh); ++f)
+    {
+        face_t face = mesh_get_face_from_buffers(mesh->vb, mesh->ib, mesh->ab,
+                                                 f, mesh->vb_type, mesh->ib_type);
+        rasterize_face(grid, accumulators, &face, x_begin, x_end);
+    }
+
+    /* Normalize the accumulated attributes and intern them as materials */
+    attribute_set_default_air(&air);
+    if ((result = material_table_intern(&grid->materials, &air, &air_id)) != WS_OK)
+        goto bail;
+    for (i = 0; i != cell_count; ++i)
+    {
+        attribute_t* cell_attribute = &accumulators[i].attribute;
+        wsreal_t weights_sum = accumulators[i].weight_sum;
+
+        /* It's possible that no faces intersected, in which case we assume it's air */
+        if (weights_sum == 0.0)
+        {
+            grid->cells[cell_begin + i] = air_id;
+            continue;
+        }
+
+        if (weights_sum != EXACT_VERTEX_WEIGHT)
+        {
+            weights_sum = 1.0 / weights_sum;
+            cell_attribute->absorption *= weights_sum;
+            cell_attribute->reflection *= weights_sum;
+            cell_attribute->transmission *= weights_sum;
+            /* Need to normalize it so 1 = reflection + transmission + absorption */
+            weights_sum = cell_attribute->reflection + cell_attribute->transmission + cell_attribute->absorption;
+            weights_sum = 1.0 / weights_sum;
+            cell_attribute->absorption *= weights_sum;
+            cell_attribute->reflection *= weights_sum;
+            cell_attribute->transmission *= weights_sum;
+        }
+
+        if ((result = material_table_intern(&grid->materials, cell_attribute, &grid->cells[cell_begin + i])) != WS_OK)
+            goto bail;
+    }
+
+    bail : FREE(accumulators);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+grid_build_from_mesh(grid_t* grid,
+                     const mesh_t* mesh,
+                     const wsreal_t boundary[6],
+                     const wsreal_t cell_size[3])
+{
+    wsret result;
+
+    if ((result = grid_allocate(grid, boundary, cell_size)) != WS_OK)
+        return result;
+    if ((result = grid_classify_cells(grid, mesh, 0, grid->dims[0])) != WS_OK)
+    {
+        grid_clear(grid);
+        return result;
+    }
+
+    ws_log_info(&g_ws_log, "Classified %d x %d x %d grid cells", grid->dims[0], grid->dims[1], grid->dims[2]);
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+typedef struct row_crossing_t
+{
+    size_t   row;  /* y * dims[2] + z */
+    wsreal_t x;    /* Where the row's center line crosses a face */
+} row_crossing_t;
+
+static int
+row_crossing_compare(const void* a, const void* b)
+{
+    const row_crossing_t* ca = a;
+    const row_crossing_t* cb = b;
+    if (ca->row != cb->row)
+        return ca->row < cb->row ? -1 : 1;
+    return (ca->x > cb->x) - (ca->x < cb->x);
+}
+
+/*!
+ * Edge function of the projected edge a->b at point p. It is always evaluated
+ * with the endpoints in the same order, so two faces sharing an edge get
+ * exactly opposite values and a point on the edge is never lost to rounding.
+ */
+static wsreal_t
+edge_function(const wsreal_t a[2], const wsreal_t b[2], const wsreal_t p[2])
+{
+    int swapped = (a[0] > b[0] || (a[0] == b[0] && a[1] > b[1]));
+    const wsreal_t* lo = swapped ? b : a;
+    const wsreal_t* hi = swapped ? a : b;
+    wsreal_t e = (hi[0] - lo[0]) * (p[1] - lo[1]) - (hi[1] - lo[1]) * (p[0] - lo[0]);
+    return swapped ? -e : e;
+}
+
+/*!
+ * Decides who owns points lying exactly on an edge. Of the two opposite
+ * directions an edge can have, exactly one owns them, so a row crossing a
+ * closed mesh through an edge is counted once.
+ */
+static int
+edge_owns_boundary(const wsreal_t a[2], const wsreal_t b[2])
+{
+    wsreal_t du = b[0] - a[0];
+    wsreal_t dv = b[1] - a[1];
+    return dv > 0 || (dv == 0 && du < 0);
+}
+
+/*!
+ * Shoots a ray along the X axis through the center line of every row of
+ * cells and records where it crosses the faces of the mesh.
+ */
+static wsret
+collect_row_crossings(vector_t* crossings, const grid_t* grid, const mesh_t* mesh)
+{
+    wsib_t f;
+    for (f = 0; f != mesh_face_count(mesh); ++f)
+    {
+        face_t face = mesh_get_face_from_buffers(mesh->vb, mesh->ib, mesh->ab,
+                                                 f, mesh->vb_type, mesh->ib_type);
+        wsreal_t v[3][2];
+        wsreal_t area, lo[2], hi[2];
+        int32_t y_begin, y_end, z_begin, z_end, y, z;
+        vec3_t e1, e2, normal;
+        int i;
+
+        /* Project onto the YZ plane, the plane perpendicular to the rays */
+        for (i = 0; i != 3; ++i)
+        {
+            v[i][0] = face.vertices[i].position.v.y;
+            v[i][1] = face.vertices[i].position.v.z;
+        }
+        area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+        if (area == 0)
+            continue; /* parallel to the rays, can't be crossed */
+        if (area < 0)
+        {
+            /* Make the winding counter clockwise so the inside is positive */
+            wsreal_t tmp[2];
+            memcpy(tmp, v[1], sizeof(tmp));
+            memcpy(v[1], v[2], sizeof(tmp));
+            memcpy(v[2], tmp, sizeof(tmp));
+        }
+
+        e1 = face.vertices[1].position; vec3_sub_vec3(e1.xyz, face.vertices[0].position.xyz);
+        e2 = face.vertices[2].position; vec3_sub_vec3(e2.xyz, face.vertices[0].position.xyz);
+        normal = e1;
+        vec3_cross(normal.xyz, e2.xyz);
+
+        /* Range of rows whose center lines may pass through the projection */
+        for (i = 0; i != 2; ++i)
+        {
+            lo[i] = v[0][i]; hi[i] = v[0][i];
+            if (v[1][i] < lo[i]) lo[i] = v[1][i];
+            if (v[2][i] < lo[i]) lo[i] = v[2][i];
+            if (v[1][i] > hi[i]) hi[i] = v[1][i];
+            if (v[2][i] > hi[i]) hi[i] = v[2][i];
+        }
+        y_begin = (int32_t)ceil((lo[0] - grid->origin.v.y) / grid->cell_size.v.y - 0.5);
+        y_end   = (int32_t)floor((hi[0] - grid->origin.v.y) / grid->cell_size.v.y - 0.5) + 1;
+        z_begin = (int32_t)ceil((lo[1] - grid->origin.v.z) / grid->cell_size.v.z - 0.5);
+        z_end   = (int32_t)floor((hi[1] - grid->origin.v.z) / grid->cell_size.v.z - 0.5) + 1;
+        if (y_begin < 0) y_begin = 0;
+        if (z_begin < 0) z_begin = 0;
+        if (y_end > grid->dims[1]) y_end = grid->dims[1];
+        if (z_end > grid->dims[2]) z_end = grid->dims[2];
+
+        for (y = y_begin; y < y_end; ++y)
+            for (z = z_begin; z < z_end; ++z)
+            {
+                row_crossing_t* crossing;
+                wsreal_t p[2];
+                int inside = 1;
+                p[0] = grid->origin.v.y + grid->cell_size.v.y * (y + 0.5);
+                p[1] = grid->origin.v.z + grid->cell_size.v.z * (z + 0.5);
+                for (i = 0; i != 3 && inside; ++i)
+                {
+                    const wsreal_t* a = v[i];
+                    const wsreal_t* b = v[(i + 1) % 3];
+                    wsreal_t e = edge_function(a, b, p);
+                    inside = e > 0 || (e == 0 && edge_owns_boundary(a, b));
+                }
+                if (inside == 0)
+                    continue;
+
+                if ((crossing = vector_emplace(crossings)) == NULL)
+                    WSRET(WS_ERR_OUT_OF_MEMORY);
+                crossing->row = (size_t)y * (size_t)grid->dims[2] + (size_t)z;
+                crossing->x = (vec3_dot(normal.xyz, face.vertices[0].position.xyz)
+                               - normal.v.y * p[0] - normal.v.z * p[1]) / normal.v.x;
+            }
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+grid_exclude_cells(grid_t* grid, const mesh_t* mesh, int keep_exterior)
+{
+    vector_t crossings;
+    size_t* queue = NULL;
+    size_t queue_begin = 0, queue_end = 0;
+    size_t c, i;
+    int32_t x, y, z;
+    wsret result = WS_OK;
+
+    if (grid_cell_count(grid) == 0)
+        return WS_OK;
+    if ((queue = MALLOC(sizeof(size_t) * grid_cell_count(grid))) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (i = 0; i != grid_cell_count(grid); ++i)
+        grid->flags[i] &= GRID_CELL_SURFACE;
+    grid->excluded_count = 0;
+
+    /*
+     * Determine which cell centers lie inside of the closed mesh by counting
+     * how many faces a ray along X crosses before reaching them. Sorting the
+     * crossings by row and position lets each row be swept once.
+     */
+    vector_construct(&crossings, sizeof(row_crossing_t));
+    if ((result = collect_row_crossings(&crossings, grid, mesh)) != WS_OK)
+        goto bail;
+    if (vector_count(&crossings) != 0)
+        qsort(crossings.data, vector_count(&crossings), sizeof(row_crossing_t), row_crossing_compare);
+    for (c = 0; c != vector_count(&crossings); )
+    {
+        const row_crossing_t* first = vector_get_element(&crossings, c);
+        size_t row = first->row;
+        int inside = 0;
+        y = (int32_t)(row / (size_t)grid->dims[2]);
+        z = (int32_t)(row % (size_t)grid->dims[2]);
+        for (x = 0; x != grid->dims[0]; ++x)
+        {
+            wsreal_t center = grid->origin.v.x + grid->cell_size.v.x * (x + 0.5);
+            for (; c != vector_count(&crossings); ++c)
+            {
+                const row_crossing_t* crossing = vector_get_element(&crossings, c);
+                if (crossing->row != row || crossing->x > center)
+                    break;
+                inside = !inside;
+            }
+            if (inside)
+                *grid_cell_flags(grid, x, y, z) |= GRID_CELL_INSIDE;
+        }
+        /* Skip crossings behind the last cell */
+        while (c != vector_count(&crossings) && ((const row_crossing_t*)vector_get_element(&crossings, c))->row == row)
+            ++c;
+    }
+
+    /*
+     * Flood fill the air outside of the mesh, starting at the boundary of the
+     * grid. Surface cells and cells inside the mesh stop the fill. Every cell
+     * is queued at most once, since it is marked before it is queued.
+     */
+#define FLOOD_FILL_VISIT(x, y, z) do {                                          \
+        uint8_t* flags = grid_cell_flags(grid, x, y, z);                         \
+        if ((*flags & (GRID_CELL_SURFACE | GRID_CELL_INSIDE | GRID_CELL_EXTERIOR)) == 0) \
+        {                                                                         \
+            *flags |= GRID_CELL_EXTERIOR;                                         \
+            queue[queue_end++] = GRID_INDEX(grid, x, y, z);                       \
+        }                                                                         \
+    } while (0)
+    for (x = 0; x != grid->dims[0]; ++x)
+        for (y = 0; y != grid->dims[1]; ++y)
+            for (z = 0; z != grid->dims[2]; ++z)
+                if (x == 0 || y == 0 || z == 0 ||
+                    x == grid->dims[0] - 1 || y == grid->dims[1] - 1 || z == grid->dims[2] - 1)
+                    FLOOD_FILL_VISIT(x, y, z);
+    while (queue_begin != queue_end)
+    {
+        size_t idx = queue[queue_begin++];
+        size_t yz = (size_t)grid->dims[1] * (size_t)grid->dims[2];
+        x = (int32_t)(idx / yz);
+        y = (int32_t)((idx % yz) / (size_t)grid->dims[2]);
+        z = (int32_t)(idx % (size_t)grid->dims[2]);
+        if (x > 0)                 FLOOD_FILL_VISIT(x - 1, y, z);
+        if (x < grid->dims[0] - 1) FLOOD_FILL_VISIT(x + 1, y, z);
+        if (y > 0)                 FLOOD_FILL_VISIT(x, y - 1, z);
+        if (y < grid->dims[1] - 1) FLOOD_FILL_VISIT(x, y + 1, z);
+        if (z > 0)                 FLOOD_FILL_VISIT(x, y, z - 1);
+        if (z < grid->dims[2] - 1) FLOOD_FILL_VISIT(x, y, z + 1);
+    }
+#undef FLOOD_FILL_VISIT
+
+    /*
+     * Exterior air and the solid volume of the mesh don't need simulating.
+     * Cells inside of the mesh are solid even if they enclose air, rooms must
+     * be cavities in the mesh to be kept.
+     */
+    for (i = 0; i != grid_cell_count(grid); ++i)
+        if (((grid->flags[i] & GRID_CELL_EXTERIOR) && keep_exterior == 0) ||
+            (grid->flags[i] & (GRID_CELL_INSIDE | GRID_CELL_SURFACE)) == GRID_CELL_INSIDE)
+        {
+            grid->flags[i] |= GRID_CELL_EXCLUDED;
+            ++grid->excluded_count;
+        }
+
+    ws_log_info(&g_ws_log, keep_exterior ? "Excluded %d solid cells" : "Excluded %d exterior and solid cells",
+                (int)grid->excluded_count);
+
+    bail : FREE(queue);
+    vector_clear_free(&crossings);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+aabb_t
+grid_cell_aabb(const grid_t* grid, int32_t x, int32_t y, int32_t z)
+{
+    /* Multiply instead of accumulate so cell positions don't drift */
+    wsreal_t ax = grid->origin.v.x + grid->cell_size.v.x * x;
+    wsreal_t ay = grid->origin.v.y + grid->cell_size.v.y * y;
+    wsreal_t az = grid->origin.v.z + grid->cell_size.v.z * z;
+    return aabb(ax, ay, az,
+                ax + grid->cell_size.v.x,
+                ay + grid->cell_size.v.y,
+                az + grid->cell_size.v.z);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+grid_cell_at(const grid_t* grid, int32_t cell[3], const wsreal_t point[3])
+{
+    int i;
+    for (i = 0; i != 3; ++i)
+        cell[i] = (int32_t)floor((point[i] - grid->origin.xyz[i]) / grid->cell_size.xyz[i] + 0.5);
+}
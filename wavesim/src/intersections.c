@@ -3,6 +3,14 @@
 #include <math.h>
 #include <float.h>
 
+#if defined(WAVESIM_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(WAVESIM_PRECISION_DOUBLE) || defined(WAVESIM_PRECISION_FLOAT))
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+typedef unsigned (*aabb8_mask_func)(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive);
+
 /* ------------------------------------------------------------------------- */
 int
 intersect_point_aabb_test(const wsreal_t point[3], const wsreal_t aabb[6])
@@ -24,6 +32,161 @@ intersect_aabb_aabb_test(const wsreal_t aabb1[6], const wsreal_t aabb2[6])
     return 1;
 }
 
+/* ------------------------------------------------------------------------- */
+static unsigned
+aabb8_mask_scalar(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    unsigned mask = 0;
+    int i, a;
+    for (i = 0; i != 8; ++i)
+    {
+        int hit = 1;
+        for (a = 0; a != 3; ++a)
+        {
+            if (inclusive)
+                hit &= (boxes->max[a][i] >= aabb[a] && boxes->min[a][i] <= aabb[a+3]);
+            else
+                hit &= (boxes->max[a][i] > aabb[a] && boxes->min[a][i] < aabb[a+3]);
+        }
+        mask |= (unsigned)hit << i;
+    }
+    return mask;
+}
+
+#if defined(HAVE_X86_SIMD)
+/*
+ * Each lane holds one of the eight boxes. A box intersects if, on all three
+ * axes, its max is above the query's min and its min is below the query's
+ * max, which is 6 compares and 5 ands per group of lanes.
+ */
+#   if defined(WAVESIM_PRECISION_DOUBLE)
+__attribute__((target("sse2"))) static unsigned
+aabb8_mask_sse2(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    unsigned mask = 0;
+    int i, a;
+    for (i = 0; i != 8; i += 2)
+    {
+        __m128d hit = _mm_castsi128_pd(_mm_set1_epi32(-1));
+        for (a = 0; a != 3; ++a)
+        {
+            __m128d lo = _mm_set1_pd(aabb[a]);
+            __m128d hi = _mm_set1_pd(aabb[a+3]);
+            __m128d bmin = _mm_loadu_pd(&boxes->min[a][i]);
+            __m128d bmax = _mm_loadu_pd(&boxes->max[a][i]);
+            if (inclusive)
+                hit = _mm_and_pd(hit, _mm_and_pd(_mm_cmpge_pd(bmax, lo), _mm_cmple_pd(bmin, hi)));
+            else
+                hit = _mm_and_pd(hit, _mm_and_pd(_mm_cmpgt_pd(bmax, lo), _mm_cmplt_pd(bmin, hi)));
+        }
+        mask |= (unsigned)_mm_movemask_pd(hit) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx"))) static unsigned
+aabb8_mask_avx(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    unsigned mask = 0;
+    int i, a;
+    for (i = 0; i != 8; i += 4)
+    {
+        __m256d hit = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+        for (a = 0; a != 3; ++a)
+        {
+            __m256d lo = _mm256_set1_pd(aabb[a]);
+            __m256d hi = _mm256_set1_pd(aabb[a+3]);
+            __m256d bmin = _mm256_loadu_pd(&boxes->min[a][i]);
+            __m256d bmax = _mm256_loadu_pd(&boxes->max[a][i]);
+            if (inclusive)
+                hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(bmax, lo, _CMP_GE_OQ),
+                                                       _mm256_cmp_pd(bmin, hi, _CMP_LE_OQ)));
+            else
+                hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(bmax, lo, _CMP_GT_OQ),
+                                                       _mm256_cmp_pd(bmin, hi, _CMP_LT_OQ)));
+        }
+        mask |= (unsigned)_mm256_movemask_pd(hit) << i;
+    }
+    return mask;
+}
+#   else
+__attribute__((target("sse2"))) static unsigned
+aabb8_mask_sse2(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    unsigned mask = 0;
+    int i, a;
+    for (i = 0; i != 8; i += 4)
+    {
+        __m128 hit = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (a = 0; a != 3; ++a)
+        {
+            __m128 lo = _mm_set1_ps(aabb[a]);
+            __m128 hi = _mm_set1_ps(aabb[a+3]);
+            __m128 bmin = _mm_loadu_ps(&boxes->min[a][i]);
+            __m128 bmax = _mm_loadu_ps(&boxes->max[a][i]);
+            if (inclusive)
+                hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(bmax, lo), _mm_cmple_ps(bmin, hi)));
+            else
+                hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(bmax, lo), _mm_cmplt_ps(bmin, hi)));
+        }
+        mask |= (unsigned)_mm_movemask_ps(hit) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx"))) static unsigned
+aabb8_mask_avx(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    __m256 hit = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    int a;
+    for (a = 0; a != 3; ++a)
+    {
+        __m256 lo = _mm256_set1_ps(aabb[a]);
+        __m256 hi = _mm256_set1_ps(aabb[a+3]);
+        __m256 bmin = _mm256_loadu_ps(boxes->min[a]);
+        __m256 bmax = _mm256_loadu_ps(boxes->max[a]);
+        if (inclusive)
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(bmax, lo, _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(bmin, hi, _CMP_LE_OQ)));
+        else
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(bmax, lo, _CMP_GT_OQ),
+                                                   _mm256_cmp_ps(bmin, hi, _CMP_LT_OQ)));
+    }
+    return (unsigned)_mm256_movemask_ps(hit);
+}
+#   endif
+#endif
+
+static aabb8_mask_func g_aabb8_mask = aabb8_mask_scalar;
+
+/* ------------------------------------------------------------------------- */
+unsigned
+intersect_aabb8_aabb_mask(const aabb8_t* boxes, const wsreal_t aabb[6], int inclusive)
+{
+    return g_aabb8_mask(boxes, aabb, inclusive);
+}
+
+/* ------------------------------------------------------------------------- */
+cpu_simd_e
+intersect_select_simd(cpu_simd_e simd)
+{
+#if defined(HAVE_X86_SIMD)
+    cpu_simd_e supported = cpu_detect_simd();
+    if (simd > supported)
+        simd = supported;
+    switch (simd)
+    {
+        case CPU_SIMD_AVX  : g_aabb8_mask = aabb8_mask_avx;  return CPU_SIMD_AVX;
+        case CPU_SIMD_SSE2 : g_aabb8_mask = aabb8_mask_sse2; return CPU_SIMD_SSE2;
+        case CPU_SIMD_NONE : break;
+    }
+#else
+    (void)simd;
+#endif
+    g_aabb8_mask = aabb8_mask_scalar;
+    return CPU_SIMD_NONE;
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * Behaves the same as intersect_line_plane() (see intersections.h), except
@@ -256,7 +419,7 @@ intersect_triangle_aabb_test(const wsreal_t v0[3], const wsreal_t v1[3], const w
 
     /* n00: p0=v0z*v1y - v0y*v1z, p2=v2z*f0y - v2y*f0z */
     p0 = v0c.v.z*v1c.v.y - v0c.v.y*v1c.v.z;
-    p2 = v2c.v.z*f0.v.y - v2c.v.z*f0.v.z;
+    p2 = v2c.v.z*f0.v.y - v2c.v.y*f0.v.z;
     r = e1*fabs(f0.v.z) + e2*fabs(f0.v.y);
     if (fmax(p0, p2) < -r || fmin(p0, p2) > r) return 0; /* Axis is a separating axis */
     /* n01: p0=v0z*f1y - v0y*f1z, p1=v2y*v1z - v1y*v2z */
@@ -269,13 +432,13 @@ intersect_triangle_aabb_test(const wsreal_t v0[3], const wsreal_t v1[3], const w
     p1 = v1c.v.z*f2.v.y - v1c.v.y*f2.v.z;
     r = e1*fabs(f2.v.z) + e2*fabs(f2.v.y);
     if (fmax(p0, p1) < -r || fmin(p0, p1) > r) return 0;
-    /* n10: p0=v0x*v1z - v1x*v0z, p2=v2z*f0x - v2x*f0z */
+    /* n10: p0=v0x*v1z - v1x*v0z, p2=v2x*f0z - v2z*f0x */
     p0 = v0c.v.x*v1c.v.z - v1c.v.x*v0c.v.z;
-    p2 = v2c.v.z*f0.v.x - v2c.v.x*f0.v.z;
+    p2 = v2c.v.x*f0.v.z - v2c.v.z*f0.v.x;
     r = e0*fabs(f0.v.z) + e2*fabs(f0.v.x);
     if (fmax(p0, p2) < -r || fmin(p0, p2) > r) return 0;
-    /* n11: p0=v0z*f1x - v0x*f1z, p1=v1x*v2z - v2x*v1z */
-    p0 = v0c.v.z*f1.v.x - v0c.v.x*f1.v.z;
+    /* n11: p0=v0x*f1z - v0z*f1x, p1=v1x*v2z - v2x*v1z */
+    p0 = v0c.v.x*f1.v.z - v0c.v.z*f1.v.x;
     p1 = v1c.v.x*v2c.v.z - v2c.v.x*v1c.v.z;
     r = e0*fabs(f1.v.z) + e2*fabs(f1.v.x);
     if (fmax(p0, p1) < -r || fmin(p0, p1) > r) return 0;
@@ -284,13 +447,13 @@ intersect_triangle_aabb_test(const wsreal_t v0[3], const wsreal_t v1[3], const w
     p1 = v1c.v.x*f2.v.z - v1c.v.z*f2.v.x;
     r = e0*fabs(f2.v.z) + e2*fabs(f2.v.x);
     if (fmax(p0, p1) < -r || fmin(p0, p1) > r) return 0;
-    /* n20: p0=v1x*v0y - v0x*v1y, p2=v2x*f0y - v2y*f0x */
+    /* n20: p0=v1x*v0y - v0x*v1y, p2=v2y*f0x - v2x*f0y */
     p0 = v1c.v.x*v0c.v.y - v0c.v.x*v1c.v.y;
-    p2 = v2c.v.x*f0.v.y - v2c.v.y*f0.v.x;
+    p2 = v2c.v.y*f0.v.x - v2c.v.x*f0.v.y;
     r = e0*fabs(f0.v.y) + e1*fabs(f0.v.x);
     if (fmax(p0, p2) < -r || fmin(p0, p2) > r) return 0;
-    /* n21: p0=v0x*f1y - v0y*f1x, p1=v2x*v1y - v1x*v2y */
-    p0 = v0c.v.x*f1.v.y - v0c.v.y*f1.v.x;
+    /* n21: p0=v0y*f1x - v0x*f1y, p1=v2x*v1y - v1x*v2y */
+    p0 = v0c.v.y*f1.v.x - v0c.v.x*f1.v.y;
     p1 = v2c.v.x*v1c.v.y - v1c.v.x*v2c.v.y;
     r = e0*fabs(f1.v.y) + e1*fabs(f1.v.x);
     if (fmax(p0, p1) < -r || fmin(p0, p1) > r) return 0;
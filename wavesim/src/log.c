@@ -28,8 +28,6 @@ log_destroy(log_t* log)
 void
 log_construct(log_t* log)
 {
-    log->buffer = NULL;
-    log->buffer_length = 0;
     log->info = default_info_func;
     log->data = default_data_func;
 }
@@ -38,8 +36,7 @@ log_construct(log_t* log)
 void
 log_destruct(log_t* log)
 {
-    if (log->buffer != NULL)
-        FREE(log->buffer);
+    (void)log;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -54,6 +51,13 @@ log_set_callbacks(log_t* log, log_info_func info, log_data_func data)
 static void
 ws_vlog(log_t* log, const char* fmt, va_list ap, int type)
 {
+    /*
+     * Messages are formatted into a buffer owned by this call, so it is safe
+     * to log from multiple threads. Only unusually long messages need a
+     * heap allocation.
+     */
+    char local[256];
+    char* buf = local;
     int len;
 
     va_list ap2;
@@ -65,27 +69,26 @@ ws_vlog(log_t* log, const char* fmt, va_list ap, int type)
         return;
 
     len += 2; /* newline + null terminator */
-    if (len > log->buffer_length)
+    if ((size_t)len > sizeof(local))
     {
-        char* buf = MALLOC((size_t)len * sizeof(char));
+        buf = MALLOC((size_t)len * sizeof(char));
         if (buf == NULL)
         {
             fprintf(stderr, "%s\n", wsret_to_string(WS_ERR_OUT_OF_MEMORY));
             return;
         }
-        if (log->buffer != NULL)
-            FREE(log->buffer);
-        log->buffer = buf;
-        log->buffer_length = (size_t)len * sizeof(char);
     }
 
-    vsprintf(log->buffer, fmt, ap);
-    strcat(log->buffer, "\n");
+    vsprintf(buf, fmt, ap);
+    strcat(buf, "\n");
 
     if (type == 0)
-        log->info(log->buffer);
+        log->info(buf);
     if (type == 1)
-        log->data(log->buffer);
+        log->data(buf);
+
+    if (buf != local)
+        FREE(buf);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -0,0 +1,166 @@
+#include "wavesim/material.h"
+#include "wavesim/hash.h"
+#include "wavesim/memory.h"
+#include <math.h>
+#include <string.h>
+
+typedef struct material_key_t
+{
+    int32_t q[3]; /* reflection, transmission, absorption in fixed point */
+} material_key_t;
+
+/* ------------------------------------------------------------------------- */
+static int32_t
+quantize_component(wsreal_t value)
+{
+    return (int32_t)floor(value * MATERIAL_QUANTIZATION + 0.5);
+}
+
+/* ------------------------------------------------------------------------- */
+static material_key_t
+make_key(const attribute_t* attribute)
+{
+    material_key_t key;
+    key.q[0] = quantize_component(attribute->reflection);
+    key.q[1] = quantize_component(attribute->transmission);
+    key.q[2] = quantize_component(attribute->absorption);
+    return key;
+}
+
+/* ------------------------------------------------------------------------- */
+static uint32_t
+hash_key(const material_key_t* key)
+{
+    return hash_combine(hash_combine((uint32_t)key->q[0], (uint32_t)key->q[1]), (uint32_t)key->q[2]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Returns the slot holding the key, or the empty slot it would be inserted
+ * into.
+ */
+static uint32_t*
+find_slot(const material_table_t* table, const material_key_t* key)
+{
+    size_t mask = table->slot_count - 1;
+    size_t i = hash_key(key) & mask;
+    for (;; i = (i + 1) & mask)
+    {
+        uint32_t* slot = &table->slots[i];
+        if (*slot == 0 ||
+            memcmp(vector_get_element(&table->keys, *slot - 1), key, sizeof(material_key_t)) == 0)
+            return slot;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+grow_slots(material_table_t* table)
+{
+    size_t i;
+    size_t new_count = table->slot_count ? table->slot_count * 2 : 64;
+    uint32_t* new_slots = MALLOC(sizeof(uint32_t) * new_count);
+    if (new_slots == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    memset(new_slots, 0, sizeof(uint32_t) * new_count);
+
+    if (table->slots != NULL)
+        FREE(table->slots);
+    table->slots = new_slots;
+    table->slot_count = new_count;
+
+    /* Re-insert all existing keys */
+    for (i = 0; i != vector_count(&table->keys); ++i)
+        *find_slot(table, vector_get_element(&table->keys, i)) = (uint32_t)i + 1;
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+material_table_construct(material_table_t* table)
+{
+    vector_construct(&table->materials, sizeof(attribute_t));
+    vector_construct(&table->keys, sizeof(material_key_t));
+    table->slots = NULL;
+    table->slot_count = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+material_table_clear_free(material_table_t* table)
+{
+    vector_clear_free(&table->materials);
+    vector_clear_free(&table->keys);
+    if (table->slots != NULL)
+        FREE(table->slots);
+    table->slots = NULL;
+    table->slot_count = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+material_table_intern(material_table_t* table, const attribute_t* attribute, material_id_t* id)
+{
+    material_key_t key = make_key(attribute);
+    attribute_t* material;
+    uint32_t* slot;
+    size_t count = vector_count(&table->keys);
+    wsret result;
+
+    /* Keep the load factor below 1/2 so probe sequences stay short */
+    if ((count + 1) * 2 > table->slot_count)
+        if ((result = grow_slots(table)) != WS_OK)
+            return result;
+
+    slot = find_slot(table, &key);
+    if (*slot != 0)
+    {
+        *id = (material_id_t)(*slot - 1);
+        return WS_OK;
+    }
+
+    if (count >= MATERIAL_MAX_COUNT)
+        WSRET(WS_ERR_TOO_MANY_MATERIALS);
+    if (vector_push(&table->keys, &key) == VECTOR_ERROR)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    if ((material = vector_emplace(&table->materials)) == NULL)
+    {
+        vector_pop(&table->keys);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    /* The table stores the canonical (quantized) value of the material */
+    *material = *attribute;
+    material_quantize(material);
+    *slot = (uint32_t)count + 1;
+    *id = (material_id_t)count;
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+material_table_merge(material_table_t* table, const material_table_t* source, material_id_t* remap)
+{
+    size_t i;
+    wsret result;
+    for (i = 0; i != material_table_count(source); ++i)
+    {
+        material_id_t id;
+        if ((result = material_table_intern(table, material_table_get(source, i), &id)) != WS_OK)
+            return result;
+        if (remap != NULL)
+            remap[i] = id;
+    }
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+material_quantize(attribute_t* attribute)
+{
+    attribute->reflection = (wsreal_t)quantize_component(attribute->reflection) / MATERIAL_QUANTIZATION;
+    attribute->transmission = (wsreal_t)quantize_component(attribute->transmission) / MATERIAL_QUANTIZATION;
+    attribute->absorption = (wsreal_t)quantize_component(attribute->absorption) / MATERIAL_QUANTIZATION;
+}
@@ -1,167 +1,81 @@
-#include "wavesim/attribute.h"
+#include "wavesim/bitset.h"
+#include "wavesim/grid.h"
 #include "wavesim/intersections.h"
 #include "wavesim/log.h"
 #include "wavesim/memory.h"
 #include "wavesim/mesh.h"
-#include "wavesim/octree.h"
 #include "wavesim/medium.h"
+#include "wavesim/thread.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+
+#define CELL_INDEX(medium, x, y, z) \
+    (((size_t)(x) * (size_t)(medium)->grid_dims[1] + (size_t)(y)) * (size_t)(medium)->grid_dims[2] + (size_t)(z))
 
 /* ------------------------------------------------------------------------- */
-/*!
- * Subdivides an AABB into smaller "cells" and iterates through every cell.
- * This function begins a new iteration. Thereafter, call iterate_cells_next()
- * to get to the next cell.
- * @param[out] cell The first cell to be iterated is written to this paramter.
- * @param[in] extents The AABB to subdivide.
- * @param[in] cell_size The x,y,z dimensions of a single cell.
- */
 static void
-iterate_cells_begin(wsreal_t cell[6], const wsreal_t extents[6], const wsreal_t cell_size[3])
+mark_box_occupied(medium_t* medium, const int32_t box[6])
 {
-    /* Begin in lower left corner... */
-    memcpy(cell, extents, sizeof(wsreal_t)*3);
-    memcpy(cell+3, extents, sizeof(wsreal_t)*3);
-    vec3_add_vec3(cell+3, cell_size);
+    int32_t x, y;
+    for (x = box[0]; x < box[3]; ++x)
+        for (y = box[1]; y < box[4]; ++y)
+            bitset_set_range(&medium->occupied,
+                             CELL_INDEX(medium, x, y, box[2]),
+                             CELL_INDEX(medium, x, y, box[5]));
 }
 
 /* ------------------------------------------------------------------------- */
 /*!
- * Subdivides an AABB into smaller "cells" and iterates through every cell.
- * This function continues to the next cell after having begun an iteration
- * with iterate_cells_begin().
- * @param[out] cell The next cell AABB will be written to this parameter.
- * @param[in] extents The AABB to subdivide.
- * @return Returns 1 if the cell written to "cell" is still within the extents.
- * Returns 0 if all cells have been iterated.
+ * Cells that don't need simulating are marked as occupied up front, which
+ * keeps the decomposers from covering them with partitions.
  */
-static int
-iterate_cells_next(wsreal_t cell[6], const wsreal_t extents[6])
+static void
+mark_excluded_cells_occupied(medium_t* medium, const grid_t* grid)
 {
-    /* Advance on the Z axis */
-    wsreal_t z_size = cell[5] - cell[2];
-    cell[2] = cell[5];
-    cell[5] += z_size;
-
-    if (cell[5] > extents[5])
-    {
-        /* Reset Z axis and advance on the Y axis */
-        wsreal_t y_size = cell[4] - cell[1];
-        cell[1] = cell[4];
-        cell[4] += y_size;
-        cell[2] = extents[2];
-        cell[5] = extents[2] + z_size;
-
-        if (cell[4] > extents[4])
-        {
-            /* Reset Y axis and advance on the X axis */
-            wsreal_t x_size = cell[3] - cell[0];
-            cell[0] = cell[3];
-            cell[3] += x_size;
-            cell[1] = extents[1];
-            cell[4] = extents[1] + y_size;
-
-            if (cell[3] > extents[3])
-            {
-                /* Done */
-                return 0;
-            }
-        }
-    }
-
-    return 1;
+    size_t i;
+    for (i = 0; i != grid_cell_count(grid); ++i)
+        if (grid->flags[i] & GRID_CELL_EXCLUDED)
+            bitset_set(&medium->occupied, i);
+    medium->excluded_cell_count = grid->excluded_count;
 }
 
 /* ------------------------------------------------------------------------- */
 static int
-determine_cell_attribute(attribute_t* cell_attribute,
-                         const octree_t* octree,
-                         const wsreal_t cell_aabb[6])
+box_is_occupied(const medium_t* medium, const int32_t box[6])
 {
-    wsib_t i;
-    wsreal_t weights_sum;
-    vector_t query_result;
-    vec3_t cell_center;
+    int32_t x, y;
+    int i;
 
-    /* XXX This is super ugly, maybe add a result_construct() function that takes a mesh? */
-    vector_construct(&query_result, octree->mesh->ib_size);
-    if (octree_query_potential_faces(octree, &query_result, cell_aabb) < 1)
-        goto octree_query_failed;
+    /* Everything outside of the grid counts as occupied */
+    for (i = 0; i != 3; ++i)
+        if (box[i] < 0 || box[i+3] > medium->grid_dims[i])
+            return 1;
 
-    /* Calculate the center of the AABB, required for attribute interpolation */
-    vec3_copy(&cell_center, cell_aabb);
-    vec3_add_vec3(cell_center.xyz, cell_aabb+3);
-    vec3_mul_scalar(cell_center.xyz, 0.5);
+    /* Rows along the Z axis are contiguous in the bitset */
+    for (x = box[0]; x < box[3]; ++x)
+        for (y = box[1]; y < box[4]; ++y)
+            if (bitset_any_in_range(&medium->occupied,
+                                    CELL_INDEX(medium, x, y, box[2]),
+                                    CELL_INDEX(medium, x, y, box[5])))
+                return 1;
 
-    /*
-     * Octree delivers a number of faces that *might* intersect the cell AABB,
-     * but we cannot be sure until we do a proper intersection test.
-     */
-    attribute_set_zero(cell_attribute);
-    weights_sum = 0.0;
-    for (i = 0; i != (wsib_t)vector_count(&query_result) / 3; ++i)
-    {
-        int v;
-
-        /* Do intersection test of face with our cell */
-        const mesh_t* m = octree->mesh;
-        face_t face = mesh_get_face_from_buffers(m->vb, query_result.data, m->ab,
-                                                i, m->vb_type, m->ib_type);
-        if (intersect_triangle_aabb_test(
-                face.vertices[0].position.xyz,
-                face.vertices[1].position.xyz,
-                face.vertices[2].position.xyz,
-                cell_aabb) == 0)
-            continue; /* face doesn't intersect our cell, so ignore it */
-
-        /*
-         * Using Shepard's method, weight all vertex attributes according to
-         * their distance to the cell's AABB center.
-         *
-         * https://en.wikipedia.org/wiki/Inverse_distance_weighting
-         */
-        for (v = 0; v != 3; ++v)
-        {
-            wsreal_t weight;
-            vec3_t distance = face.vertices[v].position;
-            vec3_sub_vec3(distance.xyz, cell_center.xyz);
-            weight = vec3_length_squared(distance.xyz);
-            if (weight == 0.0) /* catch division by 0, if the cell center is  right on top of a vertex */
-            {
-                *cell_attribute = face.vertices[v].attr;
-                goto only_one_vertex_matters;
-            }
-            weight = 1.0 / weight; /* We're using p=2, since weight is the squared length */
-            cell_attribute->reflection   += face.vertices[v].attr.reflection * weight;
-            cell_attribute->transmission += face.vertices[v].attr.transmission * weight;
-            cell_attribute->absorption   += face.vertices[v].attr.absorption * weight;
-            weights_sum += weight;
-        }
-    }
+    return 0;
+}
 
-    /* It's possible that no faces intersected, in which case we assume it's air */
-    if (weights_sum == 0.0)
-    {
-        attribute_set_default_air(cell_attribute);
-    }
-    else
+/* ------------------------------------------------------------------------- */
+static void
+box_expand_box(int32_t box[6], const int32_t other[6])
+{
+    int i;
+    for (i = 0; i != 3; ++i)
     {
-        weights_sum = 1.0 / weights_sum;
-        cell_attribute->absorption *= weights_sum;
-        cell_attribute->reflection *= weights_sum;
-        cell_attribute->transmission *= weights_sum;
-        /* Need to normalize it so 1 = reflection + transmission + absorption */
-        weights_sum = cell_attribute->reflection + cell_attribute->transmission + cell_attribute->absorption;
-        weights_sum = 1.0 / weights_sum;
-        cell_attribute->absorption *= weights_sum;
-        cell_attribute->reflection *= weights_sum;
-        cell_attribute->transmission *= weights_sum;
+        if (other[i] < box[i])
+            box[i] = other[i];
+        if (other[i+3] > box[i+3])
+            box[i+3] = other[i+3];
     }
-
-    only_one_vertex_matters:
-    octree_query_failed : vector_clear_free(&query_result);
-    return -1;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -188,7 +102,19 @@ void
 medium_construct(medium_t* medium)
 {
     vector_construct(&medium->partitions, sizeof(medium_partition_t));
+    material_table_construct(&medium->materials);
+    vector_construct(&medium->adjacency_offsets, sizeof(size_t));
+    vector_construct(&medium->interfaces, sizeof(medium_interface_t));
+    bitset_construct(&medium->occupied);
+    medium->grid_dims[0] = 0;
+    medium->grid_dims[1] = 0;
+    medium->grid_dims[2] = 0;
     medium->decompose = medium_decompose_systematic;
+    medium->decomposition_seed = 0;
+    medium->thread_count = 1;
+    medium->keep_exterior_air = 0;
+    medium->sound_speed = 343;
+    medium->excluded_cell_count = 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -196,33 +122,56 @@ void
 medium_destruct(medium_t* medium)
 {
     medium_clear(medium);
+    bitset_clear_free(&medium->occupied);
 }
 
 /* ------------------------------------------------------------------------- */
 void
 medium_clear(medium_t* medium)
 {
-    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
-        vector_clear_free(&partition->adcacent_partitions);
-    VECTOR_END_EACH
     vector_clear_free(&medium->partitions);
+    material_table_clear_free(&medium->materials);
+    vector_clear_free(&medium->adjacency_offsets);
+    vector_clear_free(&medium->interfaces);
+    bitset_reset(&medium->occupied);
+    medium->excluded_cell_count = 0;
 }
 
 /* ------------------------------------------------------------------------- */
 wsret
-medium_add_partition(medium_t* medium, const wsreal_t bb[6], wsreal_t sound_speed)
+medium_add_partition(medium_t* medium, const int32_t box[6], material_id_t material, wsreal_t sound_speed)
 {
     medium_partition_t* partition = vector_emplace(&medium->partitions);
     if (partition == NULL)
         WSRET(WS_ERR_OUT_OF_MEMORY);
 
-    partition->aabb = aabb(bb[0], bb[1], bb[2], bb[3], bb[4], bb[5]);
+    memcpy(partition->box, box, sizeof(partition->box));
+    partition->material = material;
     partition->sound_speed = sound_speed;
-    vector_construct(&partition->adcacent_partitions, sizeof(int32_t));
+
+    /* Keep track of which cells are covered by partitions */
+    if (bitset_count(&medium->occupied) != 0)
+        mark_box_occupied(medium, box);
 
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+aabb_t
+medium_partition_aabb(const medium_t* medium, const medium_partition_t* partition)
+{
+    const wsreal_t* origin = medium->boundary.b.min.xyz;
+    const wsreal_t* size = medium->grid_size.xyz;
+    return aabb(
+        origin[0] + size[0] * partition->box[0],
+        origin[1] + size[1] * partition->box[1],
+        origin[2] + size[2] * partition->box[2],
+        origin[0] + size[0] * partition->box[3],
+        origin[1] + size[1] * partition->box[4],
+        origin[2] + size[2] * partition->box[5]
+    );
+}
+
 /* ------------------------------------------------------------------------- */
 void
 medium_set_decomposition_method(medium_t* medium,
@@ -231,6 +180,34 @@ medium_set_decomposition_method(medium_t* medium,
     medium->decompose = method;
 }
 
+/* ------------------------------------------------------------------------- */
+void
+medium_set_decomposition_seed(medium_t* medium, uint64_t seed)
+{
+    medium->decomposition_seed = seed;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+medium_set_thread_count(medium_t* medium, int thread_count)
+{
+    medium->thread_count = thread_count;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+medium_set_keep_exterior_air(medium_t* medium, int keep)
+{
+    medium->keep_exterior_air = keep;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+medium_set_sound_speed(medium_t* medium, wsreal_t sound_speed)
+{
+    medium->sound_speed = sound_speed;
+}
+
 /* ------------------------------------------------------------------------- */
 typedef enum direction_e
 {
@@ -245,90 +222,83 @@ typedef enum direction_e
     ALL_DIRECTIONS = UP | DOWN | LEFT | RIGHT | FRONT | BACK,
     DIRECTION_COUNT = 6
 } direction_e;
-static aabb_t
-get_adjacent_slice(const medium_t* medium, const wsreal_t aabb[6], direction_e direction)
+static void
+get_adjacent_slice(int32_t slice[6], const int32_t box[6], direction_e direction)
 {
-    aabb_t adjacent;
-    memcpy(adjacent.xyzxyz, aabb, sizeof(adjacent.xyzxyz));
+    memcpy(slice, box, sizeof(int32_t) * 6);
     switch (direction)
     {
-        case UP :
-            AABB_AY(adjacent) = aabb[4];
-            AABB_BY(adjacent) = aabb[4] + medium->grid_size.v.y;
-            break;
-        case DOWN:
-            AABB_AY(adjacent) = aabb[1] - medium->grid_size.v.y;
-            AABB_BY(adjacent) = aabb[1];
-            break;
-        case LEFT :
-            AABB_AX(adjacent) = aabb[0] - medium->grid_size.v.x;
-            AABB_BX(adjacent) = aabb[0];
-            break;
-        case RIGHT:
-            AABB_AX(adjacent) = aabb[3];
-            AABB_BX(adjacent) = aabb[3] + medium->grid_size.v.x;
-            break;
-        case FRONT :
-            AABB_AZ(adjacent) = aabb[2] - medium->grid_size.v.z;
-            AABB_BZ(adjacent) = aabb[2];
-            break;
-        case BACK:
-            AABB_AZ(adjacent) = aabb[5];
-            AABB_BZ(adjacent) = aabb[5] + medium->grid_size.v.z;
-            break;
+        case UP    : slice[1] = box[4]; slice[4] = box[4] + 1; break;
+        case DOWN  : slice[1] = box[1] - 1; slice[4] = box[1]; break;
+        case LEFT  : slice[0] = box[0] - 1; slice[3] = box[0]; break;
+        case RIGHT : slice[0] = box[3]; slice[3] = box[3] + 1; break;
+        case FRONT : slice[2] = box[2] - 1; slice[5] = box[2]; break;
+        case BACK  : slice[2] = box[5]; slice[5] = box[5] + 1; break;
         default: break;
     }
-
-    return adjacent;
 }
-static int
-medium_partition_already_occupied(const medium_t* medium, const wsreal_t aabb[6])
+typedef struct seed_t
 {
-    /* First make sure it's within bounds */
-    int i;
-    for (i = 0; i != 3; ++i)
-        if (aabb[i+0] < medium->boundary.b.min.xyz[i] ||
-            aabb[i+3] > medium->boundary.b.max.xyz[i])
-        {
-            return 1;
-        }
+    int32_t cell[3];
+} seed_t;
+typedef struct seed_queue_t
+{
+    vector_t seeds;      /* seed_t, used as a stack */
+    bitset_t queued;     /* One bit per cell, set once a cell has been queued */
+    size_t   peak_count; /* Largest number of seeds waiting at any time */
+} seed_queue_t;
+static wsret
+seed_queue_push(seed_queue_t* queue, const medium_t* medium,
+                int32_t x, int32_t y, int32_t z)
+{
+    seed_t* seed;
+    size_t idx = CELL_INDEX(medium, x, y, z);
 
-    /* Next, check if it intersects with any other partition in the medium */
-    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
-        if (intersect_aabb_aabb_test(partition->aabb.xyzxyz, aabb))
-            return 1;
-    VECTOR_END_EACH
+    /*
+     * Every cell is queued at most once, which bounds the size of the queue
+     * to the number of cells in the grid.
+     */
+    if (bitset_test(&queue->queued, idx))
+        return WS_OK;
+    if ((seed = vector_emplace(&queue->seeds)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    bitset_set(&queue->queued, idx);
 
-    return 0;
+    seed->cell[0] = x;
+    seed->cell[1] = y;
+    seed->cell[2] = z;
+    if (queue->peak_count < vector_count(&queue->seeds))
+        queue->peak_count = vector_count(&queue->seeds);
+
+    return WS_OK;
 }
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Expands a box evenly in all directions for as long as the adjacent slices
+ * are unoccupied and consist only of cells with the specified material.
+ * If a queue is specified, then every cell with a different material that
+ * is encountered is pushed as a new seed. Otherwise, a slice is rejected as
+ * soon as the first mismatching cell is found.
+ */
 static wsret
-decompose_systematic_recursive(medium_t* medium,
-                               size_t parent_partition_idx,
-                               const octree_t* octree,
-                               const medium_t* mediumdef,
-                               aabb_t seed)
+grow_box(int32_t box[6],
+         const medium_t* medium,
+         const grid_t* grid,
+         material_id_t material,
+         seed_queue_t* queue)
 {
     size_t direction;
     size_t occupied_direction_flags;
-    vector_t potential_new_seeds;
-    size_t this_partition_idx;
-
-    /* Determine the cell type of our seed */
-    attribute_t seed_attr;
-    determine_cell_attribute(&seed_attr, octree, seed.xyzxyz);
+    wsret result;
 
-    /*
-     * Try to expand the seed evenly in all directions, until we hit an adjacent
-     * cell that has different attributes.
-     */
-    vector_construct(&potential_new_seeds, sizeof(aabb_t));
     do
     {
         occupied_direction_flags = 0;
         for (direction = DIR_ITER_START; direction != DIR_ITER_END; direction <<= 1)
         {
-            aabb_t slice;
-            aabb_t cell;
+            int32_t slice[6];
+            int32_t x, y, z;
             int slice_is_same_as_seed;
 
             /* Check if this direction has been flagged as occupied. If so, no
@@ -336,135 +306,740 @@ decompose_systematic_recursive(medium_t* medium,
             if (occupied_direction_flags & direction)
                 continue;
 
-            /* Calculate a slice adjacent to this seed and make sure it doesn't
+            /* Calculate a slice adjacent to this box and make sure it doesn't
              * already exist in the medium. */
-            slice = get_adjacent_slice(medium, seed.xyzxyz, direction);
-            if (medium_partition_already_occupied(medium, slice.xyzxyz))
+            get_adjacent_slice(slice, box, (direction_e)direction);
+            if (box_is_occupied(medium, slice))
             {
                 occupied_direction_flags |= direction;
                 continue;
             }
 
             /* Iterate through all cells in the slice and confirm that these cells
-             * have the same attributes as our seed cell */
+             * have the same material as our seed cell */
             slice_is_same_as_seed = 1;
-            iterate_cells_begin(cell.xyzxyz, slice.xyzxyz, medium->grid_size.xyz);
-            do
-            {
-                attribute_t cell_attribute;
-                determine_cell_attribute(&cell_attribute, octree, cell.xyzxyz);
-                if (attribute_is_same(&seed_attr, &cell_attribute) == 0)
-                {
-                    aabb_t* new_seed = vector_emplace(&potential_new_seeds);
-                    if (new_seed == NULL)
-                        goto ran_out_of_memory;
-                    *new_seed = cell;
-                    slice_is_same_as_seed = 0;
-                }
-            } while(iterate_cells_next(cell.xyzxyz, slice.xyzxyz));
-            if (slice_is_same_as_seed == 0)
+            for (x = slice[0]; x != slice[3]; ++x)
+                for (y = slice[1]; y != slice[4]; ++y)
+                    for (z = slice[2]; z != slice[5]; ++z)
+                        if (grid_cell_material(grid, x, y, z) != material)
+                        {
+                            slice_is_same_as_seed = 0;
+                            if (queue == NULL)
+                                goto slice_rejected;
+                            if ((result = seed_queue_push(queue, medium, x, y, z)) != WS_OK)
+                                return result;
+                        }
+            slice_rejected : if (slice_is_same_as_seed == 0)
             {
                 occupied_direction_flags |= direction;
                 continue;
             }
 
-            /* Since slice has the same attributes, we can merge it with our
-             * seed now */
-            aabb_expand_aabb(seed.xyzxyz, slice.xyzxyz);
+            /* Since slice has the same material, we can merge it with our
+             * box now */
+            box_expand_box(box, slice);
         }
     } while (occupied_direction_flags != ALL_DIRECTIONS);
 
+    return WS_OK;
+}
+static wsret
+decompose_systematic_seed(medium_t* medium,
+                          seed_queue_t* queue,
+                          const grid_t* grid,
+                          const seed_t* seed_cell)
+{
+    size_t this_partition_idx;
+    int32_t seed[6];
+    wsret result;
+
+    /* Look up the cell type of our seed */
+    material_id_t seed_material = grid_cell_material(grid, seed_cell->cell[0], seed_cell->cell[1], seed_cell->cell[2]);
+    seed[0] = seed_cell->cell[0]; seed[3] = seed_cell->cell[0] + 1;
+    seed[1] = seed_cell->cell[1]; seed[4] = seed_cell->cell[1] + 1;
+    seed[2] = seed_cell->cell[2]; seed[5] = seed_cell->cell[2] + 1;
+    this_partition_idx = vector_count(&medium->partitions);
+
+    /*
+     * Try to expand the seed evenly in all directions, until we hit an adjacent
+     * cell that has a different material. All of the cells with different
+     * materials are potential new seeds from which we can expand new
+     * partitions later on.
+     */
+    if ((result = grow_box(seed, medium, grid, seed_material, queue)) != WS_OK)
+        return result;
+
     /*
      * At this point, the seed has been expanded as much as possible without
      * intersecting existing partitions in the medium. Add it to the medium as
      * a new partition.
      */
-    assert(medium_partition_already_occupied(medium, seed.xyzxyz) == 0);
-    this_partition_idx = vector_count(&medium->partitions);
-    if (medium_add_partition(medium, seed.xyzxyz, 1) != 0)
-        goto ran_out_of_memory;
-    ws_log_info(&g_ws_log, "Adding partition #%d (%f,%f,%f,%f,%f,%f)", this_partition_idx, seed.xyzxyz[0], seed.xyzxyz[1], seed.xyzxyz[2], seed.xyzxyz[3], seed.xyzxyz[4], seed.xyzxyz[5]);
+    assert(box_is_occupied(medium, seed) == 0);
+    if ((result = medium_add_partition(medium, seed, seed_material, medium->sound_speed)) != WS_OK)
+        return result;
+    ws_log_info(&g_ws_log, "Adding partition #%d (%d,%d,%d,%d,%d,%d)", (int)this_partition_idx, seed[0], seed[1], seed[2], seed[3], seed[4], seed[5]);
 
-    /* Add ourselves to the parent partition's adjacent list, if possible */
-    if (parent_partition_idx != VECTOR_ERROR)
-    {
-        medium_partition_t* parent_partition = vector_get_element(&medium->partitions, parent_partition_idx);
-        size_t* adjacent_partition_idx = vector_emplace(&parent_partition->adcacent_partitions);
-        if (adjacent_partition_idx == NULL)
-            goto ran_out_of_memory;
-        *adjacent_partition_idx = this_partition_idx;
-    }
+    return WS_OK;
+}
+wsret
+medium_decompose_systematic(medium_t* medium,
+                            const grid_t* grid,
+                            const medium_t* mediumdef)
+{
+    seed_queue_t queue;
+    size_t next_free_cell;
+    wsret result = WS_OK;
+    (void)mediumdef;
+
+    vector_construct(&queue.seeds, sizeof(seed_t));
+    bitset_construct(&queue.queued);
+    queue.peak_count = 0;
+    if ((result = bitset_resize(&queue.queued, grid_cell_count(grid))) != WS_OK)
+        return result;
 
     /*
-     * During expansion, we tracked which cells had different attributes than
-     * our own. All of these cells are potential new seeds from which we can
-     * expand new partitions.
+     * Start at the bottom, left, front corner. Expanding a partition queues
+     * the cells it bumps into as new seeds, which are processed depth first.
+     * Seeds only ever come from cells with different materials, so once the
+     * queue runs dry, resume at the next cell no partition covers yet.
      */
-    VECTOR_FOR_EACH(&potential_new_seeds, aabb_t, new_seed)
-        wsret result;
-        if (medium_partition_already_occupied(medium, new_seed->xyzxyz))
-            continue;
-        result = decompose_systematic_recursive(medium, this_partition_idx, octree, mediumdef, *new_seed);
-        if (result != WS_OK)
+    next_free_cell = 0;
+    while ((next_free_cell = bitset_find_unset(&medium->occupied, next_free_cell)) != bitset_count(&medium->occupied))
+    {
+        size_t yz = (size_t)medium->grid_dims[1] * (size_t)medium->grid_dims[2];
+        int32_t x = (int32_t)(next_free_cell / yz);
+        int32_t y = (int32_t)((next_free_cell % yz) / (size_t)medium->grid_dims[2]);
+        int32_t z = (int32_t)(next_free_cell % (size_t)medium->grid_dims[2]);
+        if ((result = seed_queue_push(&queue, medium, x, y, z)) != WS_OK)
+            goto bail;
+
+        while (vector_count(&queue.seeds) != 0)
         {
-            vector_clear_free(&potential_new_seeds);
-            return result;
+            int32_t box[6];
+            seed_t seed = *(seed_t*)vector_pop(&queue.seeds);
+            box[0] = seed.cell[0]; box[3] = seed.cell[0] + 1;
+            box[1] = seed.cell[1]; box[4] = seed.cell[1] + 1;
+            box[2] = seed.cell[2]; box[5] = seed.cell[2] + 1;
+            if (box_is_occupied(medium, box))
+                continue;
+            if ((result = decompose_systematic_seed(medium, &queue, grid, &seed)) != WS_OK)
+                goto bail;
         }
-    VECTOR_END_EACH
+    }
 
-    vector_clear_free(&potential_new_seeds);
-    (void)mediumdef;
-    return WS_OK;
+    ws_log_info(&g_ws_log, "Peak seed queue size: %d", (int)queue.peak_count);
 
-    ran_out_of_memory: WSRET(WS_ERR_OUT_OF_MEMORY);
+    bail : bitset_clear_free(&queue.queued);
+    vector_clear_free(&queue.seeds);
+    return result;
 }
-wsret
-medium_decompose_systematic(medium_t* medium,
-                            const octree_t* octree,
-                            const medium_t* mediumdef)
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * splitmix64, a small and fast generator. Its output is identical on every
+ * platform, which keeps decompositions reproducible.
+ */
+static uint64_t
+random_next(uint64_t* state)
 {
-    /* Start at the bottom, left, front corner */
-    aabb_t seed = aabb(
-        AABB_AX(medium->boundary),
-        AABB_AY(medium->boundary),
-        AABB_AZ(medium->boundary),
-        AABB_AX(medium->boundary) + medium->grid_size.v.x,
-        AABB_AY(medium->boundary) + medium->grid_size.v.y,
-        AABB_AZ(medium->boundary) + medium->grid_size.v.z
-    );
-    return decompose_systematic_recursive(medium, VECTOR_ERROR, octree, mediumdef, seed);
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
 }
 
 /* ------------------------------------------------------------------------- */
 wsret
 medium_decompose_greedy_random(medium_t* medium,
-                               const octree_t* octree,
+                               const grid_t* grid,
                                const medium_t* mediumdef)
 {
-    (void)medium;
-    (void)octree;
+    uint64_t rng_state = medium->decomposition_seed;
+    size_t cell_count = bitset_count(&medium->occupied);
+    size_t yz = (size_t)medium->grid_dims[1] * (size_t)medium->grid_dims[2];
+    wsret result;
     (void)mediumdef;
+
+    for (;;)
+    {
+        int32_t box[6];
+        material_id_t material;
+
+        /*
+         * Pick a random cell. If it is already covered, use the next uncovered
+         * cell after it instead (wrapping around), which is found a word of
+         * the occupancy bitset at a time. This avoids endlessly re-rolling
+         * once most of the grid has been covered.
+         */
+        size_t cell = cell_count ? (size_t)(random_next(&rng_state) % cell_count) : 0;
+        cell = bitset_find_unset(&medium->occupied, cell);
+        if (cell == cell_count)
+            cell = bitset_find_unset(&medium->occupied, 0);
+        if (cell == cell_count)
+            break; /* every cell is covered */
+
+        box[0] = (int32_t)(cell / yz);                                box[3] = box[0] + 1;
+        box[1] = (int32_t)((cell % yz) / (size_t)medium->grid_dims[2]); box[4] = box[1] + 1;
+        box[2] = (int32_t)(cell % (size_t)medium->grid_dims[2]);        box[5] = box[2] + 1;
+
+        /* Grow the cell into the largest uniform box we can find */
+        material = grid_cell_material(grid, box[0], box[1], box[2]);
+        if ((result = grow_box(box, medium, grid, material, NULL)) != WS_OK)
+            return result;
+        if ((result = medium_add_partition(medium, box, material, medium->sound_speed)) != WS_OK)
+            return result;
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The parallel build splits the grid into slabs along the X axis ("bricks").
+ * Since X is the slowest changing index of the cell array, the cells of a
+ * brick are contiguous and a brick can use a grid that points into the full
+ * grid's cell array without copying anything.
+ */
+typedef struct brick_t
+{
+    medium_t        medium;     /* Partitions found in this brick, in brick coordinates */
+    grid_t          grid;       /* View into full_grid, doesn't own its cells but has its own material table */
+    grid_t*         full_grid;
+    const mesh_t*   mesh;
+    const medium_t* mediumdef;
+    int32_t         x_begin;
+    int32_t         x_end;
+    wsret           result;
+} brick_t;
+
+typedef struct seam_partition_t
+{
+    int32_t rect[4]; /* y and z extents: ymin, ymax, zmin, zmax */
+    size_t  idx;
+} seam_partition_t;
+
+static void
+classify_brick(void* arg)
+{
+    /* Bricks classify disjoint ranges of the shared cell array */
+    brick_t* brick = arg;
+    brick->result = grid_classify_cells(&brick->grid, brick->mesh, 0, brick->grid.dims[0]);
+}
+
+static void
+decompose_brick(void* arg)
+{
+    brick_t* brick = arg;
+    brick->result = brick->medium.decompose(&brick->medium, &brick->grid, brick->mediumdef);
+}
+
+/*!
+ * Runs func on every brick on its own thread and waits for all of them to
+ * finish.
+ */
+static wsret
+run_bricks(brick_t* bricks, thread_t** threads, int brick_count, thread_func func)
+{
+    int b, started;
+    wsret result = WS_OK;
+
+    for (started = 0; started != brick_count; ++started)
+        if ((result = thread_start(&threads[started], func, &bricks[started])) != WS_OK)
+            break;
+    for (b = 0; b != started; ++b)
+        thread_join(threads[b]);
+    if (result != WS_OK)
+        return result;
+
+    for (b = 0; b != brick_count; ++b)
+        if (bricks[b].result != WS_OK)
+            return bricks[b].result;
     return WS_OK;
 }
 
+static int
+seam_partition_compare(const void* a, const void* b)
+{
+    const int32_t* ra = ((const seam_partition_t*)a)->rect;
+    const int32_t* rb = ((const seam_partition_t*)b)->rect;
+    int i;
+    for (i = 0; i != 4; ++i)
+        if (ra[i] != rb[i])
+            return ra[i] < rb[i] ? -1 : 1;
+    return 0;
+}
+
+static size_t
+merged_root(const size_t* merged_into, size_t idx)
+{
+    while (merged_into[idx] != idx)
+        idx = merged_into[idx];
+    return idx;
+}
+
+/*!
+ * Collects the partitions touching the seam at x == seam_x, either from the
+ * left (their box ends at the seam) or from the right (their box starts at
+ * the seam), sorted by their y/z extents.
+ */
+static size_t
+collect_seam_partitions(seam_partition_t* out,
+                        const medium_t* medium,
+                        const size_t* merged_into,
+                        size_t begin, size_t end,
+                        int32_t seam_x, int from_left)
+{
+    size_t i, count = 0;
+    for (i = begin; i != end; ++i)
+    {
+        size_t idx = merged_root(merged_into, i);
+        const medium_partition_t* partition = vector_get_element(&medium->partitions, idx);
+        if (partition->box[from_left ? 3 : 0] != seam_x)
+            continue;
+        out[count].rect[0] = partition->box[1];
+        out[count].rect[1] = partition->box[4];
+        out[count].rect[2] = partition->box[2];
+        out[count].rect[3] = partition->box[5];
+        out[count].idx = idx;
+        ++count;
+    }
+    qsort(out, count, sizeof(seam_partition_t), seam_partition_compare);
+    return count;
+}
+
+/*!
+ * Every brick interned the materials of its cells into its own table. Merges
+ * them into the full grid's table and rewrites the cells to the merged IDs.
+ * Afterwards, each brick's table is replaced with a copy of the merged one so
+ * the views stay consistent.
+ */
+static wsret
+merge_brick_materials(grid_t* grid, brick_t* bricks, int brick_count)
+{
+    material_id_t* remap;
+    int b;
+    wsret result = WS_OK;
+
+    if ((remap = MALLOC(sizeof(material_id_t) * MATERIAL_MAX_COUNT)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
+    for (b = 0; b != brick_count; ++b)
+    {
+        grid_t* view = &bricks[b].grid;
+        size_t i;
+        if ((result = material_table_merge(&grid->materials, &view->materials, remap)) != WS_OK)
+            goto bail;
+        for (i = 0; i != grid_cell_count(view); ++i)
+            view->cells[i] = remap[view->cells[i]];
+    }
+    for (b = 0; b != brick_count; ++b)
+    {
+        material_table_clear_free(&bricks[b].grid.materials);
+        if ((result = material_table_merge(&bricks[b].grid.materials, &grid->materials, NULL)) != WS_OK)
+            goto bail;
+    }
+
+    bail : FREE(remap);
+    return result;
+}
+
+/*!
+ * Moves the partitions of all bricks into the medium. Partitions on both
+ * sides of a seam with identical cross sections and materials are merged
+ * into one.
+ */
+static wsret
+merge_bricks(medium_t* medium, const grid_t* grid, brick_t* bricks, int brick_count)
+{
+    size_t* first = NULL;       /* Index of the first partition of each brick */
+    size_t* merged_into = NULL; /* Every partition maps to itself unless it was merged */
+    seam_partition_t* left = NULL;
+    seam_partition_t* right = NULL;
+    size_t i, count, kept;
+    int b;
+    wsret result = WS_OK;
+
+    /* Move partitions into the medium, converting to grid coordinates */
+    first = MALLOC(sizeof(size_t) * (size_t)(brick_count + 1));
+    if (first == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (b = 0; b != brick_count; ++b)
+    {
+        vector_t* partitions = &bricks[b].medium.partitions;
+        first[b] = vector_count(&medium->partitions);
+        if (vector_count(partitions) != 0 && vector_push_vector(&medium->partitions, partitions) == VECTOR_ERROR)
+        {
+            result = WS_ERR_OUT_OF_MEMORY;
+            goto bail;
+        }
+        VECTOR_FOR_EACH_RANGE(&medium->partitions, medium_partition_t, partition, first[b], vector_count(&medium->partitions))
+            partition->box[0] += bricks[b].x_begin;
+            partition->box[3] += bricks[b].x_begin;
+        VECTOR_END_EACH
+    }
+    first[brick_count] = count = vector_count(&medium->partitions);
+
+    merged_into = MALLOC(sizeof(size_t) * (count + 1));
+    left = MALLOC(sizeof(seam_partition_t) * (count + 1));
+    right = MALLOC(sizeof(seam_partition_t) * (count + 1));
+    if (merged_into == NULL || left == NULL || right == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+    for (i = 0; i != count; ++i)
+        merged_into[i] = i;
+
+    /*
+     * Partitions that were cut in two by a seam have the same cross section
+     * on both sides. Merging them undoes the cut. A partition on the left may
+     * itself already be the result of a merge with a previous brick.
+     */
+    for (b = 0; b + 1 < brick_count; ++b)
+    {
+        int32_t seam_x = bricks[b].x_end;
+        size_t l, r;
+        size_t left_count = collect_seam_partitions(left, medium, merged_into, first[b], first[b+1], seam_x, 1);
+        size_t right_count = collect_seam_partitions(right, medium, merged_into, first[b+1], first[b+2], seam_x, 0);
+        for (l = 0, r = 0; l != left_count && r != right_count; )
+        {
+            int order = seam_partition_compare(&left[l], &right[r]);
+            if (order == 0)
+            {
+                medium_partition_t* lp = vector_get_element(&medium->partitions, left[l].idx);
+                medium_partition_t* rp = vector_get_element(&medium->partitions, right[r].idx);
+                if (lp->material == rp->material)
+                {
+                    lp->box[3] = rp->box[3];
+                    merged_into[right[r].idx] = left[l].idx;
+                }
+            }
+            if (order <= 0) ++l;
+            if (order >= 0) ++r;
+        }
+    }
+
+    /* Remove merged partitions */
+    for (i = 0, kept = 0; i != count; ++i)
+    {
+        if (merged_into[i] != i)
+            continue;
+        if (kept != i)
+            memcpy(vector_get_element(&medium->partitions, kept),
+                   vector_get_element(&medium->partitions, i),
+                   sizeof(medium_partition_t));
+        ++kept;
+    }
+    vector_resize(&medium->partitions, kept);
+
+    /* Occupancy of the full grid */
+    bitset_reset(&medium->occupied);
+    mark_excluded_cells_occupied(medium, grid);
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        mark_box_occupied(medium, partition->box);
+    VECTOR_END_EACH
+
+    ws_log_info(&g_ws_log, "Merged %d partitions across %d brick seams", (int)(count - kept), brick_count - 1);
+
+    bail : if (right) FREE(right);
+    if (left) FREE(left);
+    if (merged_into) FREE(merged_into);
+    FREE(first);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+decompose_in_bricks(medium_t* medium,
+                    grid_t* grid,
+                    const mesh_t* mesh,
+                    const medium_t* mediumdef,
+                    int brick_count)
+{
+    brick_t* bricks;
+    thread_t** threads;
+    int b;
+    wsret result = WS_OK;
+
+    bricks = MALLOC(sizeof(brick_t) * (size_t)brick_count);
+    threads = MALLOC(sizeof(thread_t*) * (size_t)brick_count);
+    if (bricks == NULL || threads == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto free_arrays;
+    }
+
+    /* Spread the X layers of the grid as evenly as possible over the bricks */
+    for (b = 0; b != brick_count; ++b)
+    {
+        brick_t* brick = &bricks[b];
+        medium_t* sub = &brick->medium;
+        brick->x_begin = (int32_t)((int64_t)grid->dims[0] * b / brick_count);
+        brick->x_end = (int32_t)((int64_t)grid->dims[0] * (b + 1) / brick_count);
+        brick->full_grid = grid;
+        brick->mesh = mesh;
+        brick->mediumdef = mediumdef;
+        brick->result = WS_OK;
+
+        brick->grid = *grid;
+        brick->grid.dims[0] = brick->x_end - brick->x_begin;
+        brick->grid.origin.v.x += grid->cell_size.v.x * brick->x_begin;
+        brick->grid.cells = grid->cells + GRID_INDEX(grid, brick->x_begin, 0, 0);
+        brick->grid.flags = grid->flags + GRID_INDEX(grid, brick->x_begin, 0, 0);
+        material_table_construct(&brick->grid.materials);
+
+        medium_construct(sub);
+        sub->boundary = medium->boundary;
+        sub->boundary.b.min.v.x = brick->grid.origin.v.x;
+        sub->boundary.b.max.v.x = brick->grid.origin.v.x + grid->cell_size.v.x * brick->grid.dims[0];
+        sub->grid_size = medium->grid_size;
+        memcpy(sub->grid_dims, brick->grid.dims, sizeof(sub->grid_dims));
+        sub->decompose = medium->decompose;
+        sub->sound_speed = medium->sound_speed;
+        sub->decomposition_seed = medium->decomposition_seed + (uint64_t)b;
+    }
+    for (b = 0; b != brick_count; ++b)
+        if ((result = bitset_resize(&bricks[b].medium.occupied, grid_cell_count(&bricks[b].grid))) != WS_OK)
+            goto destruct_bricks;
+
+    /*
+     * Finding exterior cells needs the whole grid, so all bricks have to be
+     * classified before any of them can be decomposed.
+     */
+    if ((result = run_bricks(bricks, threads, brick_count, classify_brick)) != WS_OK)
+        goto destruct_bricks;
+    if ((result = merge_brick_materials(grid, bricks, brick_count)) != WS_OK)
+        goto destruct_bricks;
+    ws_log_info(&g_ws_log, "Classified %d x %d x %d grid cells in %d bricks", grid->dims[0], grid->dims[1], grid->dims[2], brick_count);
+    if ((result = grid_exclude_cells(grid, mesh, medium->keep_exterior_air)) != WS_OK)
+        goto destruct_bricks;
+    for (b = 0; b != brick_count; ++b)
+        mark_excluded_cells_occupied(&bricks[b].medium, &bricks[b].grid);
+
+    if ((result = run_bricks(bricks, threads, brick_count, decompose_brick)) != WS_OK)
+        goto destruct_bricks;
+
+    result = merge_bricks(medium, grid, bricks, brick_count);
+
+    destruct_bricks : for (b = 0; b != brick_count; ++b)
+    {
+        medium_destruct(&bricks[b].medium);
+        material_table_clear_free(&bricks[b].grid.materials);
+    }
+    free_arrays : if (threads) FREE(threads);
+    if (bricks) FREE(bricks);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+typedef struct sweep_entry_t
+{
+    int32_t x_begin;
+    int32_t x_end;
+    int32_t idx;
+} sweep_entry_t;
+
+typedef struct interface_edge_t
+{
+    int32_t            owner;
+    medium_interface_t interface;
+} interface_edge_t;
+
+static int
+sweep_entry_compare(const void* a, const void* b)
+{
+    const sweep_entry_t* ea = a;
+    const sweep_entry_t* eb = b;
+    if (ea->x_begin != eb->x_begin)
+        return ea->x_begin < eb->x_begin ? -1 : 1;
+    return (ea->idx > eb->idx) - (ea->idx < eb->idx);
+}
+
+static int
+interface_edge_compare(const void* a, const void* b)
+{
+    const interface_edge_t* ea = a;
+    const interface_edge_t* eb = b;
+    if (ea->owner != eb->owner)
+        return ea->owner < eb->owner ? -1 : 1;
+    return (ea->interface.partition > eb->interface.partition) -
+           (ea->interface.partition < eb->interface.partition);
+}
+
+/*!
+ * If the two (non-overlapping) boxes share part of a face, the shared
+ * rectangle is written to rect and the axis normal to it is returned.
+ * Otherwise -1 is returned. Boxes that only touch along an edge or a corner
+ * don't share a face.
+ */
+static int
+boxes_share_face(int32_t rect[6], const int32_t a[6], const int32_t b[6])
+{
+    int i, axis = -1;
+    for (i = 0; i != 3; ++i)
+    {
+        rect[i] = a[i] > b[i] ? a[i] : b[i];
+        rect[i+3] = a[i+3] < b[i+3] ? a[i+3] : b[i+3];
+        if (rect[i] > rect[i+3])
+            return -1; /* separated */
+        if (rect[i] == rect[i+3])
+        {
+            if (axis != -1)
+                return -1; /* edge or corner contact */
+            axis = i;
+        }
+    }
+    return axis;
+}
+
+static wsret
+push_interface_edge(vector_t* edges, int32_t owner, int32_t neighbour,
+                    const int32_t rect[6], int axis, int32_t side)
+{
+    interface_edge_t* edge = vector_emplace(edges);
+    if (edge == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    edge->owner = owner;
+    edge->interface.partition = neighbour;
+    edge->interface.axis = axis;
+    edge->interface.side = side;
+    memcpy(edge->interface.rect, rect, sizeof(edge->interface.rect));
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+medium_build_adjacency(medium_t* medium)
+{
+    sweep_entry_t* entries;
+    vector_t edges;
+    size_t count = vector_count(&medium->partitions);
+    size_t i, j;
+    size_t* offsets;
+    wsret result = WS_OK;
+
+    vector_clear_free(&medium->adjacency_offsets);
+    vector_clear_free(&medium->interfaces);
+    vector_construct(&edges, sizeof(interface_edge_t));
+
+    if ((entries = MALLOC(sizeof(sweep_entry_t) * (count + 1))) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (i = 0; i != count; ++i)
+    {
+        const medium_partition_t* partition = vector_get_element(&medium->partitions, i);
+        entries[i].x_begin = partition->box[0];
+        entries[i].x_end = partition->box[3];
+        entries[i].idx = (int32_t)i;
+    }
+
+    /*
+     * Sweep and prune along the X axis. With the boxes sorted by their
+     * minimum X coordinate, only boxes starting before the current box ends
+     * (or exactly where it ends) can possibly touch it.
+     */
+    qsort(entries, count, sizeof(sweep_entry_t), sweep_entry_compare);
+    for (i = 0; i != count; ++i)
+        for (j = i + 1; j != count && entries[j].x_begin <= entries[i].x_end; ++j)
+        {
+            int32_t rect[6];
+            int axis;
+            const medium_partition_t* a = vector_get_element(&medium->partitions, (size_t)entries[i].idx);
+            const medium_partition_t* b = vector_get_element(&medium->partitions, (size_t)entries[j].idx);
+            if ((axis = boxes_share_face(rect, a->box, b->box)) < 0)
+                continue;
+
+            /* Edges are symmetric, every interface is stored once per side */
+            if ((result = push_interface_edge(&edges, entries[i].idx, entries[j].idx, rect, axis,
+                                              a->box[axis+3] == rect[axis] ? 1 : -1)) != WS_OK)
+                goto bail;
+            if ((result = push_interface_edge(&edges, entries[j].idx, entries[i].idx, rect, axis,
+                                              b->box[axis+3] == rect[axis] ? 1 : -1)) != WS_OK)
+                goto bail;
+        }
+
+    /* Convert to CSR, each partition's interfaces are sorted by neighbour */
+    if (vector_count(&edges) != 0)
+        qsort(edges.data, vector_count(&edges), sizeof(interface_edge_t), interface_edge_compare);
+    if (vector_resize(&medium->adjacency_offsets, count + 1) == VECTOR_ERROR ||
+        (vector_count(&edges) != 0 && vector_resize(&medium->interfaces, vector_count(&edges)) == VECTOR_ERROR))
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+    offsets = (size_t*)medium->adjacency_offsets.data;
+    for (i = 0, j = 0; i != count; ++i)
+    {
+        offsets[i] = j;
+        for (; j != vector_count(&edges); ++j)
+        {
+            const interface_edge_t* edge = vector_get_element(&edges, j);
+            if (edge->owner != (int32_t)i)
+                break;
+            memcpy(vector_get_element(&medium->interfaces, j), &edge->interface, sizeof(medium_interface_t));
+        }
+    }
+    offsets[count] = j;
+
+    ws_log_info(&g_ws_log, "Found %d partition interfaces", (int)(vector_count(&medium->interfaces) / 2));
+
+    bail : vector_clear_free(&edges);
+    FREE(entries);
+    if (result != WS_OK)
+    {
+        vector_clear_free(&medium->adjacency_offsets);
+        vector_clear_free(&medium->interfaces);
+    }
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+const medium_interface_t*
+medium_partition_interfaces(const medium_t* medium, size_t partition_idx, size_t* count)
+{
+    const size_t* offsets = (const size_t*)medium->adjacency_offsets.data;
+    if (vector_count(&medium->adjacency_offsets) == 0)
+    {
+        *count = 0;
+        return NULL;
+    }
+    *count = offsets[partition_idx + 1] - offsets[partition_idx];
+    return (const medium_interface_t*)medium->interfaces.data + offsets[partition_idx];
+}
+
 /* ------------------------------------------------------------------------- */
 static int
 integrity_checks_out(const medium_t* medium, const medium_t* mediumdef)
 {
-    aabb_t cell;
+    int32_t x, y, z;
+    size_t covered_cells = 0;
     int integrity = 1;
     (void)mediumdef;
     ws_log_info(&g_ws_log, "Integrity check...");
 
-    iterate_cells_begin(cell.xyzxyz, medium->boundary.xyzxyz, medium->grid_size.xyz);
-    do
+    /* Every cell must be covered by a partition or be excluded */
+    for (x = 0; x != medium->grid_dims[0]; ++x)
+        for (y = 0; y != medium->grid_dims[1]; ++y)
+            for (z = 0; z != medium->grid_dims[2]; ++z)
+                if (bitset_test(&medium->occupied, CELL_INDEX(medium, x, y, z)) == 0)
+                {
+                    integrity = 0;
+                    ws_log_info(&g_ws_log, "Integrity failure, missing partition at cell (%d,%d,%d)", x, y, z);
+                }
+
+    /*
+     * Partitions must not overlap. If they cover exactly as many cells as are
+     * marked in the occupancy bitset, then no cell is covered twice.
+     */
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        const int32_t* box = partition->box;
+        covered_cells += (size_t)(box[3] - box[0]) * (size_t)(box[4] - box[1]) * (size_t)(box[5] - box[2]);
+    VECTOR_END_EACH
+    if (covered_cells + medium->excluded_cell_count != (size_t)medium->grid_dims[0] * (size_t)medium->grid_dims[1] * (size_t)medium->grid_dims[2])
     {
-        if (medium_partition_already_occupied(medium, cell.xyzxyz))
-        {
-            integrity = 0;
-            ws_log_info(&g_ws_log, "Integrity failure, missing partition at (%f,%f,%f,%f,%f,%f)", AABB_AX(cell), AABB_AY(cell), AABB_AZ(cell), AABB_BX(cell), AABB_BY(cell), AABB_BZ(cell));
-        }
-    } while(iterate_cells_next(cell.xyzxyz, medium->boundary.xyzxyz));
+        integrity = 0;
+        ws_log_info(&g_ws_log, "Integrity failure, partitions cover %d cells in total and %d cells are excluded, but the grid has %d cells",
+                    (int)covered_cells, (int)medium->excluded_cell_count, medium->grid_dims[0] * medium->grid_dims[1] * medium->grid_dims[2]);
+    }
 
     if (integrity)
         ws_log_info(&g_ws_log, "Integrity check successful");
@@ -478,7 +1053,8 @@ medium_build_from_mesh(medium_t* medium,
                        const mesh_t* mesh,
                        const wsreal_t grid_size[3])
 {
-    octree_t octree;
+    grid_t grid;
+    int thread_count;
     wsret result;
 
     /* Clear partitions from last time */
@@ -497,12 +1073,44 @@ medium_build_from_mesh(medium_t* medium,
         medium->boundary = mediumdef->boundary;
     }
 
-    /* Need an octree */
-    octree_construct(&octree);
-    if ((result = octree_build_from_mesh(&octree, mesh, 2)) != WS_OK)
+    /* Every cell of the boundary is classified exactly once */
+    grid_construct(&grid);
+    if ((result = grid_allocate(&grid, medium->boundary.xyzxyz, medium->grid_size.xyz)) != WS_OK)
         goto bail;
 
-    if ((result = medium->decompose(medium, &octree, mediumdef)) != WS_OK)
+    /* Set up occupancy tracking, partitions mark the cells they cover */
+    memcpy(medium->grid_dims, grid.dims, sizeof(grid.dims));
+    if ((result = bitset_resize(&medium->occupied, grid_cell_count(&grid))) != WS_OK)
+        goto bail;
+
+    /*
+     * Each thread classifies and decomposes its own brick of X layers. There
+     * is no point in having more bricks than layers.
+     */
+    thread_count = medium->thread_count > 0 ? medium->thread_count : thread_hardware_concurrency();
+    if (thread_count > grid.dims[0])
+        thread_count = grid.dims[0];
+    if (thread_count > 1)
+    {
+        if ((result = decompose_in_bricks(medium, &grid, mesh, mediumdef, thread_count)) != WS_OK)
+            goto bail;
+    }
+    else
+    {
+        if ((result = grid_classify_cells(&grid, mesh, 0, grid.dims[0])) != WS_OK)
+            goto bail;
+        ws_log_info(&g_ws_log, "Classified %d x %d x %d grid cells", grid.dims[0], grid.dims[1], grid.dims[2]);
+        if ((result = grid_exclude_cells(&grid, mesh, medium->keep_exterior_air)) != WS_OK)
+            goto bail;
+        mark_excluded_cells_occupied(medium, &grid);
+        if ((result = medium->decompose(medium, &grid, mediumdef)) != WS_OK)
+            goto bail;
+    }
+
+    /* Partitions refer to the grid's materials, which the medium outlives */
+    if ((result = material_table_merge(&medium->materials, &grid.materials, NULL)) != WS_OK)
+        goto bail;
+    if ((result = medium_build_adjacency(medium)) != WS_OK)
         goto bail;
 
 #ifdef DEBUG
@@ -511,6 +1119,6 @@ medium_build_from_mesh(medium_t* medium,
 
     ws_log_info(&g_ws_log, "Decomposed mesh into %d partitions", (int)vector_count(&medium->partitions));
 
-    bail : octree_destruct(&octree);
+    bail : grid_destruct(&grid);
     return result;
 }
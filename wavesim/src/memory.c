@@ -1,6 +1,7 @@
 #include "wavesim/memory.h"
 #include "wavesim/btree.h"
 #include "wavesim/backtrace.h"
+#include "wavesim/thread.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +15,11 @@ static uintptr_t g_allocations = 0;
 static uintptr_t g_deallocations = 0;
 static uintptr_t g_ignore_btree_malloc = 0;
 static btree_t report;
+static mutex_t* g_mutex = NULL; /* MALLOC() and FREE() may be called from any thread */
+
+/* The mutex only exists between memory_init() and memory_deinit() */
+#define LOCK()   if (g_mutex) mutex_lock(g_mutex)
+#define UNLOCK() if (g_mutex) mutex_unlock(g_mutex)
 
 typedef struct report_info_t
 {
@@ -32,6 +38,9 @@ memory_init(void)
     g_allocations = 0;
     g_deallocations = 0;
 
+    if ((g_mutex = mutex_create()) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
     /*
      * Init bst vector of report objects and force it to allocate by adding
      * and removing one item. This fixes a bug where the number of memory leaks
@@ -48,8 +57,8 @@ memory_init(void)
 }
 
 /* ------------------------------------------------------------------------- */
-void*
-malloc_wrapper(size_t size)
+static void*
+tracked_malloc(size_t size)
 {
     void* p = NULL;
     report_info_t* info = NULL;
@@ -146,8 +155,19 @@ malloc_wrapper(size_t size)
 }
 
 /* ------------------------------------------------------------------------- */
-void
-free_wrapper(void* ptr)
+void*
+malloc_wrapper(size_t size)
+{
+    void* p;
+    LOCK();
+        p = tracked_malloc(size);
+    UNLOCK();
+    return p;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+tracked_free(void* ptr)
 {
     /* find matching allocation and remove from btree */
     if (!g_ignore_btree_malloc)
@@ -196,6 +216,15 @@ free_wrapper(void* ptr)
         fprintf(stderr, "Warning: free(NULL)\n");
 }
 
+/* ------------------------------------------------------------------------- */
+void
+free_wrapper(void* ptr)
+{
+    LOCK();
+        tracked_free(ptr);
+    UNLOCK();
+}
+
 /* ------------------------------------------------------------------------- */
 int
 memory_deinit(void)
@@ -244,6 +273,9 @@ memory_deinit(void)
     g_ignore_btree_malloc = 1;
     btree_clear_free(&report);
 
+    mutex_destroy(g_mutex);
+    g_mutex = NULL;
+
     return (int)(g_allocations - g_deallocations);
 }
 
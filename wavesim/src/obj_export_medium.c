@@ -15,11 +15,13 @@ obj_export_medium(const char* filename, const medium_t* medium)
         return result;
 
     VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
-        if ((result = obj_write_aabb_vertices(&exporter, partition->aabb.xyzxyz)) != WS_OK)
+        aabb_t bb = medium_partition_aabb(medium, partition);
+        if ((result = obj_write_aabb_vertices(&exporter, bb.xyzxyz)) != WS_OK)
             goto bail;
     VECTOR_END_EACH
     VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
-        if ((result = obj_write_aabb_indices(&exporter, partition->aabb.xyzxyz)) != WS_OK)
+        aabb_t bb = medium_partition_aabb(medium, partition);
+        if ((result = obj_write_aabb_indices(&exporter, bb.xyzxyz)) != WS_OK)
             goto bail;
     VECTOR_END_EACH
 
@@ -6,38 +6,46 @@
 
 /* ------------------------------------------------------------------------- */
 static wsret
-write_vertices(obj_exporter_t* exporter, const octree_node_t* node)
+write_vertices(obj_exporter_t* exporter, const octree_t* octree, uint32_t node_idx, const aabb_t* node_bb)
 {
+    const octree_node_t* node = octree_node(octree, node_idx);
     int i;
     wsret result;
 
-    if ((result = obj_write_aabb_vertices(exporter, node->aabb.xyzxyz)) != WS_OK)
+    if ((result = obj_write_aabb_vertices(exporter, node_bb->xyzxyz)) != WS_OK)
         return result;
 
     /* Recurse into children */
-    if (node->children != NULL)
+    if (octree_node_is_leaf(node) == 0)
         for (i = 0; i != 8; ++i)
-            if ((result = write_vertices(exporter, &node->children[i])) != WS_OK)
+        {
+            aabb_t child_bb = octree_child_aabb(node_bb, i);
+            if ((result = write_vertices(exporter, octree, node->first_child + (uint32_t)i, &child_bb)) != WS_OK)
                 return result;
+        }
 
     return WS_OK;
 }
 
 /* ------------------------------------------------------------------------- */
 static wsret
-write_indices(obj_exporter_t* exporter, const octree_node_t* node)
+write_indices(obj_exporter_t* exporter, const octree_t* octree, uint32_t node_idx, const aabb_t* node_bb)
 {
+    const octree_node_t* node = octree_node(octree, node_idx);
     int i;
     wsret result;
 
-    if ((result = obj_write_aabb_indices(exporter, node->aabb.xyzxyz)) != WS_OK)
+    if ((result = obj_write_aabb_indices(exporter, node_bb->xyzxyz)) != WS_OK)
         return result;
 
     /* Recurse into children */
-    if (node->children != NULL)
+    if (octree_node_is_leaf(node) == 0)
         for (i = 0; i != 8; ++i)
-            if ((result = write_indices(exporter, &node->children[i])) != WS_OK)
+        {
+            aabb_t child_bb = octree_child_aabb(node_bb, i);
+            if ((result = write_indices(exporter, octree, node->first_child + (uint32_t)i, &child_bb)) != WS_OK)
                 return result;
+        }
 
     return WS_OK;
 }
@@ -52,9 +60,11 @@ obj_export_octree(const char* filename, const octree_t* octree)
     if ((result = obj_exporter_open(&exporter, filename)) != WS_OK)
         return result;
 
-    if ((result = write_vertices(&exporter, &octree->root)) != WS_OK)
+    if (vector_count(&octree->nodes) == 0)
         goto bail;
-    if ((result = write_indices(&exporter, &octree->root)) != WS_OK)
+    if ((result = write_vertices(&exporter, octree, 0, &octree->aabb)) != WS_OK)
+        goto bail;
+    if ((result = write_indices(&exporter, octree, 0, &octree->aabb)) != WS_OK)
         goto bail;
 
     bail: obj_exporter_close(&exporter);
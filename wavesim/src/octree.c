@@ -1,12 +1,12 @@
-#include "wavesim/btree.h"
-#include "wavesim/hash.h"
 #include "wavesim/intersections.h"
 #include "wavesim/log.h"
 #include "wavesim/memory.h"
 #include "wavesim/mesh.h"
 #include "wavesim/octree.h"
+#include "wavesim/thread.h"
 #include "string.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <assert.h>
 
@@ -38,11 +38,15 @@ void
 octree_construct(octree_t* octree)
 {
     octree->mesh = NULL;
-    octree->root.parent = NULL;
-    octree->root.children = NULL;
-    octree->root.index_buffer.data = NULL;
-    octree->root.index_buffer.count = 0;
-    octree->root.aabb = aabb_reset();
+    octree->aabb = aabb_reset();
+    vector_construct(&octree->nodes, sizeof(octree_node_t));
+    vector_construct(&octree->face_ids, sizeof(wsib_t));
+    octree->face_marks = NULL;
+    octree->query_epoch = 0;
+    octree->looseness = 0;
+    memset(&octree->counters, 0, sizeof(octree->counters));
+    octree->thread_count = 1;
+    octree->parallel_depth = 2;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -62,87 +66,110 @@ octree_destroy(octree_t* octree)
 
 /* ------------------------------------------------------------------------- */
 void
-node_destroy_children(octree_node_t* node)
+octree_clear(octree_t* octree)
 {
-    /* The root node doesn't own the index buffer like all of the other nodes */
-    if (node->parent != NULL)
-        vector_clear_free(&node->index_buffer);
+    vector_clear_free(&octree->nodes);
+    vector_clear_free(&octree->face_ids);
+    if (octree->face_marks != NULL)
+        FREE(octree->face_marks);
+    octree->face_marks = NULL;
+    octree->query_epoch = 0;
+    octree->looseness = 0;
+    memset(&octree->counters, 0, sizeof(octree->counters));
 
-    if (node->children != NULL)
-    {
-        int i;
-        for (i = 0; i != 8; ++i)
-            node_destroy_children(&node->children[i]);
-        FREE(node->children);
-        node->children = NULL;
-    }
+    /* release reference to mesh object */
+    octree->mesh = NULL;
+    octree->aabb = aabb_reset();
 }
 
 /* ------------------------------------------------------------------------- */
-wsret
-node_create_children(octree_node_t** children, octree_node_t* parent, const mesh_t* mesh)
+static void
+collect_node_stats(const octree_t* octree, uint32_t node_idx, uint32_t depth, octree_stats_t* stats)
 {
-    int i;
-    aabb_t bb_parent;
-    vec3_t bb_dims;
+    const octree_node_t* node = octree_node(octree, node_idx);
+    uint32_t i;
 
-    *children = MALLOC(sizeof(octree_node_t) * 8);
-    if (children == NULL)
-        WSRET(WS_ERR_OUT_OF_MEMORY);
+    stats->node_count++;
+    stats->face_references += node->face_count;
+    if (depth + 1 > stats->depth)
+        stats->depth = depth + 1;
+    stats->nodes_per_depth[depth < OCTREE_STATS_DEPTHS ? depth : OCTREE_STATS_DEPTHS - 1]++;
 
-    /* Initialize children fields */
-    for (i = 0; i != 8; ++i)
+    if (octree_node_is_leaf(node))
     {
-        (*children)[i].children = NULL;
-        (*children)[i].parent = parent;
-        vector_construct(&(*children)[i].index_buffer, mesh->ib_size);
+        /* Bucket 0 counts empty leaves, bucket b counts leaves with [2^(b-1), 2^b) faces */
+        uint32_t bucket = 0;
+        while (bucket != OCTREE_STATS_FACE_BUCKETS - 1 && (node->face_count >> bucket) != 0)
+            bucket++;
+        stats->leaf_count++;
+        stats->leaves_per_face_count[bucket]++;
+        if (node->face_count > stats->max_faces_per_leaf)
+            stats->max_faces_per_leaf = node->face_count;
+        return;
     }
 
-    /* Calculate child bounding boxes */
-    bb_parent = (parent == NULL ? mesh->aabb : parent->aabb);
-    bb_dims = AABB_DIMS(bb_parent);
     for (i = 0; i != 8; ++i)
-    {
-        AABB_AX((*children)[i].aabb) = AABB_AX(bb_parent) + (CX(i) + 0) * bb_dims.v.x * 0.5;
-        AABB_BX((*children)[i].aabb) = AABB_AX(bb_parent) + (CX(i) + 1) * bb_dims.v.x * 0.5;
-        AABB_AY((*children)[i].aabb) = AABB_AY(bb_parent) + (CY(i) + 0) * bb_dims.v.y * 0.5;
-        AABB_BY((*children)[i].aabb) = AABB_AY(bb_parent) + (CY(i) + 1) * bb_dims.v.y * 0.5;
-        AABB_AZ((*children)[i].aabb) = AABB_AZ(bb_parent) + (CZ(i) + 0) * bb_dims.v.z * 0.5;
-        AABB_BZ((*children)[i].aabb) = AABB_AZ(bb_parent) + (CZ(i) + 1) * bb_dims.v.z * 0.5;
-    }
-
-    return WS_OK;
+        collect_node_stats(octree, node->first_child + i, depth + 1, stats);
 }
 
 /* ------------------------------------------------------------------------- */
 void
-octree_clear(octree_t* octree)
+octree_stats(const octree_t* octree, octree_stats_t* stats)
 {
+    memset(stats, 0, sizeof *stats);
 
-    /* destroy all children and reset the root node */
-    if (octree->root.children != NULL)
-    {
-        int i;
-        for (i = 0; i != 8; ++i)
-            node_destroy_children(&octree->root.children[i]);
-        FREE(octree->root.children);
-    }
+    stats->memory_bytes = sizeof(octree_t) +
+        vector_memory_consumption(&octree->nodes) +
+        vector_memory_consumption(&octree->face_ids);
+    if (octree->face_marks != NULL)
+        stats->memory_bytes += sizeof(uint32_t) * mesh_face_count(octree->mesh);
+    stats->counters = octree->counters;
 
-    /* release reference to mesh object */
-    octree->mesh = NULL;
-    octree->root.index_buffer.data = NULL;
-    octree->root.index_buffer.count = 0;
+    if (vector_count(&octree->nodes) == 0)
+        return;
+
+    collect_node_stats(octree, 0, 0, stats);
+    stats->mesh_face_count = mesh_face_count(octree->mesh);
+    if (stats->mesh_face_count != 0)
+        stats->duplication = (wsreal_t)stats->face_references / (wsreal_t)stats->mesh_face_count;
 }
 
 /* ------------------------------------------------------------------------- */
-wsret
-octree_subdivide(octree_t* octree, octree_node_t* node)
+void
+octree_reset_query_counters(octree_t* octree)
 {
-    /* Subdivide is only valid for leaf nodes */
-    if (node->children != NULL)
-        return WS_ERR_SUBDIVIDED_NON_LEAF_NODE;
+    memset(&octree->counters, 0, sizeof(octree->counters));
+}
+
+/* ------------------------------------------------------------------------- */
+aabb_t
+octree_child_aabb(const aabb_t* parent, int child_idx)
+{
+    aabb_t child;
+    aabb_t bb_parent = *parent;
+    vec3_t bb_dims = AABB_DIMS(bb_parent);
+    AABB_AX(child) = AABB_AX(bb_parent) + (CX(child_idx) + 0) * bb_dims.v.x * 0.5;
+    AABB_BX(child) = AABB_AX(bb_parent) + (CX(child_idx) + 1) * bb_dims.v.x * 0.5;
+    AABB_AY(child) = AABB_AY(bb_parent) + (CY(child_idx) + 0) * bb_dims.v.y * 0.5;
+    AABB_BY(child) = AABB_AY(bb_parent) + (CY(child_idx) + 1) * bb_dims.v.y * 0.5;
+    AABB_AZ(child) = AABB_AZ(bb_parent) + (CZ(child_idx) + 0) * bb_dims.v.z * 0.5;
+    AABB_BZ(child) = AABB_AZ(bb_parent) + (CZ(child_idx) + 1) * bb_dims.v.z * 0.5;
+    return child;
+}
 
-    return node_create_children(&node->children, node, octree->mesh);
+/* ------------------------------------------------------------------------- */
+aabb_t
+octree_loose_aabb(const aabb_t* node_bb, wsreal_t looseness)
+{
+    aabb_t loose;
+    int a;
+    for (a = 0; a != 3; ++a)
+    {
+        wsreal_t grow = (node_bb->xyzxyz[a+3] - node_bb->xyzxyz[a]) * looseness * (wsreal_t)0.5;
+        loose.xyzxyz[a] = node_bb->xyzxyz[a] - grow;
+        loose.xyzxyz[a+3] = node_bb->xyzxyz[a+3] + grow;
+    }
+    return loose;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -174,277 +201,1063 @@ determine_smallest_subdivision(wsreal_t smallest_subdivision[3], const mesh_t* m
 #endif
 
 /* ------------------------------------------------------------------------- */
-static wsret WS_WARN_UNUSED
-determine_child_index_buffers(const octree_t* octree, octree_node_t* node)
+static aabb_t
+face_aabb(const mesh_t* mesh, wsib_t face_id)
 {
-    wsib_t i;
-    int c;
-    for (i = 0; i != (wsib_t)vector_count(&node->index_buffer); i += 3)
-    {
-        /*
-         * Here we use the index buffer of the *node* (instead of the mesh) to
-         * look up 3 vertices in the mesh to form a face. This is dangerous and
-         * only works if the octree node's index buffer was initialized with the
-         * same datatype as the mesh's index buffer (which, if nothing broke,
-         * should always be the case).
-         */
-        wsib_t indices[3];
-        vec3_t face[3];
-        indices[0] = mesh_get_index_from_buffer(node->index_buffer.data, i + 0, octree->mesh->ib_type);
-        indices[1] = mesh_get_index_from_buffer(node->index_buffer.data, i + 1, octree->mesh->ib_type);
-        indices[2] = mesh_get_index_from_buffer(node->index_buffer.data, i + 2, octree->mesh->ib_type);
-        face[0] = mesh_get_vertex_position_from_buffer(octree->mesh->vb, indices[0], octree->mesh->vb_type);
-        face[1] = mesh_get_vertex_position_from_buffer(octree->mesh->vb, indices[1], octree->mesh->vb_type);
-        face[2] = mesh_get_vertex_position_from_buffer(octree->mesh->vb, indices[2], octree->mesh->vb_type);
-
-        /*
-         * Test the bounding box of the face we extracted with each child node
-         * bounding box. If it intersects, then add the face to the child node.
-         */
-        aabb_t face_bb = aabb_from_3_points(face[0].xyz, face[1].xyz, face[2].xyz);
+    wsib_t indices[3];
+    vec3_t face[3];
+    int i;
+    for (i = 0; i != 3; ++i)
+    {
+        indices[i] = mesh_get_index_from_buffer(mesh->ib, face_id * 3 + (wsib_t)i, mesh->ib_type);
+        face[i] = mesh_get_vertex_position_from_buffer(mesh->vb, indices[i], mesh->vb_type);
+    }
+    return aabb_from_3_points(face[0].xyz, face[1].xyz, face[2].xyz);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Writes the (loose) bounds of all 8 children of a node in SoA layout, so
+ * they can be culled with a single intersect_aabb8_aabb_mask(). The bounds
+ * are computed exactly like octree_child_aabb() and octree_loose_aabb() do.
+ * If tight isn't NULL, it receives the bounds without looseness, which saves
+ * calling octree_child_aabb() for every child that passes the culling.
+ */
+static void
+children_aabb8(aabb8_t* children, aabb8_t* tight, const aabb_t* node_bb, wsreal_t looseness)
+{
+    int a, c;
+    for (a = 0; a != 3; ++a)
+    {
+        wsreal_t lo = node_bb->xyzxyz[a];
+        wsreal_t dim = node_bb->xyzxyz[a+3] - lo;
+        wsreal_t split[3];
+        wsreal_t half_min[2], half_max[2];
+        int h;
+
+        split[0] = lo + 0 * dim * 0.5;
+        split[1] = lo + 1 * dim * 0.5;
+        split[2] = lo + 2 * dim * 0.5;
+        for (h = 0; h != 2; ++h)
+        {
+            wsreal_t grow = (split[h+1] - split[h]) * looseness * (wsreal_t)0.5;
+            half_min[h] = split[h] - grow;
+            half_max[h] = split[h+1] + grow;
+        }
+
         for (c = 0; c != 8; ++c)
         {
-            octree_node_t* child = &node->children[c];
-            if (intersect_aabb_aabb_test(child->aabb.xyzxyz, face_bb.xyzxyz))
+            h = (a == 0 ? CX(c) : a == 1 ? CY(c) : CZ(c));
+            children->min[a][c] = half_min[h];
+            children->max[a][c] = half_max[h];
+            if (tight != NULL)
             {
-                if (vector_push(&child->index_buffer, &indices[0]) == VECTOR_ERROR) WSRET(WS_ERR_OUT_OF_MEMORY);
-                if (vector_push(&child->index_buffer, &indices[1]) == VECTOR_ERROR) WSRET(WS_ERR_OUT_OF_MEMORY);
-                if (vector_push(&child->index_buffer, &indices[2]) == VECTOR_ERROR) WSRET(WS_ERR_OUT_OF_MEMORY);
+                tight->min[a][c] = split[h];
+                tight->max[a][c] = split[h+1];
             }
         }
     }
+}
+
+/* ------------------------------------------------------------------------- */
+static aabb_t
+aabb8_get(const aabb8_t* boxes, int i)
+{
+    aabb_t bb;
+    int a;
+    for (a = 0; a != 3; ++a)
+    {
+        bb.xyzxyz[a] = boxes->min[a][i];
+        bb.xyzxyz[a+3] = boxes->max[a][i];
+    }
+    return bb;
+}
+
+/*
+ * The tree is built breadth first, one level at a time. Every node of the
+ * level being processed references a range of face IDs in a scratch array.
+ * Subdividing a node writes the face lists of its 8 children into the scratch
+ * array of the next level. Only once a node turns out to be a leaf are its
+ * faces copied into the face ID array.
+ */
+typedef struct pending_node_t
+{
+    uint32_t node;
+    aabb_t   aabb;
+    size_t   face_begin;
+    size_t   face_end;
+} pending_node_t;
+
+typedef struct build_level_t
+{
+    vector_t pending; /* pending_node_t */
+    vector_t faces;   /* wsib_t */
+} build_level_t;
+
+/*
+ * A subtree is built into its own node and face ID arrays, so subtrees can be
+ * built concurrently without sharing any memory. Afterwards, it is grafted
+ * onto the node of the octree it was split off from.
+ */
+typedef struct subtree_t
+{
+    const mesh_t* mesh;
+    vector_t      nodes;     /* octree_node_t, the subtree's root is at index 0 */
+    vector_t      face_ids;  /* wsib_t */
+    vector_t      faces;     /* wsib_t, faces overlapping the subtree's root */
+    vector_t      child_masks; /* uint8_t, scratch space for subdividing */
+    aabb_t        aabb;      /* Bounding box of the subtree's root */
+    const octree_build_params_t* params;
+    int           max_depth; /* Relative to the subtree's root */
+    uint32_t      node;      /* Node of the octree this subtree belongs to */
+    wsret         result;
+} subtree_t;
+
+/* ------------------------------------------------------------------------- */
+static void
+subtree_construct(subtree_t* tree, const mesh_t* mesh, const octree_build_params_t* params)
+{
+    tree->mesh = mesh;
+    tree->params = params;
+    vector_construct(&tree->nodes, sizeof(octree_node_t));
+    vector_construct(&tree->face_ids, sizeof(wsib_t));
+    vector_construct(&tree->faces, sizeof(wsib_t));
+    vector_construct(&tree->child_masks, sizeof(uint8_t));
+    tree->aabb = aabb_reset();
+    tree->max_depth = 0;
+    tree->node = 0;
+    tree->result = WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+subtree_destruct(subtree_t* tree)
+{
+    vector_clear_free(&tree->nodes);
+    vector_clear_free(&tree->face_ids);
+    vector_clear_free(&tree->faces);
+    vector_clear_free(&tree->child_masks);
+}
 
+/* ------------------------------------------------------------------------- */
+static wsret
+make_leaf(subtree_t* tree, uint32_t node_idx, const wsib_t* faces, size_t count)
+{
+    octree_node_t* node = vector_get_element(&tree->nodes, node_idx);
+    node->first_child = 0;
+    node->face_offset = (uint32_t)vector_count(&tree->face_ids);
+    node->face_count = (uint32_t)count;
+    for (; count--; ++faces)
+        if (vector_push(&tree->face_ids, (void*)faces) == VECTOR_ERROR)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
     return WS_OK;
 }
-static wsret WS_WARN_UNUSED
-octree_build_from_mesh_recursive(octree_t* octree, octree_node_t* node, int max_depth)
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Appends the 8 children of a node and queues them for the next level. Their
+ * face lists are the ranges [child_begin[c], child_begin[c+1]) in the next
+ * level's scratch array.
+ */
+static wsret
+allocate_children(subtree_t* tree, build_level_t* next, const pending_node_t* pending,
+                  const size_t child_begin[9])
 {
-    wsret result;
-    unsigned int i;
+    uint32_t first_child = (uint32_t)vector_count(&tree->nodes);
+    int c;
 
-    /* Stop subdividing when we reach one face */
-    if (vector_count(&node->index_buffer) <= 3)
-        return WS_OK;
+    /*
+     * Siblings are allocated together, in Morton order. Nodes are emplaced one
+     * by one because vector_resize() reallocates to the exact size every time
+     * the vector grows, which would copy the whole array for every subdivided
+     * node.
+     */
+    for (c = 0; c != 8; ++c)
+    {
+        octree_node_t* node = vector_emplace(&tree->nodes);
+        pending_node_t* child = vector_emplace(&next->pending);
+        if (node == NULL || child == NULL)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        node->first_child = 0;
+        node->face_offset = 0;
+        node->face_count = 0;
+        child->node = first_child + (uint32_t)c;
+        child->aabb = octree_child_aabb(&pending->aabb, c);
+        child->face_begin = child_begin[c];
+        child->face_end = child_begin[c+1];
+    }
+    ((octree_node_t*)vector_get_element(&tree->nodes, pending->node))->first_child = first_child;
 
-    /* Abort if max depth has been reached */
-    if (max_depth == 0)
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+subdivide_pending_node(subtree_t* tree, build_level_t* next, const pending_node_t* pending,
+                       const wsib_t* faces, int* is_leaf)
+{
+    size_t face_count = pending->face_end - pending->face_begin;
+    size_t level_faces = vector_count(&next->faces);
+    size_t child_begin[9];
+    aabb8_t children;
+    uint8_t* masks;
+    size_t i;
+    int c;
+
+    /*
+     * Test every face against all 8 children at once. Boxes that only touch
+     * count as overlapping, faces lying flat on a node boundary (e.g. every
+     * face of a box shaped mesh, which lies on the root's boundary) would be
+     * dropped otherwise.
+     */
+    children_aabb8(&children, NULL, &pending->aabb, 0);
+    if (vector_count(&tree->child_masks) < face_count)
+        if (vector_resize(&tree->child_masks, face_count) == VECTOR_ERROR)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+    masks = (uint8_t*)tree->child_masks.data;
+    for (i = 0; i != face_count; ++i)
+    {
+        aabb_t face_bb = face_aabb(tree->mesh, faces[i]);
+        masks[i] = (uint8_t)intersect_aabb8_aabb_mask(&children, face_bb.xyzxyz, 1);
+    }
+
+    /* Fill the child face lists */
+    for (c = 0; c != 8; ++c)
+    {
+        child_begin[c] = vector_count(&next->faces);
+        for (i = 0; i != face_count; ++i)
+            if (masks[i] & (1u << c))
+                if (vector_push(&next->faces, (void*)&faces[i]) == VECTOR_ERROR)
+                    WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+    child_begin[8] = vector_count(&next->faces);
+
+    /*
+     * If it turns out that all 8 children have the exact same face lists,
+     * then there is no point in subdividing.
+     */
+    *is_leaf = 1;
+    for (c = 0; c != 8; ++c)
+        if (child_begin[c+1] - child_begin[c] != face_count)
+            *is_leaf = 0;
+
+    /*
+     * Every octant has 1/4 of the parent's surface area, so a query reaching
+     * the parent is expected to test 1/4 of the faces of each child.
+     */
+    if (*is_leaf == 0 && tree->params->cost_heuristic)
+    {
+        wsreal_t split_cost = tree->params->traversal_cost +
+            (wsreal_t)(child_begin[8] - child_begin[0]) * (wsreal_t)0.25;
+        if (split_cost >= (wsreal_t)face_count)
+            *is_leaf = 1;
+    }
+    if (*is_leaf)
+    {
+        vector_resize(&next->faces, level_faces);
         return WS_OK;
+    }
+
+    return allocate_children(tree, next, pending, child_begin);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Returns the child whose loose bounds fully contain the face, or -1 if the
+ * face is too large for any child. Only the child containing the center of
+ * the face's bounding box can qualify, because the loose bounds of a child
+ * extend at most half a child beyond its own bounds.
+ */
+static int
+loose_child_of(const aabb_t* node_bb, const aabb_t* face_bb, wsreal_t looseness)
+{
+    aabb_t loose;
+    int c = 0;
+    int a;
+    for (a = 0; a != 3; ++a)
+    {
+        wsreal_t center = (face_bb->xyzxyz[a] + face_bb->xyzxyz[a+3]) * (wsreal_t)0.5;
+        wsreal_t split = (node_bb->xyzxyz[a] + node_bb->xyzxyz[a+3]) * (wsreal_t)0.5;
+        if (center >= split)
+            c += (a == 0 ? 4 : a == 1 ? 2 : 1);
+    }
+
+    loose = octree_child_aabb(node_bb, c);
+    loose = octree_loose_aabb(&loose, looseness);
+    for (a = 0; a != 3; ++a)
+        if (face_bb->xyzxyz[a] < loose.xyzxyz[a] || face_bb->xyzxyz[a+3] > loose.xyzxyz[a+3])
+            return -1;
+    return c;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Loose counterpart of subdivide_pending_node(). Every face moves into the
+ * one child whose loose bounds contain it. Faces that don't fit into any
+ * child stay with the node, so nothing is ever duplicated.
+ */
+static wsret
+subdivide_pending_node_loose(subtree_t* tree, build_level_t* next, const pending_node_t* pending,
+                             const wsib_t* faces, int* is_leaf)
+{
+    wsreal_t looseness = tree->params->looseness;
+    size_t face_count = pending->face_end - pending->face_begin;
+    size_t level_faces = vector_count(&next->faces);
+    size_t child_begin[9];
+    size_t kept;
+    size_t i;
+    int c;
 
-    /* Subdivide and do AABB intersection tests to fill child index buffers */
-    if ((result = octree_subdivide(octree, node)) != WS_OK)
-        return result;
-    if ((result = determine_child_index_buffers(octree, node)) != WS_OK)
-        return result;
+    for (c = 0; c != 8; ++c)
+    {
+        child_begin[c] = vector_count(&next->faces);
+        for (i = 0; i != face_count; ++i)
+        {
+            aabb_t face_bb = face_aabb(tree->mesh, faces[i]);
+            if (loose_child_of(&pending->aabb, &face_bb, looseness) == c)
+                if (vector_push(&next->faces, (void*)&faces[i]) == VECTOR_ERROR)
+                    WSRET(WS_ERR_OUT_OF_MEMORY);
+        }
+    }
+    child_begin[8] = vector_count(&next->faces);
+    kept = face_count - (child_begin[8] - child_begin[0]);
 
     /*
-     * If it turns out that all 8 children have the exact same index buffers,
-     * then there is no point in doing further subdivisions.
+     * Nothing to gain if no face fits into a child. Otherwise weigh the faces
+     * staying with the node plus the faces reachable through the loose
+     * children, each of which has (1 + looseness)^2 / 4 of the node's
+     * surface area.
      */
-    for (i = 0; i != 8; ++i)
-        if (vector_count(&node->index_buffer) != vector_count(&node->children[i].index_buffer))
+    *is_leaf = (kept == face_count);
+    if (*is_leaf == 0 && tree->params->cost_heuristic)
+    {
+        wsreal_t area = (1 + looseness) * (1 + looseness) * (wsreal_t)0.25;
+        wsreal_t split_cost = tree->params->traversal_cost + (wsreal_t)kept +
+            (wsreal_t)(child_begin[8] - child_begin[0]) * area;
+        if (split_cost >= (wsreal_t)face_count)
+            *is_leaf = 1;
+    }
+    if (*is_leaf)
+    {
+        vector_resize(&next->faces, level_faces);
+        return WS_OK;
+    }
+
+    /* Faces that don't fit into any child are stored with the node itself */
+    {
+        octree_node_t* node = vector_get_element(&tree->nodes, pending->node);
+        node->face_offset = (uint32_t)vector_count(&tree->face_ids);
+        node->face_count = (uint32_t)kept;
+        for (i = 0; i != face_count; ++i)
         {
-            for (i = 0; i != 8; ++i)
-                if ((result = octree_build_from_mesh_recursive(octree, &node->children[i], max_depth - 1)) != WS_OK)
-                    return result;
-            return WS_OK;
+            aabb_t face_bb = face_aabb(tree->mesh, faces[i]);
+            if (loose_child_of(&pending->aabb, &face_bb, looseness) == -1)
+                if (vector_push(&tree->face_ids, (void*)&faces[i]) == VECTOR_ERROR)
+                    WSRET(WS_ERR_OUT_OF_MEMORY);
         }
-    /* If we end up here it means the 8 children have identical index buffers.
-     * Delete the children, they don't accomplish anything */
-    node_destroy_children(node);
+    }
+
+    return allocate_children(tree, next, pending, child_begin);
+}
+
+/* ------------------------------------------------------------------------- */
+static int
+children_are_large_enough(const subtree_t* tree, const aabb_t* node_bb)
+{
+    int a;
+    for (a = 0; a != 3; ++a)
+        if ((node_bb->xyzxyz[a+3] - node_bb->xyzxyz[a]) * (wsreal_t)0.5 >= tree->params->min_node_extent)
+            return 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Splits off a node that still needs subdividing as a separate subtree. The
+ * node stays an empty leaf until the subtree is grafted onto it.
+ */
+static wsret
+defer_pending_node(subtree_t* tree, vector_t* deferred, const pending_node_t* pending,
+                   const wsib_t* faces, int depth)
+{
+    size_t i;
+    subtree_t* sub = vector_emplace(deferred);
+    if (sub == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    subtree_construct(sub, tree->mesh, tree->params);
+    sub->aabb = pending->aabb;
+    sub->max_depth = tree->max_depth - depth;
+    sub->node = pending->node;
+    for (i = 0; i != pending->face_end - pending->face_begin; ++i)
+        if (vector_push(&sub->faces, (void*)&faces[i]) == VECTOR_ERROR)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+    return make_leaf(tree, pending->node, NULL, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Builds a tree from the faces in tree->faces. If deferred is not NULL, nodes
+ * at split_depth that still need subdividing are pushed into it as subtrees
+ * instead of being subdivided.
+ */
+static wsret
+build_subtree(subtree_t* tree, int split_depth, vector_t* deferred)
+{
+    build_level_t levels[2];
+    build_level_t* cur = &levels[0];
+    build_level_t* next = &levels[1];
+    octree_node_t* root;
+    pending_node_t* pending;
+    int depth;
+    wsret result = WS_OK;
+
+    if ((root = vector_emplace(&tree->nodes)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    root->first_child = 0;
+    root->face_offset = 0;
+    root->face_count = 0;
+
+    for (depth = 0; depth != 2; ++depth)
+    {
+        vector_construct(&levels[depth].pending, sizeof(pending_node_t));
+        vector_construct(&levels[depth].faces, sizeof(wsib_t));
+    }
+
+    /* The root starts out with all faces, which are moved into the scratch array */
+    cur->faces = tree->faces;
+    vector_construct(&tree->faces, sizeof(wsib_t));
+    if ((pending = vector_emplace(&cur->pending)) == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+    pending->node = 0;
+    pending->aabb = tree->aabb;
+    pending->face_begin = 0;
+    pending->face_end = vector_count(&cur->faces);
+
+    for (depth = 0; vector_count(&cur->pending) != 0; ++depth)
+    {
+        build_level_t* tmp;
+        vector_clear(&next->pending);
+        vector_clear(&next->faces);
+
+        VECTOR_FOR_EACH(&cur->pending, pending_node_t, node)
+            const wsib_t* faces = (const wsib_t*)cur->faces.data + node->face_begin;
+            size_t face_count = node->face_end - node->face_begin;
+            int is_leaf = 1;
+
+            /* Stop subdividing when the node is small enough */
+            if (face_count > tree->params->max_faces_per_leaf &&
+                depth != tree->max_depth &&
+                children_are_large_enough(tree, &node->aabb))
+            {
+                if (deferred != NULL && depth == split_depth)
+                {
+                    if ((result = defer_pending_node(tree, deferred, node, faces, depth)) != WS_OK)
+                        goto bail;
+                    continue;
+                }
+                if (tree->params->looseness > 0)
+                    result = subdivide_pending_node_loose(tree, next, node, faces, &is_leaf);
+                else
+                    result = subdivide_pending_node(tree, next, node, faces, &is_leaf);
+                if (result != WS_OK)
+                    goto bail;
+            }
+            if (is_leaf)
+                if ((result = make_leaf(tree, node->node, faces, face_count)) != WS_OK)
+                    goto bail;
+        VECTOR_END_EACH
+
+        tmp = cur; cur = next; next = tmp;
+    }
+
+    bail : for (depth = 0; depth != 2; ++depth)
+    {
+        vector_clear_free(&levels[depth].pending);
+        vector_clear_free(&levels[depth].faces);
+    }
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Appends the nodes and face IDs of a subtree to the tree and replaces the
+ * node the subtree was split off from with the subtree's root.
+ */
+static wsret
+graft_subtree(subtree_t* tree, const subtree_t* sub)
+{
+    uint32_t node_base = (uint32_t)vector_count(&tree->nodes) - 1;
+    uint32_t face_base = (uint32_t)vector_count(&tree->face_ids);
+    size_t i;
+
+    if (vector_count(&sub->face_ids) != 0 && vector_push_vector(&tree->face_ids, &sub->face_ids) == VECTOR_ERROR)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    if (vector_resize(&tree->nodes, node_base + vector_count(&sub->nodes)) == VECTOR_ERROR)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
+    /* Local node i > 0 ends up at node_base + i, the root replaces sub->node */
+    for (i = 0; i != vector_count(&sub->nodes); ++i)
+    {
+        octree_node_t node = *(octree_node_t*)vector_get_element(&sub->nodes, i);
+        node.face_offset += face_base;
+        if (octree_node_is_leaf(&node) == 0)
+            node.first_child += node_base;
+        memcpy(vector_get_element(&tree->nodes, i == 0 ? sub->node : node_base + (uint32_t)i),
+               &node, sizeof(octree_node_t));
+    }
 
     return WS_OK;
 }
+
+/* ------------------------------------------------------------------------- */
+typedef struct subtree_worker_t
+{
+    subtree_t* subtrees;
+    size_t     count;
+    size_t     first;
+    size_t     stride;
+} subtree_worker_t;
+
+static void
+build_subtrees(void* arg)
+{
+    subtree_worker_t* worker = arg;
+    size_t i;
+    for (i = worker->first; i < worker->count; i += worker->stride)
+        worker->subtrees[i].result = build_subtree(&worker->subtrees[i], -1, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Builds all subtrees on thread_count threads. Each thread builds every
+ * thread_count'th subtree, so no synchronization is needed besides joining
+ * the threads.
+ */
+static wsret
+build_subtrees_in_parallel(vector_t* subtrees, int thread_count)
+{
+    subtree_worker_t* workers;
+    thread_t** threads;
+    int t, started;
+    wsret result = WS_OK;
+
+    if ((size_t)thread_count > vector_count(subtrees))
+        thread_count = (int)vector_count(subtrees);
+    if (thread_count == 0)
+        return WS_OK;
+
+    workers = MALLOC(sizeof(subtree_worker_t) * (size_t)thread_count);
+    threads = MALLOC(sizeof(thread_t*) * (size_t)thread_count);
+    if (workers == NULL || threads == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+
+    for (started = 0; started != thread_count; ++started)
+    {
+        workers[started].subtrees = (subtree_t*)subtrees->data;
+        workers[started].count = vector_count(subtrees);
+        workers[started].first = (size_t)started;
+        workers[started].stride = (size_t)thread_count;
+        if ((result = thread_start(&threads[started], build_subtrees, &workers[started])) != WS_OK)
+            break;
+    }
+    for (t = 0; t != started; ++t)
+        thread_join(threads[t]);
+    if (result != WS_OK)
+        goto bail;
+
+    VECTOR_FOR_EACH(subtrees, subtree_t, sub)
+        if (sub->result != WS_OK)
+        {
+            result = sub->result;
+            goto bail;
+        }
+    VECTOR_END_EACH
+
+    bail : if (threads) FREE(threads);
+    if (workers) FREE(workers);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+octree_build_params_default(octree_build_params_t* params,
+                            const mesh_t* mesh,
+                            wsreal_t min_node_extent)
+{
+    size_t nodes = mesh_face_count(mesh) / 8;
+
+    params->max_faces_per_leaf = 8;
+    params->min_node_extent = min_node_extent;
+    params->cost_heuristic = 1;
+    params->traversal_cost = 1;
+    params->looseness = 0;
+
+    /* One level per factor of 4 in face count, plus a little slack */
+    params->max_depth = 2;
+    for (; nodes > 1 && params->max_depth < 16; nodes /= 4)
+        params->max_depth++;
+}
+
+/* ------------------------------------------------------------------------- */
 wsret
 octree_build_from_mesh(octree_t* octree, const mesh_t* mesh, int max_depth)
 {
+    octree_build_params_t params;
+    params.max_depth = max_depth;
+    params.max_faces_per_leaf = 1;
+    params.min_node_extent = 0;
+    params.cost_heuristic = 0;
+    params.traversal_cost = 0;
+    params.looseness = 0;
+    return octree_build_from_mesh_params(octree, mesh, &params);
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+octree_build_from_mesh_params(octree_t* octree,
+                              const mesh_t* mesh,
+                              const octree_build_params_t* params)
+{
+    subtree_t tree;
+    vector_t deferred;
+    wsib_t f;
+    int thread_count;
+    wsret result = WS_OK;
+
     /* Clear old octree if it exists */
     octree_clear(octree);
+    octree->mesh = mesh;
+    octree->aabb = mesh->aabb;
+    octree->looseness = params->looseness;
+
+    /* Handle empty meshes */
+    if (mesh_face_count(mesh) == 0)
+    {
+        octree_node_t* root = vector_emplace(&octree->nodes);
+        if (root == NULL)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        root->first_child = 0;
+        root->face_offset = 0;
+        root->face_count = 0;
+        return WS_OK;
+    }
+
+    subtree_construct(&tree, mesh, params);
+    vector_construct(&deferred, sizeof(subtree_t));
+    tree.aabb = mesh->aabb;
+    tree.max_depth = params->max_depth;
+
+    if ((octree->face_marks = MALLOC(sizeof(uint32_t) * mesh_face_count(mesh))) == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+    memset(octree->face_marks, 0, sizeof(uint32_t) * mesh_face_count(mesh));
+
+    /* The root starts out with every face of the mesh */
+    if (vector_resize(&tree.faces, mesh_face_count(mesh)) == VECTOR_ERROR)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto bail;
+    }
+    for (f = 0; f != mesh_face_count(mesh); ++f)
+        *(wsib_t*)vector_get_element(&tree.faces, f) = f;
 
     /*
-     * Create root
-     * WARNING: This is a pretty terrible hack; we manually set up the index
-     * buffer vector to point to the mesh's index buffer, instead of allocating
-     * and copying all of the indices. The root node's IB is identical to the
-     * mesh's IB and we save memory by avoiding a copy.
+     * With more than one thread, the levels above parallel_depth are built
+     * first. The nodes at parallel_depth that still need subdividing are
+     * then built as independent subtrees, each into memory of its own, and
+     * grafted onto the tree once all of them are done.
      */
-    octree->mesh = mesh;
-    octree->root.aabb = mesh->aabb;
-    octree->root.index_buffer.capacity = 0;
-    octree->root.index_buffer.count = mesh->ib_count;
-    octree->root.index_buffer.element_size = mesh->ib_size;
-    octree->root.index_buffer.data = mesh->ib;
+    thread_count = octree->thread_count > 0 ? octree->thread_count : thread_hardware_concurrency();
+    if (thread_count > 1)
+    {
+        if ((result = build_subtree(&tree, octree->parallel_depth, &deferred)) != WS_OK)
+            goto bail;
+        if ((result = build_subtrees_in_parallel(&deferred, thread_count)) != WS_OK)
+            goto bail;
+        VECTOR_FOR_EACH(&deferred, subtree_t, sub)
+            if ((result = graft_subtree(&tree, sub)) != WS_OK)
+                goto bail;
+        VECTOR_END_EACH
+    }
+    else
+    {
+        if ((result = build_subtree(&tree, -1, NULL)) != WS_OK)
+            goto bail;
+    }
 
-    /* Handle empty meshes */
-    if (mesh_face_count(octree->mesh) == 0)
-        return 0;
+    /* Hand the arrays over to the octree */
+    vector_clear_free(&octree->nodes);
+    vector_clear_free(&octree->face_ids);
+    octree->nodes = tree.nodes;
+    octree->face_ids = tree.face_ids;
+    vector_construct(&tree.nodes, sizeof(octree_node_t));
+    vector_construct(&tree.face_ids, sizeof(wsib_t));
 
-    if (octree_build_from_mesh_recursive(octree, &octree->root, max_depth) < 0)
-        return -1;
-    return 0;
+    bail : VECTOR_FOR_EACH(&deferred, subtree_t, sub)
+        subtree_destruct(sub);
+    VECTOR_END_EACH
+    vector_clear_free(&deferred);
+    subtree_destruct(&tree);
+    if (result != WS_OK)
+        octree_clear(octree);
+    return result;
 }
 
 /* ------------------------------------------------------------------------- */
+void
+octree_set_parallel_build(octree_t* octree, int thread_count, int parallel_depth)
+{
+    octree->thread_count = thread_count;
+    octree->parallel_depth = parallel_depth;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Starts a new query by advancing the epoch. Every face whose mark differs
+ * from the epoch hasn't been visited by this query yet, so the marks never
+ * need to be cleared, except for when the epoch wraps around.
+ */
+static uint32_t
+begin_query(octree_t* octree)
+{
+    if (++octree->query_epoch == 0)
+    {
+        memset(octree->face_marks, 0, sizeof(uint32_t) * mesh_face_count(octree->mesh));
+        octree->query_epoch = 1;
+    }
+    return octree->query_epoch;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Visits the faces of a node and then descends into the children that
+ * overlap the query. The caller has already checked that the node itself
+ * overlaps. Returns 0 if all faces were visited, otherwise whatever non-zero
+ * value the visitor returned to stop the query.
+ */
 static int
-octree_query_potential_faces_recursive(const octree_node_t* node, vector_t* result, const wsreal_t bb[6])
+visit_potential_faces(octree_t* octree, uint32_t node_idx, const aabb_t* node_bb,
+                      const wsreal_t bb[6], octree_face_visitor visitor, void* user_data)
 {
-    /* This node and all children are of no interest */
-    if (intersect_aabb_aabb_test(node->aabb.xyzxyz, bb) == 0)
-        return 1;
+    const octree_node_t* node = octree_node(octree, node_idx);
+    uint32_t i;
+    int stop;
+
+    octree->counters.nodes_visited++;
+    octree->counters.face_references += node->face_count;
 
     /*
-     * We want to keep drilling deeper until the node size is smaller or equal
-     * to the specified bounding box. Going any deeper is useless because all
-     * children beyond that point will intersect anyway, and going shallower is
-     * less efficient because we'd have to do more index buffer copies.
+     * Faces overlapping several leaves were already stamped with the current
+     * epoch by the first leaf that visited them. In a loose octree, inner
+     * nodes store faces too.
      */
-    if (node->children != NULL)
+    for (i = 0; i != node->face_count; ++i)
     {
-        vec3_t node_dims = AABB_DIMS(node->aabb);
-        if (node_dims.v.x > bb[3] - bb[0] ||
-            node_dims.v.y > bb[4] - bb[1] ||
-            node_dims.v.z > bb[5] - bb[2])
+        wsib_t face_id = *(wsib_t*)vector_get_element(&octree->face_ids, node->face_offset + i);
+        if (octree->face_marks[face_id] == octree->query_epoch)
         {
-            int i, node_counter = 0;
-            for (i = 0; i != 8; ++i)
-            {
-                int child_result = octree_query_potential_faces_recursive(&node->children[i], result, bb);
-                if (child_result == -1)
-                    return child_result;
-                node_counter += child_result;
-            }
-            return node_counter;
+            octree->counters.duplicates_skipped++;
+            continue;
         }
+        octree->face_marks[face_id] = octree->query_epoch;
+        if ((stop = visitor(user_data, face_id)) != 0)
+            return stop;
     }
 
-    /*
-     * We're at the bottom, add this node's indices to the result list and
-     * avoid duplicate faces. In the worst case, we have to do a linear search
-     * for indices 7 times (if the bounding box happens to intersect all 8
-     * neighbouring nodes).
-     *
-     * Note that because we don't know the type of data in the result vector
-     * or in the node vector, we have to do a direct memory comparison of
-     * 3 element chunks.
-     *
-     * TODO: Maybe profile this, depending on how complex the mesh is it might
-     * matter.
-     */
+    if (octree_node_is_leaf(node) == 0)
     {
-        size_t node_chunk_idx;
-        const vector_t* vn = &node->index_buffer;
-        size_t chunk_size = vn->element_size * 3;
-        size_t node_chunk_count = vector_count(vn) / 3;
-        size_t result_chunk_count = vector_count(result) / 3;
-
-        assert(vector_count(vn) % 3 == 0);
-        assert(vector_count(result) % 3 == 0);
-
-        /* For all index triplets in the node... */
-        for (node_chunk_idx = 0; node_chunk_idx != node_chunk_count; node_chunk_idx++)
+        aabb8_t children, tight;
+        unsigned mask;
+        children_aabb8(&children, &tight, node_bb, octree->looseness);
+        mask = intersect_aabb8_aabb_mask(&children, bb, 0);
+        for (i = 0; i != 8; ++i)
         {
-            /* Try to find the current triplet in the result index buffer */
-            size_t result_chunk_idx = 0;
-            for (result_chunk_idx = 0; result_chunk_idx != result_chunk_count; result_chunk_idx++)
-            {
-                if (memcmp(&vn->data[node_chunk_idx*chunk_size],
-                           &result->data[result_chunk_idx*chunk_size],
-                           chunk_size) != 0)
-                    goto identical_face_found;
-            }
-
-            /*
-             * Duplicate indices not found, append this chunk to the vector by
-             * emplacing 3 times.
-             */
-            if (vector_emplace(result) == NULL) return -1;
-            if (vector_emplace(result) == NULL) return -1;
-            if (vector_emplace(result) == NULL) return -1;
-            memcpy(result->data + (result->count * result->element_size) - chunk_size,
-                   &vn->data[node_chunk_idx*chunk_size],
-                   chunk_size);
-
-            identical_face_found: continue;
+            aabb_t child_bb;
+            if ((mask & (1u << i)) == 0)
+                continue; /* This child and all of its children are of no interest */
+            child_bb = aabb8_get(&tight, (int)i);
+            if ((stop = visit_potential_faces(octree, node->first_child + i, &child_bb, bb, visitor, user_data)) != 0)
+                return stop;
         }
     }
 
     return 0;
 }
+
+/* ------------------------------------------------------------------------- */
 int
-octree_query_potential_faces(const octree_t* octree, vector_t* result, const wsreal_t aabb[6])
+octree_visit_potential_faces(octree_t* octree,
+                             const wsreal_t aabb[6],
+                             octree_face_visitor visitor,
+                             void* user_data)
 {
-    return octree_query_potential_faces_recursive(&octree->root, result, aabb);
+    aabb_t root_bb;
+    if (octree->face_marks == NULL)
+        return 0;
+    root_bb = octree_loose_aabb(&octree->aabb, octree->looseness);
+    if (intersect_aabb_aabb_test(root_bb.xyzxyz, aabb) == 0)
+        return 0;
+    begin_query(octree);
+    octree->counters.queries++;
+    return visit_potential_faces(octree, 0, &octree->aabb, aabb, visitor, user_data);
 }
 
 /* ------------------------------------------------------------------------- */
+static int
+push_face(void* user_data, wsib_t face_id)
+{
+    vector_t* result = user_data;
+    return vector_push(result, &face_id) == VECTOR_ERROR ? -1 : 0;
+}
 int
-octree_query_point_is_inside_mesh_recursive(const octree_node_t* node, const mesh_t* mesh, const wsreal_t p[3], btree_t* tested_indices)
+octree_query_potential_faces(octree_t* octree, vector_t* result, const wsreal_t aabb[6])
 {
-    wsib_t i;
+    aabb_t root_bb;
+    if (octree->face_marks == NULL)
+        return 1;
+    root_bb = octree_loose_aabb(&octree->aabb, octree->looseness);
+    if (intersect_aabb_aabb_test(root_bb.xyzxyz, aabb) == 0)
+        return 1;
+    return octree_visit_potential_faces(octree, aabb, push_face, result);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Counts how many faces the vertical segment from p1 to p2 crosses, visiting
+ * only the nodes the segment passes through. Points lying exactly on a node
+ * boundary descend into the nodes on both sides, so faces on either side of
+ * the boundary are tested. Faces overlapping more than one leaf along the
+ * segment are only tested once, they are stamped with the current query
+ * epoch the first time. If crossings isn't NULL, the Z coordinate of every
+ * crossing is appended to it. Returns -1 if that runs out of memory.
+ */
+static int
+count_column_crossings(octree_t* octree, uint32_t node_idx, const aabb_t* node_bb,
+                       const wsreal_t p1[3], const wsreal_t p2[3], vector_t* crossings)
+{
+    const octree_node_t* node = octree_node(octree, node_idx);
+    const mesh_t* mesh = octree->mesh;
     int intersect_count = 0;
-    vec3_t p1, p2;
+    uint32_t i;
 
-    /*
-     * The way this algorithm works is we project the mesh onto a 2D plane (the
-     * easiest way being to just eliminate one of the main axes) and do a
-     * line-face intersection test along the eliminated axis through the
-     * specified point and count how many faces it intersects. An even number
-     * of intersections means the point lies outside of the mesh, and odd
-     * number means inside.
-     *
-     * For this implementation we don't project, we just cast a ray from +Z to
-     * -Z through point p, where +Z and -Z lie outside of the octree's bounding
-     * box, so the line is guaranteed to intersect all faces in the mesh.
-     */
+    octree->counters.nodes_visited++;
+    octree->counters.face_references += node->face_count;
 
-    /* Only select partitions that are leaf nodes */
-    if (node->children != NULL)
+    if (octree_node_is_leaf(node) == 0)
     {
+        /* The line is a zero width box, touching it is enough */
+        aabb8_t children, tight;
+        unsigned mask;
+        wsreal_t line_bb[6];
+        line_bb[0] = p1[0]; line_bb[1] = p1[1]; line_bb[2] = p1[2];
+        line_bb[3] = p2[0]; line_bb[4] = p2[1]; line_bb[5] = p2[2];
+        children_aabb8(&children, &tight, node_bb, octree->looseness);
+        mask = intersect_aabb8_aabb_mask(&children, line_bb, 1);
         for (i = 0; i != 8; ++i)
-            intersect_count += octree_query_point_is_inside_mesh_recursive(&node->children[i], mesh, p, tested_indices);
-        return intersect_count;
+        {
+            aabb_t child_bb;
+            if ((mask & (1u << i)) == 0)
+                continue;
+            child_bb = aabb8_get(&tight, (int)i);
+            int child_count = count_column_crossings(octree, node->first_child + i, &child_bb, p1, p2, crossings);
+            if (child_count < 0)
+                return -1;
+            intersect_count += child_count;
+        }
     }
 
-    /*
-     * We are a leaf node, do intersection test from -Z to +Z for all faces in
-     * our partition.
-     */
-    vec3_copy(&p1, p);
-    vec3_copy(&p2, p);
-    p1.v.z = AABB_AZ(mesh->aabb) - 1; /* From -Z... */
-    p2.v.z = AABB_BZ(mesh->aabb) + 1; /* ...to +Z */
-    for (i = 0; i != (wsib_t)vector_count(&node->index_buffer); i += 3)
+    for (i = 0; i != node->face_count; ++i)
     {
-        wsret result;
+        wsib_t face_id = *(wsib_t*)vector_get_element(&octree->face_ids, node->face_offset + i);
         wsib_t indices[3];
+        wsreal_t hit[3];
         vec3_t vertices[3];
-        indices[0] = mesh_get_index_from_buffer(node->index_buffer.data, i + 0, mesh->ib_type);
-        indices[1] = mesh_get_index_from_buffer(node->index_buffer.data, i + 1, mesh->ib_type);
-        indices[2] = mesh_get_index_from_buffer(node->index_buffer.data, i + 2, mesh->ib_type);
 
         /* Make sure we don't test duplicates */
-        result = btree_insert(tested_indices, hash_face_indices(indices), (void*)1);
-        if (result == 1)
+        if (octree->face_marks[face_id] == octree->query_epoch)
+        {
+            octree->counters.duplicates_skipped++;
             continue; /* face was already tested */
-        if (result == -1)
-            return -1;
+        }
+        octree->face_marks[face_id] = octree->query_epoch;
+
+        indices[0] = mesh_get_index_from_buffer(mesh->ib, face_id * 3 + 0, mesh->ib_type);
+        indices[1] = mesh_get_index_from_buffer(mesh->ib, face_id * 3 + 1, mesh->ib_type);
+        indices[2] = mesh_get_index_from_buffer(mesh->ib, face_id * 3 + 2, mesh->ib_type);
 
         /* Get face vertices and do intersection test */
         vertices[0] = mesh_get_vertex_position_from_buffer(mesh->vb, indices[0], mesh->vb_type);
         vertices[1] = mesh_get_vertex_position_from_buffer(mesh->vb, indices[1], mesh->vb_type);
         vertices[2] = mesh_get_vertex_position_from_buffer(mesh->vb, indices[2], mesh->vb_type);
-        intersect_count += intersect_line_triangle_test(p1.xyz, p2.xyz, vertices[0].xyz, vertices[1].xyz, vertices[2].xyz);
+        if (crossings == NULL)
+            intersect_count += intersect_line_triangle_test(p1, p2, vertices[0].xyz, vertices[1].xyz, vertices[2].xyz);
+        else if (intersect_line_triangle_cartesian(hit, p1, p2, vertices[0].xyz, vertices[1].xyz, vertices[2].xyz))
+        {
+            if (vector_push(crossings, &hit[2]) == VECTOR_ERROR)
+                return -1;
+            ++intersect_count;
+        }
     }
 
     return intersect_count;
 }
 
+/* ------------------------------------------------------------------------- */
+static int
+query_point(octree_t* octree, const wsreal_t p[3])
+{
+    const mesh_t* mesh = octree->mesh;
+    aabb_t root_bb;
+    vec3_t p1, p2;
+
+    /*
+     * The way this algorithm works is we project the mesh onto a 2D plane (the
+     * easiest way being to just eliminate one of the main axes) and do a
+     * line-face intersection test along the eliminated axis through the
+     * specified point and count how many faces it intersects. An even number
+     * of intersections means the point lies outside of the mesh, and odd
+     * number means inside.
+     *
+     * For this implementation we don't project, we just cast a ray from p to
+     * +Z, where +Z lies outside of the octree's bounding box. The ray must
+     * start at p: a line through the whole mesh crosses every closed surface
+     * an even number of times, no matter where p is.
+     */
+    vec3_copy(&p1, p);
+    vec3_copy(&p2, p);
+    p2.v.z = AABB_BZ(mesh->aabb) + 1;
+
+    /* The children are culled by count_column_crossings(), the root is culled here */
+    root_bb = octree_loose_aabb(&octree->aabb, octree->looseness);
+    if (p[0] < AABB_AX(root_bb) || p[0] > AABB_BX(root_bb) ||
+        p[1] < AABB_AY(root_bb) || p[1] > AABB_BY(root_bb) ||
+        p[2] > AABB_BZ(root_bb))
+        return 0;
+
+    begin_query(octree);
+    octree->counters.queries++;
+    return count_column_crossings(octree, 0, &octree->aabb, p1.xyz, p2.xyz, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
 int
-octree_query_point_is_inside_mesh(const octree_t* octree, const wsreal_t p[3])
+octree_query_point_is_inside_mesh(octree_t* octree, const wsreal_t p[3])
 {
-    int result;
-    btree_t tested_indices;
-    btree_construct(&tested_indices);
-    result = octree_query_point_is_inside_mesh_recursive(&octree->root, octree->mesh, p, &tested_indices);
-    btree_clear_free(&tested_indices);
-    return result;
+    if (octree->face_marks == NULL)
+        return 0;
+    return query_point(octree, p);
+}
+
+/* ------------------------------------------------------------------------- */
+typedef struct column_point_t
+{
+    const wsreal_t* p;
+    size_t          index;
+} column_point_t;
+
+/* Sorts points into columns of equal X and Y, bottom to top */
+static int
+column_point_compare(const void* a, const void* b)
+{
+    const wsreal_t* pa = ((const column_point_t*)a)->p;
+    const wsreal_t* pb = ((const column_point_t*)b)->p;
+    int i;
+    for (i = 0; i != 3; ++i)
+    {
+        if (pa[i] < pb[i]) return -1;
+        if (pa[i] > pb[i]) return 1;
+    }
+    return 0;
+}
+
+static int
+wsreal_compare(const void* a, const void* b)
+{
+    wsreal_t za = *(const wsreal_t*)a;
+    wsreal_t zb = *(const wsreal_t*)b;
+    return za < zb ? -1 : za > zb ? 1 : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+octree_query_points_are_inside_mesh(octree_t* octree,
+                                    uint8_t* inside,
+                                    const wsreal_t* points,
+                                    size_t count)
+{
+    column_point_t* order;
+    vector_t crossings;
+    aabb_t root_bb;
+    size_t begin, end, i;
+
+    memset(inside, 0, count);
+    if (octree->face_marks == NULL || count == 0)
+        return WS_OK;
+
+    /*
+     * Points sharing a column are served by a single ray, cast from the lowest
+     * of them. Sorting its crossings lets every point of the column count the
+     * crossings above it with one sweep.
+     */
+    if ((order = MALLOC(sizeof(column_point_t) * count)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (i = 0; i != count; ++i)
+    {
+        order[i].p = &points[i*3];
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(column_point_t), column_point_compare);
+
+    vector_construct(&crossings, sizeof(wsreal_t));
+    root_bb = octree_loose_aabb(&octree->aabb, octree->looseness);
+    for (begin = 0; begin != count; begin = end)
+    {
+        const wsreal_t* p = order[begin].p;
+        vec3_t p1, p2;
+        size_t c;
+
+        end = begin + 1;
+        while (end != count && order[end].p[0] == p[0] && order[end].p[1] == p[1])
+            ++end;
+
+        /* Misses the tree, or every point of the column lies above it */
+        if (p[0] < AABB_AX(root_bb) || p[0] > AABB_BX(root_bb) ||
+            p[1] < AABB_AY(root_bb) || p[1] > AABB_BY(root_bb) ||
+            p[2] > AABB_BZ(root_bb))
+            continue;
+
+        vec3_copy(&p1, p);
+        vec3_copy(&p2, p);
+        p2.v.z = AABB_BZ(octree->mesh->aabb) + 1;
+        vector_clear(&crossings);
+        begin_query(octree);
+        octree->counters.queries++;
+        if (count_column_crossings(octree, 0, &octree->aabb, p1.xyz, p2.xyz, &crossings) < 0)
+        {
+            vector_clear_free(&crossings);
+            FREE(order);
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        }
+        if (vector_count(&crossings) > 1)
+            qsort(crossings.data, vector_count(&crossings), sizeof(wsreal_t), wsreal_compare);
+
+        for (c = 0, i = begin; i != end; ++i)
+        {
+            while (c != vector_count(&crossings) && *(wsreal_t*)vector_get_element(&crossings, c) < order[i].p[2])
+                ++c;
+            inside[order[i].index] = (uint8_t)((vector_count(&crossings) - c) % 2);
+        }
+    }
+
+    vector_clear_free(&crossings);
+    FREE(order);
+    return WS_OK;
 }
@@ -0,0 +1,155 @@
+#include "wavesim/thread.h"
+#include "wavesim/memory.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct thread_t
+{
+    pthread_t handle;
+    thread_func func;
+    void* arg;
+};
+
+struct mutex_t
+{
+    pthread_mutex_t handle;
+};
+
+struct cond_t
+{
+    pthread_cond_t handle;
+};
+
+/* ------------------------------------------------------------------------- */
+static void*
+thread_entry(void* arg)
+{
+    thread_t* thread = arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+thread_start(thread_t** thread, thread_func func, void* arg)
+{
+    *thread = MALLOC(sizeof **thread);
+    if (*thread == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
+    (*thread)->func = func;
+    (*thread)->arg = arg;
+    if (pthread_create(&(*thread)->handle, NULL, thread_entry, *thread) != 0)
+    {
+        FREE(*thread);
+        WSRET(WS_ERR_THREAD_CREATE_FAILED);
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+thread_join(thread_t* thread)
+{
+    pthread_join(thread->handle, NULL);
+    FREE(thread);
+}
+
+/* ------------------------------------------------------------------------- */
+int
+thread_hardware_concurrency(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+/* ------------------------------------------------------------------------- */
+mutex_t*
+mutex_create(void)
+{
+    pthread_mutexattr_t attr;
+    mutex_t* mutex = malloc(sizeof *mutex);
+    if (mutex == NULL)
+        return NULL;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if (pthread_mutex_init(&mutex->handle, &attr) != 0)
+    {
+        free(mutex);
+        mutex = NULL;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    return mutex;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_destroy(mutex_t* mutex)
+{
+    pthread_mutex_destroy(&mutex->handle);
+    free(mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_lock(mutex_t* mutex)
+{
+    pthread_mutex_lock(&mutex->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_unlock(mutex_t* mutex)
+{
+    pthread_mutex_unlock(&mutex->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+cond_t*
+cond_create(void)
+{
+    cond_t* cond = malloc(sizeof *cond);
+    if (cond == NULL)
+        return NULL;
+
+    if (pthread_cond_init(&cond->handle, NULL) != 0)
+    {
+        free(cond);
+        return NULL;
+    }
+
+    return cond;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_destroy(cond_t* cond)
+{
+    pthread_cond_destroy(&cond->handle);
+    free(cond);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_wait(cond_t* cond, mutex_t* mutex)
+{
+    pthread_cond_wait(&cond->handle, &mutex->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_signal(cond_t* cond)
+{
+    pthread_cond_signal(&cond->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_broadcast(cond_t* cond)
+{
+    pthread_cond_broadcast(&cond->handle);
+}
@@ -0,0 +1,141 @@
+#include "wavesim/thread.h"
+#include "wavesim/memory.h"
+#include <stdlib.h>
+#include <windows.h>
+
+struct thread_t
+{
+    HANDLE handle;
+    thread_func func;
+    void* arg;
+};
+
+struct mutex_t
+{
+    CRITICAL_SECTION handle; /* critical sections are recursive */
+};
+
+struct cond_t
+{
+    CONDITION_VARIABLE handle;
+};
+
+/* ------------------------------------------------------------------------- */
+static DWORD WINAPI
+thread_entry(LPVOID arg)
+{
+    thread_t* thread = arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+thread_start(thread_t** thread, thread_func func, void* arg)
+{
+    *thread = MALLOC(sizeof **thread);
+    if (*thread == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+
+    (*thread)->func = func;
+    (*thread)->arg = arg;
+    (*thread)->handle = CreateThread(NULL, 0, thread_entry, *thread, 0, NULL);
+    if ((*thread)->handle == NULL)
+    {
+        FREE(*thread);
+        WSRET(WS_ERR_THREAD_CREATE_FAILED);
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+thread_join(thread_t* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    FREE(thread);
+}
+
+/* ------------------------------------------------------------------------- */
+int
+thread_hardware_concurrency(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+/* ------------------------------------------------------------------------- */
+mutex_t*
+mutex_create(void)
+{
+    mutex_t* mutex = malloc(sizeof *mutex);
+    if (mutex == NULL)
+        return NULL;
+    InitializeCriticalSection(&mutex->handle);
+    return mutex;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_destroy(mutex_t* mutex)
+{
+    DeleteCriticalSection(&mutex->handle);
+    free(mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_lock(mutex_t* mutex)
+{
+    EnterCriticalSection(&mutex->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+mutex_unlock(mutex_t* mutex)
+{
+    LeaveCriticalSection(&mutex->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+cond_t*
+cond_create(void)
+{
+    cond_t* cond = malloc(sizeof *cond);
+    if (cond == NULL)
+        return NULL;
+    InitializeConditionVariable(&cond->handle);
+    return cond;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_destroy(cond_t* cond)
+{
+    /* Condition variables don't need to be deleted */
+    free(cond);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_wait(cond_t* cond, mutex_t* mutex)
+{
+    SleepConditionVariableCS(&cond->handle, &mutex->handle, INFINITE);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_signal(cond_t* cond)
+{
+    WakeConditionVariable(&cond->handle);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cond_broadcast(cond_t* cond)
+{
+    WakeAllConditionVariable(&cond->handle);
+}
@@ -6,19 +6,27 @@ static const char* codemap[] = {
     "The program ran out of memory in a malloc() call somewhere.",
     "The library was built without unit tests. Try passing -DWAVESIM_TESTS=ON to CMake.",
     "One or more unit tests failed to pass. This indicates that some bugs are present and need to be fixed.",
+    "The requested feature is not implemented.",
     "An attempt was made to subdivide a node in the octree that was not a leaf node. This operation is only valid for leaf nodes.",
     "Failed to open file.",
     "Something went wrong while reading from a file/stream.",
     "3 indices were expected (to form a face), but there were less.",
     "A face that has more than 3 vertices was detected. Only triangular faces are supported.",
-    "The corresponding index to a vertex was not found. This can occur in the obj exporter when the indices are exported and a vertex is not found in vi_map."
+    "The corresponding index to a vertex was not found. This can occur in the obj exporter when the indices are exported and a vertex is not found in vi_map.",
+    "Failed to start a new thread.",
+    "The mesh has more distinct attributes than fit into a material table (65536).",
+    "The medium has no partitions. Build it from a mesh before preparing the simulation.",
+    "The simulation must be prepared with simulation_prepare() first.",
+    "The position doesn't lie within any partition of the medium.",
+    "A partition of the medium has a sound speed that isn't positive.",
+    "The grid of the medium has too few cells per wavelength at the simulation's maximum frequency."
 };
 
 /* ------------------------------------------------------------------------- */
 const char*
 wsret_to_string(wsret code)
 {
-    return codemap[-code-1];
+    return codemap[-code];
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1,5 +1,107 @@
 #include "wavesim/simulation.h"
+#include "wavesim/dct.h"
 #include "wavesim/memory.h"
+#include "wavesim/thread.h"
+#include "wavesim/thread_pool.h"
+#include <string.h>
+#include <math.h>
+
+#define PI 3.14159265358979323846
+
+#define LOCAL_INDEX(part, x, y, z) \
+    (((size_t)(x) * (size_t)(part)->dims[1] + (size_t)(y)) * (size_t)(part)->dims[2] + (size_t)(z))
+
+/* 6th order central difference of the second derivative, a[0] is the center */
+static const double g_stencil[4] = {-490.0 / 180, 270.0 / 180, -27.0 / 180, 2.0 / 180};
+#define STENCIL_REACH 3
+
+/*
+ * Leapfrog with the stencil above along all three axes is stable up to
+ * c*dt/h = 2/sqrt(3 * sum|a|), sum|a| = 1088/180. The interface terms run
+ * into the same limit, the 2nd order FDTD limit 1/sqrt(3) is not enough.
+ */
+#define MAX_COURANT_NUMBER (2.0 / sqrt(3.0 * 1088.0 / 180.0))
+
+#define NO_CELL ((size_t)-1)
+
+/*
+ * Enough tasks per worker and phase that workers finishing early find
+ * something to steal, but not so many that scheduling them costs more than
+ * the work they do.
+ */
+#define TASKS_PER_WORKER 8
+#define MIN_TASK_SIZE 4096
+
+/* ------------------------------------------------------------------------- */
+static void
+free_interface_terms(simulation_interface_terms_t* terms)
+{
+    if (terms->target != NULL)      FREE(terms->target);
+    if (terms->source != NULL)      FREE(terms->source);
+    if (terms->mirror != NULL)      FREE(terms->mirror);
+    if (terms->coefficient != NULL) FREE(terms->coefficient);
+    if (terms->offsets != NULL)     FREE(terms->offsets);
+    memset(terms, 0, sizeof *terms);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+free_pml(simulation_pml_t* pml)
+{
+    wsreal_t** fields[5];
+    int i;
+    fields[0] = &pml->split;
+    fields[1] = &pml->split_prev;
+    fields[2] = &pml->gain;
+    fields[3] = &pml->decay;
+    fields[4] = &pml->restore;
+    for (i = 0; i != 5; ++i)
+    {
+        if (*fields[i] != NULL)
+            FREE(*fields[i]);
+        *fields[i] = NULL;
+    }
+    if (pml->neighbours != NULL)
+        FREE(pml->neighbours);
+    pml->neighbours = NULL;
+    vector_clear_free(&pml->slabs);
+    pml->cell_count = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+free_fields(simulation_t* simulation)
+{
+    wsreal_t** fields[7];
+    int i;
+    fields[0] = &simulation->pressure;
+    fields[1] = &simulation->forcing;
+    fields[2] = &simulation->modes;
+    fields[3] = &simulation->modes_prev;
+    fields[4] = &simulation->mode_cos;
+    fields[5] = &simulation->mode_forcing;
+    fields[6] = &simulation->scratch;
+    for (i = 0; i != 7; ++i)
+    {
+        if (*fields[i] != NULL)
+            FREE(*fields[i]);
+        *fields[i] = NULL;
+    }
+    if (simulation->thread_pool != NULL)
+        thread_pool_destroy(simulation->thread_pool);
+    simulation->thread_pool = NULL;
+    for (i = 0; i != SIMULATION_PHASE_COUNT; ++i)
+        vector_clear_free(&simulation->tasks[i]);
+    vector_clear_free(&simulation->partitions);
+    free_interface_terms(&simulation->interface_terms);
+    free_pml(&simulation->pml);
+    if (simulation->cell_partitions != NULL)
+        FREE(simulation->cell_partitions);
+    simulation->cell_partitions = NULL;
+    simulation->scratch_size = 0;
+    simulation->cell_count = 0;
+    simulation->step_count = 0;
+}
 
 /* ------------------------------------------------------------------------- */
 wsret
@@ -25,12 +127,1168 @@ simulation_destroy(simulation_t* simulation)
 void
 simulation_construct(simulation_t* simulation)
 {
+    int i;
+
     medium_construct(&simulation->medium);
+    vector_construct(&simulation->partitions, sizeof(simulation_partition_t));
+    simulation->dct_cache = NULL;
+    simulation->time_step = 0;
+    simulation->step_count = 0;
+    simulation->cell_count = 0;
+    simulation->pressure = NULL;
+    simulation->forcing = NULL;
+    simulation->modes = NULL;
+    simulation->modes_prev = NULL;
+    simulation->mode_cos = NULL;
+    simulation->mode_forcing = NULL;
+    simulation->scratch = NULL;
+    simulation->scratch_size = 0;
+    simulation->cell_partitions = NULL;
+    simulation->max_frequency = 0;
+    simulation->spatial_samples = 3;
+    simulation->thread_count = 1;
+    simulation->thread_pool = NULL;
+    for (i = 0; i != SIMULATION_PHASE_COUNT; ++i)
+        vector_construct(&simulation->tasks[i], sizeof(simulation_task_t));
+    memset(&simulation->interface_terms, 0, sizeof(simulation->interface_terms));
+    memset(&simulation->pml, 0, sizeof(simulation->pml));
+    vector_construct(&simulation->pml.slabs, sizeof(simulation_pml_slab_t));
+    simulation_pml_params_default(&simulation->pml_params);
+    simulation->pml_params.faces = 0;
 }
 
 /* ------------------------------------------------------------------------- */
 void
 simulation_destruct(simulation_t* simulation)
 {
+    free_fields(simulation);
+    if (simulation->dct_cache != NULL)
+    {
+        dct_cache_clear_free(simulation->dct_cache);
+        FREE(simulation->dct_cache);
+    }
     medium_destruct(&simulation->medium);
 }
+
+/* ------------------------------------------------------------------------- */
+void
+simulation_set_thread_count(simulation_t* simulation, int thread_count)
+{
+    simulation->thread_count = thread_count;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+simulation_pml_params_default(simulation_pml_params_t* params)
+{
+    params->faces = SIMULATION_FACE_ALL;
+    params->thickness = 8;
+    params->profile_order = 2;
+    params->reflection = (wsreal_t)1e-3;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+simulation_set_pml(simulation_t* simulation, const simulation_pml_params_t* params)
+{
+    simulation->pml_params = *params;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Computes the update coefficients of every mode of a partition. The angular
+ * frequency of mode (kx,ky,kz) in a box of size lx*ly*lz is
+ * w = c*pi*sqrt((kx/lx)^2 + (ky/ly)^2 + (kz/lz)^2).
+ */
+static void
+compute_mode_coefficients(simulation_t* simulation, const simulation_partition_t* part, wsreal_t sound_speed)
+{
+    const wsreal_t* h = simulation->medium.grid_size.xyz;
+    wsreal_t dt = simulation->time_step;
+    int32_t x, y, z;
+
+    for (x = 0; x != part->dims[0]; ++x)
+        for (y = 0; y != part->dims[1]; ++y)
+            for (z = 0; z != part->dims[2]; ++z)
+            {
+                size_t i = part->offset + LOCAL_INDEX(part, x, y, z);
+                wsreal_t kx = x / (part->dims[0] * h[0]);
+                wsreal_t ky = y / (part->dims[1] * h[1]);
+                wsreal_t kz = z / (part->dims[2] * h[2]);
+                wsreal_t w = sound_speed * (wsreal_t)PI * sqrt(kx*kx + ky*ky + kz*kz);
+                wsreal_t c = cos(w * dt);
+                simulation->mode_cos[i] = 2 * c;
+
+                /* The constant mode isn't restored by anything, forcing accumulates */
+                if (w == 0)
+                    simulation->mode_forcing[i] = dt * dt;
+                else
+                    simulation->mode_forcing[i] = 2 * (1 - c) / (w * w);
+            }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Index of a cell in the field arrays, from cell coordinates of the medium's
+ * grid.
+ */
+static size_t
+cell_index(const simulation_t* simulation, size_t partition_idx, const int32_t cell[3])
+{
+    const medium_partition_t* partition = vector_get_element(&simulation->medium.partitions, partition_idx);
+    const simulation_partition_t* part = vector_get_element(&simulation->partitions, partition_idx);
+    return part->offset + LOCAL_INDEX(part,
+                                      cell[0] - partition->box[0],
+                                      cell[1] - partition->box[1],
+                                      cell[2] - partition->box[2]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Index of a PML cell in the pressure array, or NO_CELL if no slab contains
+ * the cell.
+ */
+static size_t
+pml_cell_index(const simulation_t* simulation, const int32_t cell[3])
+{
+    VECTOR_FOR_EACH(&simulation->pml.slabs, simulation_pml_slab_t, slab)
+        const int32_t* box = slab->box;
+        if (cell[0] < box[0] || cell[0] >= box[3] ||
+            cell[1] < box[1] || cell[1] >= box[4] ||
+            cell[2] < box[2] || cell[2] >= box[5])
+            continue;
+        return simulation->cell_count + slab->offset +
+            ((size_t)(cell[0] - box[0]) * (size_t)(box[4] - box[1]) + (size_t)(cell[1] - box[1])) *
+            (size_t)(box[5] - box[2]) + (size_t)(cell[2] - box[2]);
+    VECTOR_END_EACH
+
+    return NO_CELL;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Generates the terms of one column of cells crossing a face, for the cells
+ * on the side of partition_idx. The column is given by the cell coordinates
+ * of the face (plane) along the axis and of the column along the other two
+ * axes. The cells across the face belong to other_partition, or to the PML if
+ * other_partition is NO_CELL. The terms are appended to terms, or only
+ * counted if terms is NULL. Returns the number of terms.
+ *
+ * Cells are counted in depth from the face. A target cell at depth d sees
+ * the neighbour's cell at depth e at a distance of d+e+1 cells. Where one of
+ * the sides is thinner than the stencil, the terms reaching beyond it are
+ * dropped.
+ */
+static size_t
+emit_column_terms(const simulation_t* simulation, size_t partition_idx, int32_t axis, int32_t side,
+                  const int32_t column[3], int32_t other_depth, size_t other_partition,
+                  simulation_interface_terms_t* terms)
+{
+    const medium_partition_t* own = vector_get_element(&simulation->medium.partitions, partition_idx);
+    int32_t plane = column[axis];
+    int32_t own_depth = own->box[axis+3] - own->box[axis];
+    wsreal_t h = simulation->medium.grid_size.xyz[axis];
+    wsreal_t scale = own->sound_speed * own->sound_speed / (h * h);
+    size_t count = 0;
+    int32_t d, e;
+
+    for (d = 0; d < STENCIL_REACH && d < own_depth; ++d)
+        for (e = 0; d + e < STENCIL_REACH && e < own_depth && e < other_depth; ++e)
+        {
+            int32_t target[3], source[3], mirror[3];
+            if (terms != NULL)
+            {
+                size_t i = terms->count++;
+                memcpy(target, column, sizeof(target));
+                memcpy(source, column, sizeof(source));
+                memcpy(mirror, column, sizeof(mirror));
+                target[axis] = (side > 0 ? plane - 1 - d : plane + d);
+                mirror[axis] = (side > 0 ? plane - 1 - e : plane + e);
+                source[axis] = (side > 0 ? plane + e : plane - 1 - e);
+                terms->target[i] = cell_index(simulation, partition_idx, target);
+                terms->mirror[i] = cell_index(simulation, partition_idx, mirror);
+                terms->source[i] = (other_partition == NO_CELL ?
+                    pml_cell_index(simulation, source) :
+                    cell_index(simulation, other_partition, source));
+                terms->coefficient[i] = scale * (wsreal_t)g_stencil[d+e+1];
+            }
+            ++count;
+        }
+
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Generates the terms of one interface for the cells on the owning
+ * partition's side, see emit_column_terms().
+ */
+static size_t
+emit_interface_terms(const simulation_t* simulation, size_t partition_idx,
+                     const medium_interface_t* iface, simulation_interface_terms_t* terms)
+{
+    const medium_partition_t* other = vector_get_element(&simulation->medium.partitions, (size_t)iface->partition);
+    int32_t axis = iface->axis;
+    int32_t u_axis = (axis + 1) % 3;
+    int32_t v_axis = (axis + 2) % 3;
+    int32_t column[3];
+    size_t count = 0;
+
+    column[axis] = iface->rect[axis];
+    for (column[u_axis] = iface->rect[u_axis]; column[u_axis] != iface->rect[u_axis+3]; ++column[u_axis])
+        for (column[v_axis] = iface->rect[v_axis]; column[v_axis] != iface->rect[v_axis+3]; ++column[v_axis])
+            count += emit_column_terms(simulation, partition_idx, axis, iface->side, column,
+                                       other->box[axis+3] - other->box[axis], (size_t)iface->partition, terms);
+
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Generates the terms of a partition's cells next to a face of the medium's
+ * boundary with a PML, see emit_column_terms().
+ */
+static size_t
+emit_pml_terms(const simulation_t* simulation, size_t partition_idx, int face,
+               simulation_interface_terms_t* terms)
+{
+    const medium_partition_t* partition = vector_get_element(&simulation->medium.partitions, partition_idx);
+    const int32_t* dims = simulation->medium.grid_dims;
+    int32_t axis = face / 2;
+    int32_t u_axis = (axis + 1) % 3;
+    int32_t v_axis = (axis + 2) % 3;
+    int32_t column[3];
+    size_t count = 0;
+
+    if (vector_count(&simulation->pml.slabs) == 0 || (simulation->pml_params.faces & (1u << face)) == 0)
+        return 0;
+    if ((face & 1) ? partition->box[axis+3] != dims[axis] : partition->box[axis] != 0)
+        return 0;
+
+    column[axis] = (face & 1) ? dims[axis] : 0;
+    for (column[u_axis] = partition->box[u_axis]; column[u_axis] != partition->box[u_axis+3]; ++column[u_axis])
+        for (column[v_axis] = partition->box[v_axis]; column[v_axis] != partition->box[v_axis+3]; ++column[v_axis])
+            count += emit_column_terms(simulation, partition_idx, axis, (face & 1) ? 1 : -1, column,
+                                       simulation->pml_params.thickness, NO_CELL, terms);
+
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Generates all terms targeting the cells of a partition.
+ */
+static size_t
+emit_partition_terms(const simulation_t* simulation, size_t partition_idx, simulation_interface_terms_t* terms)
+{
+    const medium_interface_t* ifaces;
+    size_t iface_count, i;
+    size_t count = 0;
+    int face;
+
+    ifaces = medium_partition_interfaces(&simulation->medium, partition_idx, &iface_count);
+    for (i = 0; i != iface_count; ++i)
+        count += emit_interface_terms(simulation, partition_idx, &ifaces[i], terms);
+    for (face = 0; face != 6; ++face)
+        count += emit_pml_terms(simulation, partition_idx, face, terms);
+
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+build_interface_terms(simulation_t* simulation)
+{
+    simulation_interface_terms_t* terms = &simulation->interface_terms;
+    size_t partition_count = vector_count(&simulation->partitions);
+    size_t total = 0;
+    size_t p;
+
+    terms->offsets = MALLOC(sizeof(size_t) * (partition_count + 1));
+    if (terms->offsets == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (p = 0; p != partition_count; ++p)
+    {
+        terms->offsets[p] = total;
+        total += emit_partition_terms(simulation, p, NULL);
+    }
+    terms->offsets[partition_count] = total;
+
+    if (total == 0)
+        return WS_OK;
+
+    terms->target = MALLOC(sizeof(size_t) * total);
+    terms->source = MALLOC(sizeof(size_t) * total);
+    terms->mirror = MALLOC(sizeof(size_t) * total);
+    terms->coefficient = MALLOC(sizeof(wsreal_t) * total);
+    if (terms->target == NULL || terms->source == NULL || terms->mirror == NULL || terms->coefficient == NULL)
+    {
+        free_interface_terms(terms);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    for (p = 0; p != partition_count; ++p)
+        emit_partition_terms(simulation, p, terms);
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Creates one slab per selected face. Slabs along an axis extend over the
+ * edges and corners they share with the selected faces of later axes, so no
+ * two slabs overlap.
+ */
+static wsret
+layout_pml(simulation_t* simulation)
+{
+    const simulation_pml_params_t* params = &simulation->pml_params;
+    const int32_t* dims = simulation->medium.grid_dims;
+    int32_t thickness = params->thickness;
+    int face, axis;
+
+    if (thickness <= 0)
+        return WS_OK;
+
+    for (face = 0; face != 6; ++face)
+    {
+        simulation_pml_slab_t* slab;
+        int32_t face_axis = face / 2;
+        if ((params->faces & (1u << face)) == 0)
+            continue;
+
+        slab = vector_emplace(&simulation->pml.slabs);
+        if (slab == NULL)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        for (axis = 0; axis != 3; ++axis)
+        {
+            int extend = (axis > face_axis);
+            if (axis == face_axis)
+            {
+                slab->box[axis]   = (face & 1) ? dims[axis] : -thickness;
+                slab->box[axis+3] = (face & 1) ? dims[axis] + thickness : 0;
+            }
+            else
+            {
+                slab->box[axis]   = (extend && (params->faces & (1u << (2*axis)))) ? -thickness : 0;
+                slab->box[axis+3] = dims[axis] + ((extend && (params->faces & (1u << (2*axis+1)))) ? thickness : 0);
+            }
+        }
+
+        slab->offset = simulation->pml.cell_count;
+        simulation->pml.cell_count += (size_t)(slab->box[3] - slab->box[0]) *
+                                      (size_t)(slab->box[4] - slab->box[1]) *
+                                      (size_t)(slab->box[5] - slab->box[2]);
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+free_face_maps(int32_t* face_maps[6])
+{
+    int face;
+    for (face = 0; face != 6; ++face)
+    {
+        if (face_maps[face] != NULL)
+            FREE(face_maps[face]);
+        face_maps[face] = NULL;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * For every face with a PML, looks up which partition each cell on the
+ * boundary belongs to. face_maps[face][u * dims[v_axis] + v] is the partition
+ * index, or -1 if the cell isn't part of any partition.
+ */
+static wsret
+build_face_maps(const simulation_t* simulation, int32_t* face_maps[6])
+{
+    const int32_t* dims = simulation->medium.grid_dims;
+    int face;
+    size_t i;
+
+    for (face = 0; face != 6; ++face)
+        face_maps[face] = NULL;
+    if (vector_count(&simulation->pml.slabs) == 0)
+        return WS_OK;
+
+    for (face = 0; face != 6; ++face)
+    {
+        int32_t axis = face / 2;
+        int32_t u_axis = (axis + 1) % 3;
+        int32_t v_axis = (axis + 2) % 3;
+        size_t size = (size_t)dims[u_axis] * (size_t)dims[v_axis];
+        int32_t* map;
+        if ((simulation->pml_params.faces & (1u << face)) == 0)
+            continue;
+
+        map = MALLOC(sizeof(int32_t) * size);
+        if (map == NULL)
+        {
+            free_face_maps(face_maps);
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        }
+        face_maps[face] = map;
+        for (i = 0; i != size; ++i)
+            map[i] = -1;
+
+        for (i = 0; i != vector_count(&simulation->medium.partitions); ++i)
+        {
+            const medium_partition_t* partition = vector_get_element(&simulation->medium.partitions, i);
+            int32_t u, v;
+            if ((face & 1) ? partition->box[axis+3] != dims[axis] : partition->box[axis] != 0)
+                continue;
+            for (u = partition->box[u_axis]; u != partition->box[u_axis+3]; ++u)
+                for (v = partition->box[v_axis]; v != partition->box[v_axis+3]; ++v)
+                    map[u * dims[v_axis] + v] = (int32_t)i;
+        }
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Pressure index of the neighbour of a PML cell. Neighbours that aren't
+ * part of the PML or any partition are mirrored onto the cell itself, which
+ * makes the missing side behave like a rigid wall.
+ */
+static size_t
+pml_neighbour(const simulation_t* simulation, int32_t* const face_maps[6],
+              const int32_t cell[3], int32_t axis, int32_t dir, size_t self)
+{
+    const int32_t* dims = simulation->medium.grid_dims;
+    int32_t n[3];
+    int32_t u_axis = (axis + 1) % 3;
+    int32_t v_axis = (axis + 2) % 3;
+    int32_t partition_idx;
+    size_t idx;
+
+    memcpy(n, cell, sizeof(n));
+    n[axis] += dir;
+    if ((idx = pml_cell_index(simulation, n)) != NO_CELL)
+        return idx;
+
+    if (n[0] < 0 || n[0] >= dims[0] || n[1] < 0 || n[1] >= dims[1] || n[2] < 0 || n[2] >= dims[2])
+        return self;
+
+    /* Stepping in positive direction enters the grid through its negative face */
+    partition_idx = face_maps[2*axis + (dir > 0 ? 0 : 1)][n[u_axis] * dims[v_axis] + n[v_axis]];
+    if (partition_idx < 0)
+        return self;
+    return cell_index(simulation, (size_t)partition_idx, n);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Computes the neighbours and update coefficients of every PML cell. The
+ * absorption along an axis is zero inside the grid's range on that axis and
+ * grows polynomially with depth beyond it. Its maximum follows from the
+ * theoretical reflection coefficient R of a layer of thickness T,
+ * sigma_max = (order + 1) * c * ln(1/R) / (2 * T * h).
+ */
+static wsret
+build_pml(simulation_t* simulation, int32_t* const face_maps[6], wsreal_t sound_speed)
+{
+    simulation_pml_t* pml = &simulation->pml;
+    const simulation_pml_params_t* params = &simulation->pml_params;
+    const int32_t* dims = simulation->medium.grid_dims;
+    const wsreal_t* h = simulation->medium.grid_size.xyz;
+    wsreal_t dt = simulation->time_step;
+    wsreal_t sigma_max[3];
+    size_t n = pml->cell_count;
+    int axis;
+
+    if (n == 0)
+        return WS_OK;
+
+    pml->neighbours = MALLOC(sizeof(size_t) * 6 * n);
+    pml->split = MALLOC(sizeof(wsreal_t) * 3 * n);
+    pml->split_prev = MALLOC(sizeof(wsreal_t) * 3 * n);
+    pml->gain = MALLOC(sizeof(wsreal_t) * 3 * n);
+    pml->decay = MALLOC(sizeof(wsreal_t) * 3 * n);
+    pml->restore = MALLOC(sizeof(wsreal_t) * 3 * n);
+    if (pml->neighbours == NULL || pml->split == NULL || pml->split_prev == NULL ||
+        pml->gain == NULL || pml->decay == NULL || pml->restore == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    memset(pml->split, 0, sizeof(wsreal_t) * 3 * n);
+    memset(pml->split_prev, 0, sizeof(wsreal_t) * 3 * n);
+
+    for (axis = 0; axis != 3; ++axis)
+    {
+        pml->courant2[axis] = (sound_speed * dt / h[axis]) * (sound_speed * dt / h[axis]);
+        sigma_max[axis] = (params->profile_order + 1) * sound_speed * (wsreal_t)log(1 / params->reflection) /
+                          (2 * params->thickness * h[axis]);
+    }
+
+    VECTOR_FOR_EACH(&pml->slabs, simulation_pml_slab_t, slab)
+        int32_t cell[3];
+        for (cell[0] = slab->box[0]; cell[0] != slab->box[3]; ++cell[0])
+            for (cell[1] = slab->box[1]; cell[1] != slab->box[4]; ++cell[1])
+                for (cell[2] = slab->box[2]; cell[2] != slab->box[5]; ++cell[2])
+                {
+                    size_t self = pml_cell_index(simulation, cell);
+                    size_t i = self - simulation->cell_count;
+                    for (axis = 0; axis != 3; ++axis)
+                    {
+                        size_t j = 3*i + (size_t)axis;
+                        wsreal_t depth = 0;
+                        wsreal_t sigma_dt;
+                        pml->neighbours[6*i + 2*(size_t)axis]     = pml_neighbour(simulation, face_maps, cell, axis, -1, self);
+                        pml->neighbours[6*i + 2*(size_t)axis + 1] = pml_neighbour(simulation, face_maps, cell, axis, 1, self);
+
+                        /* Relative depth of the cell's center into the layer */
+                        if (cell[axis] < 0)
+                            depth = (-cell[axis] - (wsreal_t)0.5) / params->thickness;
+                        else if (cell[axis] >= dims[axis])
+                            depth = (cell[axis] - dims[axis] + (wsreal_t)0.5) / params->thickness;
+
+                        /* Beyond 1, the damping term overshoots and becomes unstable for values > 2 */
+                        sigma_dt = depth > 0 ? sigma_max[axis] * (wsreal_t)pow(depth, params->profile_order) * dt : 0;
+                        if (sigma_dt > 1)
+                            sigma_dt = 1;
+                        pml->gain[j] = 1 / (1 + sigma_dt);
+                        pml->decay[j] = (1 - sigma_dt) / (1 + sigma_dt);
+                        pml->restore[j] = 2 - sigma_dt * sigma_dt;
+                    }
+                }
+    VECTOR_END_EACH
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static wsret
+add_task(simulation_t* simulation, simulation_phase_e phase, simulation_task_e type,
+         size_t partition, size_t begin, size_t end)
+{
+    simulation_task_t* task = vector_emplace(&simulation->tasks[phase]);
+    if (task == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    task->simulation = simulation;
+    task->type = type;
+    task->partition = partition;
+    task->begin = begin;
+    task->end = end;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Adds one task per slab for splitting layer_count layers into slab_count
+ * slabs of nearly equal thickness.
+ */
+static wsret
+add_slab_tasks(simulation_t* simulation, simulation_phase_e phase, simulation_task_e type,
+               size_t partition, int32_t layer_count, size_t slab_count)
+{
+    size_t layers = (size_t)layer_count;
+    size_t s;
+    wsret result;
+
+    if (slab_count > layers)
+        slab_count = layers;
+    for (s = 0; s != slab_count; ++s)
+        if ((result = add_task(simulation, phase, type, partition,
+                               layers * s / slab_count, layers * (s + 1) / slab_count)) != WS_OK)
+            return result;
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Splits the work of a step into tasks. A single worker gets as few tasks
+ * as possible. Otherwise, the work of each phase is cut into pieces of
+ * around cell_count / (TASKS_PER_WORKER * worker_count) cells or terms.
+ * Interface terms are grouped by partition, so no two tasks write to the
+ * same forcing. Partitions larger than a piece are split into slabs.
+ */
+static wsret
+build_tasks(simulation_t* simulation, int worker_count)
+{
+    const simulation_interface_terms_t* terms = &simulation->interface_terms;
+    size_t partition_count = vector_count(&simulation->partitions);
+    size_t pml_count = simulation->pml.cell_count;
+    size_t task_size = (size_t)-1;
+    size_t begin, end, p;
+    wsret result;
+
+    if (worker_count > 1)
+    {
+        task_size = simulation->cell_count / ((size_t)worker_count * TASKS_PER_WORKER);
+        if (task_size < MIN_TASK_SIZE)
+            task_size = MIN_TASK_SIZE;
+    }
+
+    for (begin = 0, p = 0; p != partition_count; ++p)
+    {
+        if (terms->offsets[p+1] - terms->offsets[begin] < task_size && p + 1 != partition_count)
+            continue;
+        if (terms->offsets[p+1] != terms->offsets[begin])
+            if ((result = add_task(simulation, SIMULATION_PHASE_INTERFACES, SIMULATION_TASK_INTERFACE_TERMS,
+                                   0, terms->offsets[begin], terms->offsets[p+1])) != WS_OK)
+                return result;
+        begin = p + 1;
+    }
+
+    /* The PML's pressure is read during the interface phase and written later */
+    for (begin = 0; begin != pml_count; begin = end)
+    {
+        end = (pml_count - begin > task_size ? begin + task_size : pml_count);
+        if ((result = add_task(simulation, SIMULATION_PHASE_INTERFACES, SIMULATION_TASK_PML_FIELDS, 0, begin, end)) != WS_OK ||
+            (result = add_task(simulation, SIMULATION_PHASE_FORWARD, SIMULATION_TASK_PML_PRESSURE, 0, begin, end)) != WS_OK)
+            return result;
+    }
+
+    for (p = 0; p != partition_count; ++p)
+    {
+        const simulation_partition_t* part = vector_get_element(&simulation->partitions, p);
+        size_t slab_count = (part->count <= task_size ? 1 : (part->count - 1) / task_size + 1);
+        if (slab_count == 1)
+        {
+            if ((result = add_task(simulation, SIMULATION_PHASE_FORWARD, SIMULATION_TASK_PARTITION, p, 0, 0)) != WS_OK)
+                return result;
+            continue;
+        }
+
+        if ((result = add_slab_tasks(simulation, SIMULATION_PHASE_FORWARD, SIMULATION_TASK_SLAB_FORWARD,
+                                     p, part->dims[1], slab_count)) != WS_OK ||
+            (result = add_slab_tasks(simulation, SIMULATION_PHASE_MODES, SIMULATION_TASK_SLAB_MODES,
+                                     p, part->dims[0], slab_count)) != WS_OK ||
+            (result = add_slab_tasks(simulation, SIMULATION_PHASE_INVERSE, SIMULATION_TASK_SLAB_INVERSE,
+                                     p, part->dims[1], slab_count)) != WS_OK)
+            return result;
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Records which partition every cell of the grid belongs to, so positions
+ * can be looked up without searching the partitions. The map covers the
+ * medium's grid, or the partitions if they were added by hand and reach
+ * past it.
+ */
+static wsret
+build_cell_partitions(simulation_t* simulation)
+{
+    const medium_t* medium = &simulation->medium;
+    int32_t* dims = simulation->cell_partition_dims;
+    size_t count, i;
+
+    memcpy(dims, medium->grid_dims, sizeof(simulation->cell_partition_dims));
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        for (i = 0; i != 3; ++i)
+            if (partition->box[i+3] > dims[i])
+                dims[i] = partition->box[i+3];
+    VECTOR_END_EACH
+
+    count = (size_t)dims[0] * (size_t)dims[1] * (size_t)dims[2];
+    if ((simulation->cell_partitions = MALLOC(sizeof(int32_t) * count)) == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    for (i = 0; i != count; ++i)
+        simulation->cell_partitions[i] = -1;
+
+    for (i = 0; i != vector_count(&medium->partitions); ++i)
+    {
+        const medium_partition_t* partition = vector_get_element(&medium->partitions, i);
+        int32_t x, y, z;
+        for (x = partition->box[0]; x != partition->box[3]; ++x)
+            for (y = partition->box[1]; y != partition->box[4]; ++y)
+                for (z = partition->box[2]; z != partition->box[5]; ++z)
+                    simulation->cell_partitions[((size_t)x * (size_t)dims[1] + (size_t)y) * (size_t)dims[2] + (size_t)z] = (int32_t)i;
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+simulation_prepare(simulation_t* simulation)
+{
+    const medium_t* medium = &simulation->medium;
+    wsreal_t max_speed = 0;
+    wsreal_t min_speed = 0;
+    wsreal_t min_size, max_size;
+    size_t max_work = 0;
+    size_t offset = 0;
+    size_t total;
+    size_t i;
+    int32_t* face_maps[6] = {NULL, NULL, NULL, NULL, NULL, NULL};
+    int worker_count = (simulation->thread_count > 0 ? simulation->thread_count : thread_hardware_concurrency());
+    wsret result = WS_ERR_OUT_OF_MEMORY;
+
+    free_fields(simulation);
+    if (vector_count(&medium->partitions) == 0)
+        WSRET(WS_ERR_EMPTY_MEDIUM);
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        if (!(partition->sound_speed > 0))
+            WSRET(WS_ERR_INVALID_SOUND_SPEED);
+        if (min_speed == 0 || partition->sound_speed < min_speed)
+            min_speed = partition->sound_speed;
+    VECTOR_END_EACH
+
+    /* The shortest wavelength of interest must span enough cells */
+    max_size = medium->grid_size.v.x;
+    if (medium->grid_size.v.y > max_size) max_size = medium->grid_size.v.y;
+    if (medium->grid_size.v.z > max_size) max_size = medium->grid_size.v.z;
+    if (simulation->max_frequency > 0 &&
+        max_size * simulation->spatial_samples > min_speed / simulation->max_frequency)
+        WSRET(WS_ERR_GRID_TOO_COARSE);
+
+    if (simulation->dct_cache == NULL)
+    {
+        simulation->dct_cache = MALLOC(sizeof *simulation->dct_cache);
+        if (simulation->dct_cache == NULL)
+            WSRET(WS_ERR_OUT_OF_MEMORY);
+        dct_cache_construct(simulation->dct_cache);
+    }
+
+    if (vector_count(&medium->adjacency_offsets) != vector_count(&medium->partitions) + 1)
+        if ((result = medium_build_adjacency(&simulation->medium)) != WS_OK)
+            return result;
+
+    /* Lay the partitions out one after another */
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        simulation_partition_t* part = vector_emplace(&simulation->partitions);
+        if (part == NULL)
+            goto fail;
+        for (i = 0; i != 3; ++i)
+            part->dims[i] = partition->box[i+3] - partition->box[i];
+        /* Partitions of the same size share one plan */
+        if ((result = dct_cache_get_plan(simulation->dct_cache, part->dims, &part->dct)) != WS_OK)
+            goto fail;
+        if (part->dct->work_size > max_work)
+            max_work = part->dct->work_size;
+        part->offset = offset;
+        part->count = (size_t)part->dims[0] * (size_t)part->dims[1] * (size_t)part->dims[2];
+        offset += part->count;
+        if (partition->sound_speed > max_speed)
+            max_speed = partition->sound_speed;
+    VECTOR_END_EACH
+    simulation->cell_count = offset;
+
+    /* PML cells are stored after the cells of the partitions */
+    if ((result = layout_pml(simulation)) != WS_OK)
+        goto fail;
+    total = offset + simulation->pml.cell_count;
+
+    min_size = medium->grid_size.v.x;
+    if (medium->grid_size.v.y < min_size) min_size = medium->grid_size.v.y;
+    if (medium->grid_size.v.z < min_size) min_size = medium->grid_size.v.z;
+    simulation->time_step = (wsreal_t)MAX_COURANT_NUMBER * min_size / max_speed;
+
+    simulation->pressure = MALLOC(sizeof(wsreal_t) * total);
+    simulation->forcing = MALLOC(sizeof(wsreal_t) * offset);
+    simulation->modes = MALLOC(sizeof(wsreal_t) * offset);
+    simulation->modes_prev = MALLOC(sizeof(wsreal_t) * offset);
+    simulation->mode_cos = MALLOC(sizeof(wsreal_t) * offset);
+    simulation->mode_forcing = MALLOC(sizeof(wsreal_t) * offset);
+    simulation->scratch_size = max_work;
+    simulation->scratch = MALLOC(sizeof(wsreal_t) * max_work * (size_t)worker_count);
+    if (simulation->pressure == NULL || simulation->forcing == NULL ||
+        simulation->modes == NULL || simulation->modes_prev == NULL ||
+        simulation->mode_cos == NULL || simulation->mode_forcing == NULL ||
+        simulation->scratch == NULL)
+    {
+        result = WS_ERR_OUT_OF_MEMORY;
+        goto fail;
+    }
+
+    memset(simulation->pressure, 0, sizeof(wsreal_t) * total);
+    memset(simulation->forcing, 0, sizeof(wsreal_t) * offset);
+    memset(simulation->modes, 0, sizeof(wsreal_t) * offset);
+    memset(simulation->modes_prev, 0, sizeof(wsreal_t) * offset);
+    for (i = 0; i != vector_count(&medium->partitions); ++i)
+        compute_mode_coefficients(simulation,
+                                  vector_get_element(&simulation->partitions, i),
+                                  ((medium_partition_t*)vector_get_element(&medium->partitions, i))->sound_speed);
+    if ((result = build_interface_terms(simulation)) != WS_OK)
+        goto fail;
+    if ((result = build_cell_partitions(simulation)) != WS_OK)
+        goto fail;
+    if ((result = build_face_maps(simulation, face_maps)) != WS_OK)
+        goto fail;
+    if ((result = build_pml(simulation, face_maps, max_speed)) != WS_OK)
+        goto fail;
+    if ((result = build_tasks(simulation, worker_count)) != WS_OK)
+        goto fail;
+    if (worker_count > 1)
+        if ((result = thread_pool_create(&simulation->thread_pool, worker_count)) != WS_OK)
+            goto fail;
+
+    free_face_maps(face_maps);
+    return WS_OK;
+
+    fail : free_face_maps(face_maps);
+    free_fields(simulation);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Advances the modes of a partition's X layers [begin, end) by one step and
+ * transforms them back into pressure, except along X. The forcing must have
+ * been transformed along X already.
+ *
+ * The Y and Z transforms only mix cells within an X layer, so partitions
+ * can be split into slabs of layers along X here and into slabs along Y for
+ * the X transforms, see dct_forward_axis().
+ */
+static void
+update_modes(simulation_t* simulation, const simulation_partition_t* part, int32_t begin, int32_t end,
+             wsreal_t* scratch)
+{
+    size_t layer = (size_t)part->dims[1] * (size_t)part->dims[2];
+    size_t first = part->offset + (size_t)begin * layer;
+    size_t last = part->offset + (size_t)end * layer;
+    wsreal_t* pressure = simulation->pressure;
+    wsreal_t* forcing = simulation->forcing;
+    wsreal_t* modes = simulation->modes;
+    wsreal_t* modes_prev = simulation->modes_prev;
+    const wsreal_t* mode_cos = simulation->mode_cos;
+    const wsreal_t* mode_forcing = simulation->mode_forcing;
+    int has_forcing = 0;
+    size_t i;
+
+    /* Layers without sources and without waves reaching them save a transform */
+    for (i = first; i != last; ++i)
+        if (forcing[i] != 0)
+        {
+            has_forcing = 1;
+            break;
+        }
+
+    if (has_forcing)
+    {
+        dct_forward_axis(part->dct, forcing + part->offset, scratch, 1, begin, end);
+        dct_forward_axis(part->dct, forcing + part->offset, scratch, 2, begin, end);
+        for (i = first; i != last; ++i)
+        {
+            wsreal_t next = mode_cos[i] * modes[i] - modes_prev[i] + mode_forcing[i] * forcing[i];
+            modes_prev[i] = modes[i];
+            modes[i] = next;
+            forcing[i] = 0;
+        }
+    }
+    else
+    {
+        for (i = first; i != last; ++i)
+        {
+            wsreal_t next = mode_cos[i] * modes[i] - modes_prev[i];
+            modes_prev[i] = modes[i];
+            modes[i] = next;
+        }
+    }
+
+    memcpy(pressure + first, modes + first, sizeof(wsreal_t) * (last - first));
+    dct_inverse_axis(part->dct, pressure + part->offset, scratch, 2, begin, end);
+    dct_inverse_axis(part->dct, pressure + part->offset, scratch, 1, begin, end);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Advances all modes of a partition by one step and transforms them back
+ * into pressure. Partitions don't share any state, so they can be updated in
+ * any order.
+ */
+static void
+update_partition(simulation_t* simulation, const simulation_partition_t* part, wsreal_t* scratch)
+{
+    const wsreal_t* forcing = simulation->forcing + part->offset;
+    size_t i;
+
+    for (i = 0; i != part->count; ++i)
+        if (forcing[i] != 0)
+        {
+            dct_forward_axis(part->dct, simulation->forcing + part->offset, scratch, 0, 0, part->dims[1]);
+            break;
+        }
+    update_modes(simulation, part, 0, part->dims[0], scratch);
+    dct_inverse_axis(part->dct, simulation->pressure + part->offset, scratch, 0, 0, part->dims[1]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Adds the forcing of the interface terms [begin, end). This only reads
+ * pressure and writes forcing, so it must run before any partition is
+ * updated.
+ */
+static void
+apply_interface_terms(simulation_t* simulation, size_t begin, size_t end)
+{
+    const simulation_interface_terms_t* terms = &simulation->interface_terms;
+    const wsreal_t* pressure = simulation->pressure;
+    wsreal_t* forcing = simulation->forcing;
+    size_t i;
+
+    for (i = begin; i != end; ++i)
+        forcing[terms->target[i]] += terms->coefficient[i] * (pressure[terms->source[i]] - pressure[terms->mirror[i]]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Advances the split pressure of the PML cells [begin, end), reading the
+ * pressure of the current step from the layer and the medium. The results
+ * go to split_prev, which becomes the current split pressure once all cells
+ * are done, see swap_pml_fields().
+ */
+static void
+update_pml_fields(simulation_t* simulation, size_t begin, size_t end)
+{
+    simulation_pml_t* pml = &simulation->pml;
+    const wsreal_t* pressure = simulation->pressure;
+    const wsreal_t* pml_pressure = simulation->pressure + simulation->cell_count;
+    const wsreal_t* c2 = pml->courant2;
+    size_t i;
+
+    for (i = begin; i != end; ++i)
+    {
+        const size_t* nb = pml->neighbours + 6*i;
+        const wsreal_t* split = pml->split + 3*i;
+        wsreal_t* next = pml->split_prev + 3*i;
+        const wsreal_t* gain = pml->gain + 3*i;
+        const wsreal_t* decay = pml->decay + 3*i;
+        const wsreal_t* restore = pml->restore + 3*i;
+        wsreal_t p2 = 2 * pml_pressure[i];
+
+        next[0] = gain[0] * (restore[0] * split[0] + c2[0] * (pressure[nb[0]] - p2 + pressure[nb[1]])) - decay[0] * next[0];
+        next[1] = gain[1] * (restore[1] * split[1] + c2[1] * (pressure[nb[2]] - p2 + pressure[nb[3]])) - decay[1] * next[1];
+        next[2] = gain[2] * (restore[2] * split[2] + c2[2] * (pressure[nb[4]] - p2 + pressure[nb[5]])) - decay[2] * next[2];
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+swap_pml_fields(simulation_t* simulation)
+{
+    wsreal_t* swap = simulation->pml.split;
+    simulation->pml.split = simulation->pml.split_prev;
+    simulation->pml.split_prev = swap;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Sums up the split pressure of the PML cells [begin, end). This must not
+ * run while the interface terms or the PML fields are evaluated, both read
+ * the pressure of the layer.
+ */
+static void
+update_pml_pressure(simulation_t* simulation, size_t begin, size_t end)
+{
+    const wsreal_t* split = simulation->pml.split;
+    wsreal_t* pml_pressure = simulation->pressure + simulation->cell_count;
+    size_t i;
+
+    for (i = begin; i != end; ++i)
+        pml_pressure[i] = split[3*i] + split[3*i+1] + split[3*i+2];
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+run_task(void* arg, int worker)
+{
+    const simulation_task_t* task = arg;
+    simulation_t* simulation = task->simulation;
+    const simulation_partition_t* part = vector_get_element(&simulation->partitions, task->partition);
+    wsreal_t* scratch = simulation->scratch + (size_t)worker * simulation->scratch_size;
+    int32_t begin = (int32_t)task->begin;
+    int32_t end = (int32_t)task->end;
+
+    switch (task->type)
+    {
+        case SIMULATION_TASK_INTERFACE_TERMS : apply_interface_terms(simulation, task->begin, task->end); break;
+        case SIMULATION_TASK_PML_FIELDS      : update_pml_fields(simulation, task->begin, task->end); break;
+        case SIMULATION_TASK_PML_PRESSURE    : update_pml_pressure(simulation, task->begin, task->end); break;
+        case SIMULATION_TASK_PARTITION       : update_partition(simulation, part, scratch); break;
+        case SIMULATION_TASK_SLAB_FORWARD    :
+            dct_forward_axis(part->dct, simulation->forcing + part->offset, scratch, 0, begin, end);
+            break;
+        case SIMULATION_TASK_SLAB_MODES      : update_modes(simulation, part, begin, end, scratch); break;
+        case SIMULATION_TASK_SLAB_INVERSE    :
+            dct_inverse_axis(part->dct, simulation->pressure + part->offset, scratch, 0, begin, end);
+            break;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Runs all tasks of a phase and waits for them to finish.
+ */
+static wsret
+run_phase(simulation_t* simulation, simulation_phase_e phase)
+{
+    wsret result = WS_OK;
+
+    if (simulation->thread_pool == NULL)
+    {
+        VECTOR_FOR_EACH(&simulation->tasks[phase], simulation_task_t, task)
+            run_task(task, 0);
+        VECTOR_END_EACH
+        return WS_OK;
+    }
+
+    VECTOR_FOR_EACH(&simulation->tasks[phase], simulation_task_t, task)
+        if ((result = thread_pool_submit(simulation->thread_pool, run_task, task)) != WS_OK)
+            break;
+    VECTOR_END_EACH
+
+    /* Even if queueing failed, the tasks that made it in have to finish */
+    thread_pool_wait(simulation->thread_pool);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+simulation_step(simulation_t* simulation, int step_count)
+{
+    wsret result;
+    int phase;
+
+    if (simulation->pressure == NULL)
+        WSRET(WS_ERR_NOT_PREPARED);
+
+    for (; step_count > 0; --step_count)
+    {
+        for (phase = 0; phase != SIMULATION_PHASE_COUNT; ++phase)
+        {
+            if ((result = run_phase(simulation, (simulation_phase_e)phase)) != WS_OK)
+                return result;
+            if (phase == SIMULATION_PHASE_INTERFACES)
+                swap_pml_fields(simulation);
+        }
+        simulation->step_count++;
+    }
+
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+simulation_set_initial_pressure(simulation_t* simulation,
+                                wsreal_t (*pressure)(void* user_data, const wsreal_t position[3]),
+                                void* user_data)
+{
+    const medium_t* medium = &simulation->medium;
+    size_t p, i;
+
+    if (simulation->pressure == NULL)
+        WSRET(WS_ERR_NOT_PREPARED);
+
+    for (p = 0; p != vector_count(&simulation->partitions); ++p)
+    {
+        const simulation_partition_t* part = vector_get_element(&simulation->partitions, p);
+        const medium_partition_t* partition = vector_get_element(&medium->partitions, p);
+        aabb_t bb = medium_partition_aabb(medium, partition);
+        int32_t x, y, z;
+
+        for (x = 0; x != part->dims[0]; ++x)
+            for (y = 0; y != part->dims[1]; ++y)
+                for (z = 0; z != part->dims[2]; ++z)
+                {
+                    wsreal_t center[3];
+                    center[0] = AABB_AX(bb) + (x + (wsreal_t)0.5) * medium->grid_size.v.x;
+                    center[1] = AABB_AY(bb) + (y + (wsreal_t)0.5) * medium->grid_size.v.y;
+                    center[2] = AABB_AZ(bb) + (z + (wsreal_t)0.5) * medium->grid_size.v.z;
+                    simulation->pressure[part->offset + LOCAL_INDEX(part, x, y, z)] = pressure(user_data, center);
+                }
+
+        memcpy(simulation->modes + part->offset, simulation->pressure + part->offset, sizeof(wsreal_t) * part->count);
+        dct_forward(part->dct, simulation->modes + part->offset, simulation->scratch);
+    }
+
+    /* The PML starts at rest with zero pressure */
+    if (simulation->pml.cell_count != 0)
+    {
+        memset(simulation->pressure + simulation->cell_count, 0, sizeof(wsreal_t) * simulation->pml.cell_count);
+        memset(simulation->pml.split, 0, sizeof(wsreal_t) * 3 * simulation->pml.cell_count);
+        memset(simulation->pml.split_prev, 0, sizeof(wsreal_t) * 3 * simulation->pml.cell_count);
+    }
+
+    /*
+     * Starting at rest means the modes are the same one step before and one
+     * step after the start, m(-dt) = m(dt). Together with the update this
+     * gives m(-dt) = cos(w*dt) * m(0) + mode_forcing/2 * f(0), where f(0)
+     * is the interface forcing of the initial pressure.
+     */
+    memset(simulation->forcing, 0, sizeof(wsreal_t) * simulation->cell_count);
+    apply_interface_terms(simulation, 0, simulation->interface_terms.count);
+    VECTOR_FOR_EACH(&simulation->partitions, simulation_partition_t, part)
+        dct_forward(part->dct, simulation->forcing + part->offset, simulation->scratch);
+        for (i = part->offset; i != part->offset + part->count; ++i)
+            simulation->modes_prev[i] = (simulation->modes[i] * simulation->mode_cos[i] +
+                                         simulation->mode_forcing[i] * simulation->forcing[i]) * (wsreal_t)0.5;
+    VECTOR_END_EACH
+
+    memset(simulation->forcing, 0, sizeof(wsreal_t) * simulation->cell_count);
+    simulation->step_count = 0;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Looks up the cell containing a world space position and writes its index
+ * in the field arrays to cell. Returns WS_ERR_OUTSIDE_MEDIUM if the position
+ * lies outside of the grid or in a cell no partition covers.
+ */
+static wsret
+find_cell(const simulation_t* simulation, const wsreal_t position[3], size_t* cell)
+{
+    const medium_t* medium = &simulation->medium;
+    const int32_t* dims = simulation->cell_partition_dims;
+    const medium_partition_t* partition;
+    const simulation_partition_t* part;
+    int32_t c[3], p;
+    int i;
+
+    if (simulation->pressure == NULL)
+        WSRET(WS_ERR_NOT_PREPARED);
+
+    for (i = 0; i != 3; ++i)
+    {
+        wsreal_t rel = (position[i] - medium->boundary.b.min.xyz[i]) / medium->grid_size.xyz[i];
+        if (!(rel >= 0 && rel < dims[i]))
+            WSRET(WS_ERR_OUTSIDE_MEDIUM);
+        c[i] = (int32_t)rel;
+    }
+
+    p = simulation->cell_partitions[((size_t)c[0] * (size_t)dims[1] + (size_t)c[1]) * (size_t)dims[2] + (size_t)c[2]];
+    if (p < 0)
+        WSRET(WS_ERR_OUTSIDE_MEDIUM);
+    partition = vector_get_element(&medium->partitions, (size_t)p);
+    part = vector_get_element(&simulation->partitions, (size_t)p);
+    *cell = part->offset + LOCAL_INDEX(part,
+                                       c[0] - partition->box[0],
+                                       c[1] - partition->box[1],
+                                       c[2] - partition->box[2]);
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+simulation_add_impulse(simulation_t* simulation, const wsreal_t position[3], wsreal_t amplitude)
+{
+    size_t cell;
+    wsret result = find_cell(simulation, position, &cell);
+    if (result != WS_OK)
+        return result;
+    simulation->forcing[cell] += amplitude;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+simulation_pressure_at(const simulation_t* simulation, const wsreal_t position[3], wsreal_t* pressure)
+{
+    size_t cell;
+    wsret result = find_cell(simulation, position, &cell);
+    if (result != WS_OK)
+        return result;
+    *pressure = simulation->pressure[cell];
+    return WS_OK;
+}
@@ -0,0 +1,257 @@
+#include "wavesim/thread_pool.h"
+#include "wavesim/memory.h"
+#include <assert.h>
+#include <string.h>
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Takes a task from the back of the worker's own queue or, if that is empty,
+ * from the front of another worker's queue. Returns 0 if all queues are
+ * empty. Since tasks can only be submitted by the pool's owner, the queues
+ * stay empty until the owner submits the next batch.
+ */
+static int
+take_task(thread_pool_t* pool, int worker, thread_pool_task_t* task)
+{
+    int i;
+
+    for (i = 0; i != pool->worker_count; ++i)
+    {
+        thread_pool_queue_t* queue = &pool->queues[(worker + i) % pool->worker_count];
+        int found = 0;
+
+        mutex_lock(queue->lock);
+        if (queue->head != vector_count(&queue->tasks))
+        {
+            if (i == 0)
+                *task = *(thread_pool_task_t*)vector_pop(&queue->tasks);
+            else
+                *task = *(thread_pool_task_t*)vector_get_element(&queue->tasks, queue->head++);
+            if (queue->head == vector_count(&queue->tasks))
+            {
+                vector_clear(&queue->tasks);
+                queue->head = 0;
+            }
+            found = 1;
+        }
+        mutex_unlock(queue->lock);
+
+        if (found)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Runs tasks until all queues are empty and returns how many it ran.
+ */
+static size_t
+run_tasks(thread_pool_t* pool, int worker)
+{
+    thread_pool_task_t task;
+    size_t count = 0;
+
+    while (take_task(pool, worker, &task))
+    {
+        task.func(task.arg, worker);
+        ++count;
+    }
+
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Marks tasks as finished. The caller must hold pool->lock.
+ */
+static void
+finish_tasks(thread_pool_t* pool, size_t count)
+{
+    pool->pending -= count;
+    if (pool->pending == 0)
+        cond_broadcast(pool->batch_done);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+worker_main(void* arg)
+{
+    thread_pool_queue_t* queue = arg;
+    thread_pool_t* pool = queue->pool;
+    int worker = (int)(queue - pool->queues);
+    unsigned batch = 0; /* Pools start at batch 0 */
+
+    mutex_lock(pool->lock);
+    for (;;)
+    {
+        size_t count;
+        while (pool->batch == batch && !pool->shutdown)
+            cond_wait(pool->batch_started, pool->lock);
+        if (pool->shutdown)
+            break;
+        batch = pool->batch;
+
+        mutex_unlock(pool->lock);
+        count = run_tasks(pool, worker);
+        mutex_lock(pool->lock);
+        finish_tasks(pool, count);
+    }
+    mutex_unlock(pool->lock);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * Shuts down the threads of workers 1 up to, but excluding, end.
+ */
+static void
+stop_workers(thread_pool_t* pool, int end)
+{
+    int i;
+
+    mutex_lock(pool->lock);
+    pool->shutdown = 1;
+    cond_broadcast(pool->batch_started);
+    mutex_unlock(pool->lock);
+
+    for (i = 1; i < end; ++i)
+        thread_join(pool->threads[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+free_pool(thread_pool_t* pool)
+{
+    int i;
+
+    if (pool->queues != NULL)
+    {
+        for (i = 0; i != pool->worker_count; ++i)
+        {
+            if (pool->queues[i].lock != NULL)
+                mutex_destroy(pool->queues[i].lock);
+            vector_clear_free(&pool->queues[i].tasks);
+        }
+        FREE(pool->queues);
+    }
+    if (pool->threads != NULL)
+        FREE(pool->threads);
+    if (pool->batch_done != NULL)
+        cond_destroy(pool->batch_done);
+    if (pool->batch_started != NULL)
+        cond_destroy(pool->batch_started);
+    if (pool->lock != NULL)
+        mutex_destroy(pool->lock);
+    FREE(pool);
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+thread_pool_create(thread_pool_t** pool_out, int worker_count)
+{
+    thread_pool_t* pool;
+    wsret result = WS_ERR_OUT_OF_MEMORY;
+    int i;
+
+    assert(worker_count > 0);
+
+    pool = MALLOC(sizeof *pool);
+    if (pool == NULL)
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    memset(pool, 0, sizeof *pool);
+    pool->worker_count = worker_count;
+
+    pool->queues = MALLOC(sizeof(thread_pool_queue_t) * (size_t)worker_count);
+    pool->threads = MALLOC(sizeof(thread_t*) * (size_t)worker_count);
+    if (pool->queues == NULL || pool->threads == NULL)
+        goto fail;
+    for (i = 0; i != worker_count; ++i)
+    {
+        pool->queues[i].pool = pool;
+        pool->queues[i].lock = NULL;
+        pool->queues[i].head = 0;
+        vector_construct(&pool->queues[i].tasks, sizeof(thread_pool_task_t));
+        pool->threads[i] = NULL;
+    }
+    for (i = 0; i != worker_count; ++i)
+        if ((pool->queues[i].lock = mutex_create()) == NULL)
+            goto fail;
+    pool->lock = mutex_create();
+    pool->batch_started = cond_create();
+    pool->batch_done = cond_create();
+    if (pool->lock == NULL || pool->batch_started == NULL || pool->batch_done == NULL)
+        goto fail;
+
+    for (i = 1; i < worker_count; ++i)
+        if ((result = thread_start(&pool->threads[i], worker_main, &pool->queues[i])) != WS_OK)
+        {
+            stop_workers(pool, i);
+            goto fail;
+        }
+
+    *pool_out = pool;
+    return WS_OK;
+
+    fail : free_pool(pool);
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+thread_pool_destroy(thread_pool_t* pool)
+{
+    stop_workers(pool, pool->worker_count);
+    free_pool(pool);
+}
+
+/* ------------------------------------------------------------------------- */
+wsret
+thread_pool_submit(thread_pool_t* pool, thread_pool_func func, void* arg)
+{
+    thread_pool_queue_t* queue = &pool->queues[pool->next_queue];
+    thread_pool_task_t task;
+    size_t index;
+
+    task.func = func;
+    task.arg = arg;
+
+    /* Count the task first, a busy worker may finish it before we return */
+    mutex_lock(pool->lock);
+    pool->pending++;
+    mutex_unlock(pool->lock);
+
+    mutex_lock(queue->lock);
+    index = vector_push(&queue->tasks, &task);
+    mutex_unlock(queue->lock);
+    if (index == VECTOR_ERROR)
+    {
+        mutex_lock(pool->lock);
+        finish_tasks(pool, 1);
+        mutex_unlock(pool->lock);
+        WSRET(WS_ERR_OUT_OF_MEMORY);
+    }
+
+    pool->next_queue = (pool->next_queue + 1) % pool->worker_count;
+    return WS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+thread_pool_wait(thread_pool_t* pool)
+{
+    size_t count;
+
+    mutex_lock(pool->lock);
+    pool->batch++;
+    cond_broadcast(pool->batch_started);
+    mutex_unlock(pool->lock);
+
+    count = run_tasks(pool, 0);
+
+    mutex_lock(pool->lock);
+    finish_tasks(pool, count);
+    while (pool->pending != 0)
+        cond_wait(pool->batch_done, pool->lock);
+    mutex_unlock(pool->lock);
+}
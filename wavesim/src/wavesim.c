@@ -1,4 +1,5 @@
 #include "wavesim/wavesim.h"
+#include "wavesim/intersections.h"
 #include "wavesim/memory.h"
 #include "wavesim/log.h"
 
@@ -20,6 +21,13 @@ wavesim_init()
     log_construct(&g_ws_log);
     ws_log_info(&g_ws_log, "Initializing WaveSim...");
 
+    switch (intersect_select_simd(CPU_SIMD_AVX))
+    {
+        case CPU_SIMD_AVX  : ws_log_info(&g_ws_log, "Using AVX for bounding box tests"); break;
+        case CPU_SIMD_SSE2 : ws_log_info(&g_ws_log, "Using SSE2 for bounding box tests"); break;
+        case CPU_SIMD_NONE : break;
+    }
+
     g_was_initialised = 1;
     return 0;
 }
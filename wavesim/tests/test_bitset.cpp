@@ -0,0 +1,102 @@
+#include "gmock/gmock.h"
+#include "wavesim/bitset.h"
+
+#define NAME bitset
+
+using namespace ::testing;
+
+TEST(NAME, construct_is_empty)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    EXPECT_THAT(bitset_count(&b), Eq(0u));
+    EXPECT_THAT(b.data, IsNull());
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, resize_resets_all_bits)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 130), Eq(WS_OK));
+    EXPECT_THAT(bitset_count(&b), Eq(130u));
+    for (size_t i = 0; i != 130; ++i)
+        EXPECT_THAT(bitset_test(&b, i), Eq(0u));
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, set_and_unset_single_bits)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 100), Eq(WS_OK));
+    bitset_set(&b, 0);
+    bitset_set(&b, 63);
+    bitset_set(&b, 64);
+    bitset_set(&b, 99);
+    EXPECT_THAT(bitset_test(&b, 0), Eq(1u));
+    EXPECT_THAT(bitset_test(&b, 1), Eq(0u));
+    EXPECT_THAT(bitset_test(&b, 63), Eq(1u));
+    EXPECT_THAT(bitset_test(&b, 64), Eq(1u));
+    EXPECT_THAT(bitset_test(&b, 99), Eq(1u));
+    bitset_unset(&b, 63);
+    EXPECT_THAT(bitset_test(&b, 63), Eq(0u));
+    EXPECT_THAT(bitset_test(&b, 64), Eq(1u));
+    bitset_reset(&b);
+    EXPECT_THAT(bitset_test(&b, 64), Eq(0u));
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, set_range_within_one_word)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 64), Eq(WS_OK));
+    bitset_set_range(&b, 3, 7);
+    for (size_t i = 0; i != 64; ++i)
+        EXPECT_THAT(bitset_test(&b, i), Eq(i >= 3 && i < 7 ? 1u : 0u)) << i;
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, set_range_across_words)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 300), Eq(WS_OK));
+    bitset_set_range(&b, 60, 200);
+    for (size_t i = 0; i != 300; ++i)
+        EXPECT_THAT(bitset_test(&b, i), Eq(i >= 60 && i < 200 ? 1u : 0u)) << i;
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, any_in_range)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 300), Eq(WS_OK));
+    bitset_set(&b, 150);
+    EXPECT_THAT(bitset_any_in_range(&b, 0, 150), Eq(0));
+    EXPECT_THAT(bitset_any_in_range(&b, 151, 300), Eq(0));
+    EXPECT_THAT(bitset_any_in_range(&b, 150, 151), Ne(0));
+    EXPECT_THAT(bitset_any_in_range(&b, 10, 290), Ne(0));
+    EXPECT_THAT(bitset_any_in_range(&b, 128, 192), Ne(0));
+    EXPECT_THAT(bitset_any_in_range(&b, 20, 20), Eq(0));
+    bitset_clear_free(&b);
+}
+
+TEST(NAME, find_unset)
+{
+    bitset_t b;
+    bitset_construct(&b);
+    ASSERT_THAT(bitset_resize(&b, 200), Eq(WS_OK));
+    EXPECT_THAT(bitset_find_unset(&b, 0), Eq(0u));
+    EXPECT_THAT(bitset_find_unset(&b, 70), Eq(70u));
+    bitset_set_range(&b, 0, 130);
+    EXPECT_THAT(bitset_find_unset(&b, 0), Eq(130u));
+    EXPECT_THAT(bitset_find_unset(&b, 64), Eq(130u));
+    EXPECT_THAT(bitset_find_unset(&b, 131), Eq(131u));
+    bitset_set_range(&b, 130, 200);
+    EXPECT_THAT(bitset_find_unset(&b, 0), Eq(200u));
+    EXPECT_THAT(bitset_find_unset(&b, 250), Eq(200u));
+    bitset_clear_free(&b);
+}
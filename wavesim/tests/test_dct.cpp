@@ -0,0 +1,175 @@
+#include "gmock/gmock.h"
+#include "wavesim/dct.h"
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#define NAME dct
+
+using namespace ::testing;
+
+static std::vector<wsreal_t>
+random_values(size_t count)
+{
+    std::vector<wsreal_t> values(count);
+    srand(42);
+    for (size_t i = 0; i != count; ++i)
+        values[i] = (wsreal_t)rand() / RAND_MAX - 0.5;
+    return values;
+}
+
+static double
+basis(int32_t n, int32_t k, int32_t i)
+{
+    return std::sqrt((k == 0 ? 1.0 : 2.0) / n) * std::cos(M_PI * k * (i + 0.5) / n);
+}
+
+TEST(NAME, auto_method_depends_on_length)
+{
+    int32_t lengths[] = {1, 8, 16, 12, 11, 22, 49, 1024};
+    dct_method_e expected[] = {DCT_DIRECT, DCT_DIRECT, DCT_FFT, DCT_FFT, DCT_DIRECT, DCT_DIRECT, DCT_FFT, DCT_FFT};
+    for (int i = 0; i != 8; ++i)
+    {
+        dct_plan_1d_t plan;
+        ASSERT_THAT(dct_plan_1d_construct(&plan, lengths[i], DCT_AUTO), Eq(WS_OK));
+        EXPECT_THAT(plan.method, Eq(expected[i])) << lengths[i];
+        dct_plan_1d_destruct(&plan);
+    }
+}
+
+TEST(NAME, forward_matches_definition)
+{
+    int32_t n = 48;
+    dct_plan_1d_t plan;
+    ASSERT_THAT(dct_plan_1d_construct(&plan, n, DCT_FFT), Eq(WS_OK));
+    std::vector<wsreal_t> in = random_values(n), out(n);
+    std::vector<wsreal_t> work(dct_plan_1d_work_size(&plan));
+    dct_1d_forward(&plan, in.data(), out.data(), work.data());
+
+    for (int32_t k = 0; k != n; ++k)
+    {
+        double expected = 0;
+        for (int32_t i = 0; i != n; ++i)
+            expected += basis(n, k, i) * in[i];
+        EXPECT_THAT(out[k], DoubleNear(expected, 1e-12)) << k;
+    }
+    dct_plan_1d_destruct(&plan);
+}
+
+TEST(NAME, fft_matches_direct_for_all_lengths)
+{
+    for (int32_t n = 1; n <= 100; ++n)
+    {
+        dct_plan_1d_t direct, fast;
+        ASSERT_THAT(dct_plan_1d_construct(&direct, n, DCT_DIRECT), Eq(WS_OK));
+        ASSERT_THAT(dct_plan_1d_construct(&fast, n, DCT_FFT), Eq(WS_OK));
+        std::vector<wsreal_t> in = random_values(n), a(n), b(n), back(n);
+        std::vector<wsreal_t> work(dct_plan_1d_work_size(&fast));
+
+        dct_1d_forward(&direct, in.data(), a.data(), NULL);
+        dct_1d_forward(&fast, in.data(), b.data(), work.data());
+        for (int32_t k = 0; k != n; ++k)
+            ASSERT_THAT(b[k], DoubleNear(a[k], 1e-12)) << "n=" << n << ", k=" << k;
+
+        dct_1d_inverse(&direct, a.data(), back.data(), NULL);
+        dct_1d_inverse(&fast, a.data(), b.data(), work.data());
+        for (int32_t i = 0; i != n; ++i)
+        {
+            ASSERT_THAT(b[i], DoubleNear(back[i], 1e-12)) << "n=" << n << ", i=" << i;
+            ASSERT_THAT(back[i], DoubleNear(in[i], 1e-12)) << "n=" << n << ", i=" << i;
+        }
+
+        dct_plan_1d_destruct(&direct);
+        dct_plan_1d_destruct(&fast);
+    }
+}
+
+TEST(NAME, block_transform_is_separable)
+{
+    dct_cache_t cache;
+    const dct_plan_t* plan;
+    int32_t dims[3] = {4, 3, 10};
+    dct_cache_construct(&cache);
+    ASSERT_THAT(dct_cache_get_plan(&cache, dims, &plan), Eq(WS_OK));
+
+    std::vector<wsreal_t> in = random_values(4 * 3 * 10), data = in;
+    std::vector<wsreal_t> work(plan->work_size);
+    dct_forward(plan, data.data(), work.data());
+
+    for (int32_t kx = 0; kx != dims[0]; ++kx)
+        for (int32_t ky = 0; ky != dims[1]; ++ky)
+            for (int32_t kz = 0; kz != dims[2]; ++kz)
+            {
+                double expected = 0;
+                for (int32_t x = 0; x != dims[0]; ++x)
+                    for (int32_t y = 0; y != dims[1]; ++y)
+                        for (int32_t z = 0; z != dims[2]; ++z)
+                            expected += basis(dims[0], kx, x) * basis(dims[1], ky, y) * basis(dims[2], kz, z) *
+                                        in[(x * dims[1] + y) * dims[2] + z];
+                EXPECT_THAT(data[(kx * dims[1] + ky) * dims[2] + kz], DoubleNear(expected, 1e-12));
+            }
+
+    dct_inverse(plan, data.data(), work.data());
+    for (size_t i = 0; i != in.size(); ++i)
+        EXPECT_THAT(data[i], DoubleNear(in[i], 1e-12));
+
+    dct_cache_clear_free(&cache);
+}
+
+TEST(NAME, cache_shares_plans_of_same_size)
+{
+    dct_cache_t cache;
+    const dct_plan_t *a, *b, *c;
+    int32_t dims_a[3] = {4, 16, 1};
+    int32_t dims_b[3] = {1, 16, 4};
+    dct_cache_construct(&cache);
+    ASSERT_THAT(dct_cache_get_plan(&cache, dims_a, &a), Eq(WS_OK));
+    ASSERT_THAT(dct_cache_get_plan(&cache, dims_b, &b), Eq(WS_OK));
+    ASSERT_THAT(dct_cache_get_plan(&cache, dims_a, &c), Eq(WS_OK));
+
+    EXPECT_THAT(c, Eq(a));
+    EXPECT_THAT(b, Ne(a));
+    EXPECT_THAT(vector_count(&cache.plans), Eq(2u));
+    EXPECT_THAT(vector_count(&cache.plans_1d), Eq(3u));
+    EXPECT_THAT(a->axes[0], Eq(b->axes[2]));
+    EXPECT_THAT(a->axes[1], Eq(b->axes[1]));
+    EXPECT_THAT(a->axes[2], Eq(b->axes[0]));
+
+    dct_cache_clear_free(&cache);
+}
+
+TEST(NAME, axis_passes_in_slabs_match_block_transform)
+{
+    dct_cache_t cache;
+    const dct_plan_t* plan;
+    int32_t dims[3] = {6, 9, 16};
+    dct_cache_construct(&cache);
+    ASSERT_THAT(dct_cache_get_plan(&cache, dims, &plan), Eq(WS_OK));
+
+    std::vector<wsreal_t> whole = random_values(6 * 9 * 16), slabs = whole;
+    std::vector<wsreal_t> work(plan->work_size);
+    dct_forward(plan, whole.data(), work.data());
+
+    /* X lines in slabs of Y layers, Y and Z lines in slabs of X layers */
+    dct_forward_axis(plan, slabs.data(), work.data(), 0, 0, 4);
+    dct_forward_axis(plan, slabs.data(), work.data(), 0, 4, 9);
+    for (int axis = 1; axis != 3; ++axis)
+    {
+        dct_forward_axis(plan, slabs.data(), work.data(), axis, 0, 1);
+        dct_forward_axis(plan, slabs.data(), work.data(), axis, 1, 6);
+    }
+    for (size_t i = 0; i != whole.size(); ++i)
+        ASSERT_THAT(slabs[i], DoubleEq(whole[i])) << i;
+
+    dct_inverse(plan, whole.data(), work.data());
+    for (int axis = 2; axis != 0; --axis)
+    {
+        dct_inverse_axis(plan, slabs.data(), work.data(), axis, 0, 3);
+        dct_inverse_axis(plan, slabs.data(), work.data(), axis, 3, 6);
+    }
+    dct_inverse_axis(plan, slabs.data(), work.data(), 0, 0, 9);
+    for (size_t i = 0; i != whole.size(); ++i)
+        ASSERT_THAT(slabs[i], DoubleEq(whole[i])) << i;
+
+    dct_cache_clear_free(&cache);
+}
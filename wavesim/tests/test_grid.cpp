@@ -0,0 +1,244 @@
+#include "gmock/gmock.h"
+#include "wavesim/grid.h"
+#include "wavesim/face.h"
+#include "wavesim/intersections.h"
+#include "wavesim/mesh.h"
+#include "wavesim/obj.h"
+#include "utils.hpp"
+
+#define NAME grid
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        grid_construct(&g);
+        mesh_create(&m);
+        mesh_cube(m, aabb(-1, -1, -1, 1, 1, 1));
+    }
+
+    virtual void TearDown()
+    {
+        grid_destruct(&g);
+        mesh_destroy(m);
+    }
+
+protected:
+    grid_t g;
+    mesh_t* m;
+};
+
+TEST_F(NAME, dimensions_cover_boundary)
+{
+    vec3_t cell_size = vec3(0.5, 0.25, 1);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    EXPECT_THAT(g.dims[0], Eq(4));
+    EXPECT_THAT(g.dims[1], Eq(8));
+    EXPECT_THAT(g.dims[2], Eq(2));
+    EXPECT_THAT(grid_cell_count(&g), Eq(64u));
+}
+
+TEST_F(NAME, partial_cells_are_not_part_of_grid)
+{
+    vec3_t cell_size = vec3(0.75, 0.75, 0.75);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    EXPECT_THAT(g.dims[0], Eq(2));
+    EXPECT_THAT(g.dims[1], Eq(2));
+    EXPECT_THAT(g.dims[2], Eq(2));
+}
+
+TEST_F(NAME, cell_aabb_does_not_drift)
+{
+    vec3_t cell_size = vec3(0.1, 0.1, 0.1);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(g.dims[0], Eq(20));
+    aabb_t last = grid_cell_aabb(&g, 19, 19, 19);
+    EXPECT_THAT(AABB_BX(last), DoubleNear(1, 1e-12));
+    EXPECT_THAT(AABB_BY(last), DoubleNear(1, 1e-12));
+    EXPECT_THAT(AABB_BZ(last), DoubleNear(1, 1e-12));
+}
+
+TEST_F(NAME, cell_at_rounds_to_nearest_corner)
+{
+    vec3_t cell_size = vec3(0.5, 0.5, 0.5);
+    int32_t cell[3];
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    vec3_t p = vec3(-0.5 - 1e-9, 0.0 + 1e-9, 0.5);
+    grid_cell_at(&g, cell, p.xyz);
+    EXPECT_THAT(cell[0], Eq(1));
+    EXPECT_THAT(cell[1], Eq(2));
+    EXPECT_THAT(cell[2], Eq(3));
+}
+
+TEST_F(NAME, interior_cells_are_air)
+{
+    vec3_t cell_size = vec3(0.5, 0.5, 0.5);
+    attribute_t air;
+    attribute_set_default_air(&air);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    EXPECT_THAT(attribute_is_same(grid_cell_attribute(&g, 1, 1, 1), &air), Ne(0));
+    EXPECT_THAT(attribute_is_same(grid_cell_attribute(&g, 2, 2, 2), &air), Ne(0));
+    EXPECT_THAT(attribute_is_same(grid_cell_attribute(&g, 1, 2, 1), &air), Ne(0));
+}
+
+TEST_F(NAME, surface_cells_match_brute_force)
+{
+    /* Cell size doesn't divide the cube evenly, so faces cut through cells */
+    vec3_t cell_size = vec3(0.3, 0.35, 0.4);
+    aabb_t boundary = aabb(-1.3, -1.2, -1.25, 1.4, 1.3, 1.2);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, boundary.xyzxyz, cell_size.xyz), Eq(WS_OK));
+
+    int surface_cells = 0;
+    for (int32_t x = 0; x != g.dims[0]; ++x)
+        for (int32_t y = 0; y != g.dims[1]; ++y)
+            for (int32_t z = 0; z != g.dims[2]; ++z)
+            {
+                aabb_t cell = grid_cell_aabb(&g, x, y, z);
+                int touches = 0;
+                for (wsib_t f = 0; f != mesh_face_count(m); ++f)
+                {
+                    face_t face = mesh_get_face_from_buffers(m->vb, m->ib, m->ab, f, m->vb_type, m->ib_type);
+                    touches |= intersect_triangle_aabb_test(face.vertices[0].position.xyz,
+                                                            face.vertices[1].position.xyz,
+                                                            face.vertices[2].position.xyz,
+                                                            cell.xyzxyz);
+                }
+                int flagged = (*grid_cell_flags(&g, x, y, z) & GRID_CELL_SURFACE) ? 1 : 0;
+                EXPECT_THAT(flagged, Eq(touches ? 1 : 0)) << x << "," << y << "," << z;
+                surface_cells += flagged;
+            }
+    EXPECT_THAT(surface_cells, Gt(0));
+}
+
+TEST_F(NAME, classifying_in_ranges_is_same_as_all_at_once)
+{
+    grid_t ranges;
+    vec3_t cell_size = vec3(0.25, 0.25, 0.25);
+    grid_construct(&ranges);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_allocate(&ranges, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_classify_cells(&ranges, m, 0, 3), Eq(WS_OK));
+    ASSERT_THAT(grid_classify_cells(&ranges, m, 3, ranges.dims[0]), Eq(WS_OK));
+
+    for (size_t i = 0; i != grid_cell_count(&g); ++i)
+    {
+        EXPECT_THAT(ranges.flags[i], Eq(g.flags[i]));
+        EXPECT_THAT(attribute_is_same(material_table_get(&ranges.materials, ranges.cells[i]),
+                                      material_table_get(&g.materials, g.cells[i])), Ne(0));
+    }
+    grid_destruct(&ranges);
+}
+
+TEST_F(NAME, exterior_and_solid_cells_are_excluded)
+{
+    /* The cube is a solid block floating in air */
+    vec3_t cell_size = vec3(0.25, 0.25, 0.25);
+    aabb_t boundary = aabb(-2, -2, -2, 2, 2, 2);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, boundary.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_exclude_cells(&g, m, 0), Eq(WS_OK));
+
+    size_t kept = 0;
+    for (size_t i = 0; i != grid_cell_count(&g); ++i)
+    {
+        if (g.flags[i] & GRID_CELL_SURFACE)
+            EXPECT_THAT(g.flags[i] & GRID_CELL_EXCLUDED, Eq(0));
+        else
+            EXPECT_THAT(g.flags[i] & GRID_CELL_EXCLUDED, Ne(0));
+        if ((g.flags[i] & GRID_CELL_EXCLUDED) == 0)
+            ++kept;
+    }
+    EXPECT_THAT(g.excluded_count, Eq(grid_cell_count(&g) - kept));
+    EXPECT_THAT(*grid_cell_flags(&g, 0, 0, 0) & GRID_CELL_EXTERIOR, Ne(0));
+    EXPECT_THAT(*grid_cell_flags(&g, 8, 8, 8) & GRID_CELL_INSIDE, Ne(0));
+}
+
+TEST(grid_rooms, enclosed_air_is_kept)
+{
+    grid_t g;
+    mesh_t* m;
+    grid_construct(&g);
+    ASSERT_THAT(mesh_create(&m), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+
+    /* Walls are one unit thick, so at this resolution there are solid cells */
+    vec3_t cell_size = vec3(0.25, 0.25, 0.25);
+    aabb_t boundary = aabb(-5, -1, -5, 5, 9, 5);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, boundary.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_exclude_cells(&g, m, 0), Eq(WS_OK));
+
+    int32_t room[3], wall[3], outside[3];
+    /* Minimum corners of the cells */
+    vec3_t room_corner = vec3(-0.25, 3.75, -0.25);
+    vec3_t wall_corner = vec3(-3.75, 3.75, -0.25);
+    vec3_t outside_corner = vec3(-5, 3.75, -0.25);
+    grid_cell_at(&g, room, room_corner.xyz);
+    grid_cell_at(&g, wall, wall_corner.xyz);
+    grid_cell_at(&g, outside, outside_corner.xyz);
+    EXPECT_THAT(room[0], Eq(19));
+    EXPECT_THAT(outside[0], Eq(0));
+    EXPECT_THAT(*grid_cell_flags(&g, room[0], room[1], room[2]) & GRID_CELL_EXCLUDED, Eq(0));
+    EXPECT_THAT(*grid_cell_flags(&g, wall[0], wall[1], wall[2]) & (GRID_CELL_INSIDE | GRID_CELL_EXCLUDED),
+                Eq(GRID_CELL_INSIDE | GRID_CELL_EXCLUDED));
+    EXPECT_THAT(*grid_cell_flags(&g, outside[0], outside[1], outside[2]) & (GRID_CELL_EXTERIOR | GRID_CELL_EXCLUDED),
+                Eq(GRID_CELL_EXTERIOR | GRID_CELL_EXCLUDED));
+
+    grid_destruct(&g);
+    mesh_destroy(m);
+}
+
+TEST(grid_rooms, exterior_air_can_be_kept)
+{
+    grid_t g;
+    mesh_t* m;
+    grid_construct(&g);
+    ASSERT_THAT(mesh_create(&m), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+
+    vec3_t cell_size = vec3(0.25, 0.25, 0.25);
+    aabb_t boundary = aabb(-5, -1, -5, 5, 9, 5);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, boundary.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_exclude_cells(&g, m, 1), Eq(WS_OK));
+
+    int32_t wall[3], outside[3];
+    /* Minimum corners of the cells */
+    vec3_t wall_corner = vec3(-3.75, 3.75, -0.25);
+    vec3_t outside_corner = vec3(-5, 3.75, -0.25);
+    grid_cell_at(&g, wall, wall_corner.xyz);
+    grid_cell_at(&g, outside, outside_corner.xyz);
+    EXPECT_THAT(outside[0], Eq(0));
+    EXPECT_THAT(*grid_cell_flags(&g, wall[0], wall[1], wall[2]) & GRID_CELL_EXCLUDED, Ne(0));
+    EXPECT_THAT(*grid_cell_flags(&g, outside[0], outside[1], outside[2]) & (GRID_CELL_EXTERIOR | GRID_CELL_EXCLUDED),
+                Eq(GRID_CELL_EXTERIOR));
+
+    grid_destruct(&g);
+    mesh_destroy(m);
+}
+
+TEST(grid_rooms, wall_faces_on_cell_boundaries_are_surface)
+{
+    grid_t g;
+    mesh_t* m;
+    grid_construct(&g);
+    ASSERT_THAT(mesh_create(&m), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+
+    /* Every face of the model lies exactly on a cell boundary */
+    vec3_t cell_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(grid_build_from_mesh(&g, m, m->aabb.xyzxyz, cell_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(grid_exclude_cells(&g, m, 0), Eq(WS_OK));
+
+    for (int32_t x = 0; x != g.dims[0]; ++x)
+        for (int32_t z = 0; z != g.dims[2]; ++z)
+        {
+            EXPECT_THAT(*grid_cell_flags(&g, x, 0, z) & GRID_CELL_SURFACE, Ne(0)) << x << "," << z;
+            EXPECT_THAT(*grid_cell_flags(&g, x, 0, z) & GRID_CELL_EXCLUDED, Eq(0)) << x << "," << z;
+        }
+    for (int32_t y = 0; y != g.dims[1]; ++y)
+        EXPECT_THAT(*grid_cell_flags(&g, g.dims[0] - 1, y, 0) & GRID_CELL_SURFACE, Ne(0)) << y;
+
+    grid_destruct(&g);
+    mesh_destroy(m);
+}
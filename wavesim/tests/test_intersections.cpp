@@ -423,3 +423,48 @@ TEST(NAME, aabb_edge_touches_edge_of_face)
     wsreal_t bb[6] = {0, 0, 0, 2, 2, 2};
     ASSERT_THAT(intersect_triangle_aabb_test(v1, v2, v3, bb), Eq(1));
 }
+
+TEST(NAME, aabb8_mask_matches_aabb_aabb_test_for_every_simd_level)
+{
+    /* A 2x2x2 arrangement of unit boxes, tested against boxes on a 0.5 grid */
+    aabb8_t boxes;
+    aabb_t single[8];
+    for (int i = 0; i != 8; ++i)
+    {
+        single[i] = aabb(i >> 2, (i >> 1) & 1, i & 1, (i >> 2) + 1, ((i >> 1) & 1) + 1, (i & 1) + 1);
+        for (int a = 0; a != 3; ++a)
+        {
+            boxes.min[a][i] = single[i].xyzxyz[a];
+            boxes.max[a][i] = single[i].xyzxyz[a+3];
+        }
+    }
+
+    cpu_simd_e levels[3] = {CPU_SIMD_NONE, CPU_SIMD_SSE2, CPU_SIMD_AVX};
+    for (int level = 0; level != 3; ++level)
+    {
+        if (intersect_select_simd(levels[level]) != levels[level])
+            continue; /* not supported by this CPU or build */
+
+        for (wsreal_t x = -0.5; x <= 2; x += 0.5)
+            for (wsreal_t y = -0.5; y <= 2; y += 0.5)
+                for (wsreal_t z = -0.5; z <= 2; z += 0.5)
+                {
+                    aabb_t query = aabb(x, y, z, x + 0.5, y + 0.5, z + 0.5);
+                    unsigned strict = intersect_aabb8_aabb_mask(&boxes, query.xyzxyz, 0);
+                    unsigned inclusive = intersect_aabb8_aabb_mask(&boxes, query.xyzxyz, 1);
+                    for (int i = 0; i != 8; ++i)
+                    {
+                        int touches = 1;
+                        for (int a = 0; a != 3; ++a)
+                            if (single[i].xyzxyz[a+3] < query.xyzxyz[a] || single[i].xyzxyz[a] > query.xyzxyz[a+3])
+                                touches = 0;
+                        EXPECT_THAT((strict >> i) & 1u, Eq(intersect_aabb_aabb_test(single[i].xyzxyz, query.xyzxyz) ? 1u : 0u))
+                            << "level " << level << ", box " << i;
+                        EXPECT_THAT((inclusive >> i) & 1u, Eq(touches ? 1u : 0u))
+                            << "level " << level << ", box " << i;
+                    }
+                }
+    }
+
+    intersect_select_simd(cpu_detect_simd());
+}
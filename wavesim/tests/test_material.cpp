@@ -0,0 +1,100 @@
+#include "gmock/gmock.h"
+#include "wavesim/material.h"
+
+#define NAME material
+
+using namespace ::testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        material_table_construct(&t);
+    }
+
+    virtual void TearDown()
+    {
+        material_table_clear_free(&t);
+    }
+
+protected:
+    material_table_t t;
+};
+
+TEST_F(NAME, same_attribute_gets_same_id)
+{
+    material_id_t a, b, c;
+    attribute_t a1 = attribute(0.5, 0.25, 0.25);
+    attribute_t a2 = attribute(0.25, 0.5, 0.25);
+    ASSERT_THAT(material_table_intern(&t, &a1, &a), Eq(WS_OK));
+    ASSERT_THAT(material_table_intern(&t, &a2, &b), Eq(WS_OK));
+    ASSERT_THAT(material_table_intern(&t, &a1, &c), Eq(WS_OK));
+    EXPECT_THAT(a, Eq(0));
+    EXPECT_THAT(b, Eq(1));
+    EXPECT_THAT(c, Eq(a));
+    EXPECT_THAT(material_table_count(&t), Eq(2u));
+    EXPECT_THAT(attribute_is_same(material_table_get(&t, b), &a2), Ne(0));
+}
+
+TEST_F(NAME, floating_point_noise_is_quantized_away)
+{
+    material_id_t a, b;
+    attribute_t a1 = attribute(0.1, 0.2, 0.7);
+    attribute_t a2 = attribute(0.1 + 1e-12, 0.2 - 1e-12, 0.7);
+    ASSERT_THAT(material_table_intern(&t, &a1, &a), Eq(WS_OK));
+    ASSERT_THAT(material_table_intern(&t, &a2, &b), Eq(WS_OK));
+    EXPECT_THAT(a, Eq(b));
+    EXPECT_THAT(material_table_get(&t, a)->absorption, DoubleNear(0.7, 1.0 / MATERIAL_QUANTIZATION));
+}
+
+TEST_F(NAME, grows_past_initial_capacity)
+{
+    for (int i = 0; i != 1000; ++i)
+    {
+        material_id_t id;
+        attribute_t a = attribute(i, 0, 1);
+        ASSERT_THAT(material_table_intern(&t, &a, &id), Eq(WS_OK));
+        ASSERT_THAT(id, Eq(i));
+    }
+    for (int i = 0; i != 1000; ++i)
+    {
+        material_id_t id;
+        attribute_t a = attribute(i, 0, 1);
+        ASSERT_THAT(material_table_intern(&t, &a, &id), Eq(WS_OK));
+        ASSERT_THAT(id, Eq(i));
+    }
+    EXPECT_THAT(material_table_count(&t), Eq(1000u));
+}
+
+TEST_F(NAME, too_many_materials_is_an_error)
+{
+    material_id_t id;
+    for (int i = 0; i != MATERIAL_MAX_COUNT; ++i)
+    {
+        attribute_t a = attribute(i, 0, 0);
+        ASSERT_THAT(material_table_intern(&t, &a, &id), Eq(WS_OK));
+    }
+    attribute_t existing = attribute(MATERIAL_MAX_COUNT - 1, 0, 0);
+    ASSERT_THAT(material_table_intern(&t, &existing, &id), Eq(WS_OK));
+    EXPECT_THAT(id, Eq(MATERIAL_MAX_COUNT - 1));
+    attribute_t one_more = attribute(MATERIAL_MAX_COUNT, 0, 0);
+    EXPECT_THAT(material_table_intern(&t, &one_more, &id), Eq(WS_ERR_TOO_MANY_MATERIALS));
+}
+
+TEST_F(NAME, merge_remaps_ids)
+{
+    material_table_t other;
+    material_id_t id, remap[2];
+    attribute_t a1 = attribute(1, 0, 0);
+    attribute_t a2 = attribute(0, 1, 0);
+    material_table_construct(&other);
+    ASSERT_THAT(material_table_intern(&t, &a1, &id), Eq(WS_OK));
+    ASSERT_THAT(material_table_intern(&other, &a2, &id), Eq(WS_OK));
+    ASSERT_THAT(material_table_intern(&other, &a1, &id), Eq(WS_OK));
+    ASSERT_THAT(material_table_merge(&t, &other, remap), Eq(WS_OK));
+    EXPECT_THAT(remap[0], Eq(1));
+    EXPECT_THAT(remap[1], Eq(0));
+    EXPECT_THAT(material_table_count(&t), Eq(2u));
+    material_table_clear_free(&other);
+}
@@ -2,6 +2,7 @@
 #include "wavesim/medium.h"
 #include "wavesim/mesh.h"
 #include "wavesim/obj.h"
+#include "utils.hpp"
 
 #define NAME medium
 
@@ -21,3 +22,272 @@ TEST(NAME, cube_with_interior)
     medium_destroy(medium);
     mesh_destroy(mesh);
 }
+
+TEST(NAME, partition_aabb_is_derived_from_cell_box)
+{
+    medium_t medium;
+    int32_t box[6] = {1, 2, 3, 4, 6, 8};
+    medium_construct(&medium);
+    medium.boundary = aabb(-1, 0, 1, 9, 10, 11);
+    medium.grid_size = vec3(0.5, 0.25, 0.1);
+    ASSERT_THAT(medium_add_partition(&medium, box, 0, 1), Eq(WS_OK));
+
+    medium_partition_t* partition = (medium_partition_t*)vector_get_element(&medium.partitions, 0);
+    aabb_t bb = medium_partition_aabb(&medium, partition);
+    EXPECT_THAT(AABB_AX(bb), DoubleEq(-0.5));
+    EXPECT_THAT(AABB_AY(bb), DoubleEq(0.5));
+    EXPECT_THAT(AABB_AZ(bb), DoubleEq(1.3));
+    EXPECT_THAT(AABB_BX(bb), DoubleEq(1));
+    EXPECT_THAT(AABB_BY(bb), DoubleEq(1.5));
+    EXPECT_THAT(AABB_BZ(bb), DoubleEq(1.8));
+
+    medium_destruct(&medium);
+}
+
+TEST(NAME, partitions_lie_within_grid)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+
+    ASSERT_THAT(vector_count(&medium->partitions), Gt(0u));
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        for (int i = 0; i != 3; ++i)
+        {
+            EXPECT_THAT(partition->box[i], Ge(0));
+            EXPECT_THAT(partition->box[i], Lt(partition->box[i+3]));
+            EXPECT_THAT(partition->box[i+3], Le(medium->grid_dims[i]));
+        }
+    VECTOR_END_EACH
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, partitions_cover_every_cell_exactly_once)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    size_t volume = 0;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        volume += (size_t)(partition->box[3] - partition->box[0]) *
+                  (size_t)(partition->box[4] - partition->box[1]) *
+                  (size_t)(partition->box[5] - partition->box[2]);
+    VECTOR_END_EACH
+    EXPECT_THAT(volume + medium->excluded_cell_count, Eq(bitset_count(&medium->occupied)));
+    EXPECT_THAT(bitset_find_unset(&medium->occupied, 0), Eq(bitset_count(&medium->occupied)));
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, greedy_random_covers_every_cell_exactly_once)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    size_t volume = 0;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    medium_set_decomposition_method(medium, medium_decompose_greedy_random);
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+
+    ASSERT_THAT(vector_count(&medium->partitions), Gt(0u));
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        volume += (size_t)(partition->box[3] - partition->box[0]) *
+                  (size_t)(partition->box[4] - partition->box[1]) *
+                  (size_t)(partition->box[5] - partition->box[2]);
+    VECTOR_END_EACH
+    EXPECT_THAT(volume + medium->excluded_cell_count, Eq(bitset_count(&medium->occupied)));
+    EXPECT_THAT(bitset_find_unset(&medium->occupied, 0), Eq(bitset_count(&medium->occupied)));
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, greedy_random_is_reproducible_with_same_seed)
+{
+    mesh_t* mesh;
+    medium_t* a;
+    medium_t* b;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&a), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&b), Eq(WS_OK));
+    medium_set_decomposition_method(a, medium_decompose_greedy_random);
+    medium_set_decomposition_method(b, medium_decompose_greedy_random);
+    medium_set_decomposition_seed(a, 1234);
+    medium_set_decomposition_seed(b, 1234);
+    ASSERT_THAT(medium_build_from_mesh(a, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(medium_build_from_mesh(b, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+
+    ASSERT_THAT(vector_count(&a->partitions), Eq(vector_count(&b->partitions)));
+    for (uint32_t i = 0; i != vector_count(&a->partitions); ++i)
+    {
+        medium_partition_t* pa = (medium_partition_t*)vector_get_element(&a->partitions, i);
+        medium_partition_t* pb = (medium_partition_t*)vector_get_element(&b->partitions, i);
+        for (int j = 0; j != 6; ++j)
+            EXPECT_THAT(pa->box[j], Eq(pb->box[j]));
+    }
+
+    medium_destroy(a);
+    medium_destroy(b);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, bricks_cover_every_cell_exactly_once)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    size_t volume = 0;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    medium_set_thread_count(medium, 4);
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        for (int i = 0; i != 3; ++i)
+        {
+            EXPECT_THAT(partition->box[i], Ge(0));
+            EXPECT_THAT(partition->box[i], Lt(partition->box[i+3]));
+            EXPECT_THAT(partition->box[i+3], Le(medium->grid_dims[i]));
+        }
+        volume += (size_t)(partition->box[3] - partition->box[0]) *
+                  (size_t)(partition->box[4] - partition->box[1]) *
+                  (size_t)(partition->box[5] - partition->box[2]);
+    VECTOR_END_EACH
+    EXPECT_THAT(volume + medium->excluded_cell_count, Eq(bitset_count(&medium->occupied)));
+    EXPECT_THAT(bitset_find_unset(&medium->occupied, 0), Eq(bitset_count(&medium->occupied)));
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, bricks_merge_partitions_cut_by_seams)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    mesh_cube(mesh, aabb(-2, -2, -2, 2, 2, 2));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    medium_set_thread_count(medium, 4);
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(medium->grid_dims[0], Eq(8));
+
+    /* The walls of the cube run through all bricks, seams are at x=2,4,6 */
+    int crossing_seams = 0;
+    VECTOR_FOR_EACH(&medium->partitions, medium_partition_t, partition)
+        if (partition->box[0] < 4 && partition->box[3] > 4)
+            ++crossing_seams;
+    VECTOR_END_EACH
+    EXPECT_THAT(crossing_seams, Gt(0));
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, adjacency_is_symmetric_and_touching)
+{
+    mesh_t* mesh;
+    medium_t* medium;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_create(&medium), Eq(WS_OK));
+    medium_set_thread_count(medium, 3);
+    ASSERT_THAT(medium_build_from_mesh(medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(vector_count(&medium->adjacency_offsets), Eq(vector_count(&medium->partitions) + 1));
+    ASSERT_THAT(vector_count(&medium->interfaces), Gt(0u));
+
+    for (size_t i = 0; i != vector_count(&medium->partitions); ++i)
+    {
+        size_t count;
+        const medium_interface_t* interfaces = medium_partition_interfaces(medium, i, &count);
+        medium_partition_t* partition = (medium_partition_t*)vector_get_element(&medium->partitions, i);
+        for (size_t j = 0; j != count; ++j)
+        {
+            const medium_interface_t* iface = &interfaces[j];
+            ASSERT_THAT((size_t)iface->partition, Lt(vector_count(&medium->partitions)));
+            ASSERT_THAT((size_t)iface->partition, Ne(i));
+            medium_partition_t* other = (medium_partition_t*)vector_get_element(&medium->partitions, (size_t)iface->partition);
+
+            /* The rectangle lies on the face of both boxes */
+            int a = iface->axis;
+            EXPECT_THAT(iface->rect[a], Eq(iface->rect[a+3]));
+            EXPECT_THAT(iface->rect[a], Eq(iface->side > 0 ? partition->box[a+3] : partition->box[a]));
+            EXPECT_THAT(iface->rect[a], Eq(iface->side > 0 ? other->box[a] : other->box[a+3]));
+            for (int k = 0; k != 3; ++k)
+            {
+                if (k == a)
+                    continue;
+                EXPECT_THAT(iface->rect[k], Lt(iface->rect[k+3]));
+                EXPECT_THAT(iface->rect[k], Eq(std::max(partition->box[k], other->box[k])));
+                EXPECT_THAT(iface->rect[k+3], Eq(std::min(partition->box[k+3], other->box[k+3])));
+            }
+
+            /* The neighbour must list us too, with the same rectangle */
+            size_t other_count;
+            const medium_interface_t* back = medium_partition_interfaces(medium, (size_t)iface->partition, &other_count);
+            bool found = false;
+            for (size_t k = 0; k != other_count; ++k)
+                if (back[k].partition == (int32_t)i)
+                {
+                    found = true;
+                    EXPECT_THAT(back[k].side, Eq(-iface->side));
+                    for (int r = 0; r != 6; ++r)
+                        EXPECT_THAT(back[k].rect[r], Eq(iface->rect[r]));
+                }
+            EXPECT_TRUE(found);
+        }
+    }
+
+    medium_destroy(medium);
+    mesh_destroy(mesh);
+}
+
+TEST(NAME, adjacency_of_two_stacked_partitions)
+{
+    medium_t medium;
+    int32_t a[6] = {0, 0, 0, 2, 2, 2};
+    int32_t b[6] = {0, 2, 1, 2, 4, 3};
+    int32_t c[6] = {2, 2, 1, 3, 3, 2}; /* Only touches a along an edge */
+    size_t count;
+    medium_construct(&medium);
+    ASSERT_THAT(medium_add_partition(&medium, a, 0, 1), Eq(WS_OK));
+    ASSERT_THAT(medium_add_partition(&medium, b, 0, 1), Eq(WS_OK));
+    ASSERT_THAT(medium_add_partition(&medium, c, 0, 1), Eq(WS_OK));
+    ASSERT_THAT(medium_build_adjacency(&medium), Eq(WS_OK));
+
+    const medium_interface_t* iface = medium_partition_interfaces(&medium, 0, &count);
+    ASSERT_THAT(count, Eq(1u));
+    EXPECT_THAT(iface->partition, Eq(1));
+    EXPECT_THAT(iface->axis, Eq(1));
+    EXPECT_THAT(iface->side, Eq(1));
+    int32_t expected[6] = {0, 2, 1, 2, 2, 2};
+    for (int i = 0; i != 6; ++i)
+        EXPECT_THAT(iface->rect[i], Eq(expected[i]));
+
+    iface = medium_partition_interfaces(&medium, 1, &count);
+    ASSERT_THAT(count, Eq(2u));
+    EXPECT_THAT(iface[0].partition, Eq(0));
+    EXPECT_THAT(iface[0].side, Eq(-1));
+    EXPECT_THAT(iface[1].partition, Eq(2));
+    EXPECT_THAT(iface[1].axis, Eq(0));
+
+    medium_destruct(&medium);
+}
@@ -1,8 +1,11 @@
 #include "gmock/gmock.h"
+#include "wavesim/intersections.h"
 #include "wavesim/obj.h"
 #include "wavesim/octree.h"
 #include "wavesim/mesh.h"
 #include "utils.hpp"
+#include <algorithm>
+#include <vector>
 
 #define NAME octree
 
@@ -61,12 +64,12 @@ TEST_F(NAME, build_from_cube_mesh)
     EXPECT_THAT(octree_build_from_mesh(o, m, 6), Eq(WS_OK));
     EXPECT_THAT(obj_export_octree("octree.build_from_cube_mesh.obj", o), Eq(WS_OK));
     // Check boundaries
-    EXPECT_THAT(AABB_AX(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_AY(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_AZ(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_BX(o->root.aabb), DoubleEq(1));
-    EXPECT_THAT(AABB_BY(o->root.aabb), DoubleEq(1));
-    EXPECT_THAT(AABB_BZ(o->root.aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_AX(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_AY(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_AZ(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_BX(o->aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_BY(o->aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_BZ(o->aabb), DoubleEq(1));
     // Octree should contain all 12 faces
     ASSERT_THAT(octree_face_count(o), Eq(12));
 }
@@ -91,12 +94,12 @@ TEST_F(NAME, cube_mesh_with_small_triangles)
     EXPECT_THAT(octree_build_from_mesh(o, m, 6), Eq(WS_OK));
     EXPECT_THAT(obj_export_octree("octree.cube_mesh_with_small_triangles.obj", o), Eq(WS_OK));
     // Check boundaries
-    EXPECT_THAT(AABB_AX(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_AY(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_AZ(o->root.aabb), DoubleEq(-1));
-    EXPECT_THAT(AABB_BX(o->root.aabb), DoubleEq(1));
-    EXPECT_THAT(AABB_BY(o->root.aabb), DoubleEq(1));
-    EXPECT_THAT(AABB_BZ(o->root.aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_AX(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_AY(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_AZ(o->aabb), DoubleEq(-1));
+    EXPECT_THAT(AABB_BX(o->aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_BY(o->aabb), DoubleEq(1));
+    EXPECT_THAT(AABB_BZ(o->aabb), DoubleEq(1));
     // Octree top node should contain all 14 faces
     ASSERT_THAT(octree_face_count(o), Eq(14));
 }
@@ -118,3 +121,521 @@ TEST_F(NAME, from_high_ceiling_obj)
     obj_export_octree("octree.from_high_ceiling_obj.obj", o);
 }
 
+
+TEST_F(NAME, child_aabbs_are_in_morton_order)
+{
+    aabb_t parent = aabb(0, 0, 0, 2, 4, 8);
+    aabb_t c5 = octree_child_aabb(&parent, 5); /* x=1, y=0, z=1 */
+    EXPECT_THAT(AABB_AX(c5), DoubleEq(1)); EXPECT_THAT(AABB_BX(c5), DoubleEq(2));
+    EXPECT_THAT(AABB_AY(c5), DoubleEq(0)); EXPECT_THAT(AABB_BY(c5), DoubleEq(2));
+    EXPECT_THAT(AABB_AZ(c5), DoubleEq(4)); EXPECT_THAT(AABB_BZ(c5), DoubleEq(8));
+}
+
+static void
+check_leaves(const octree_t* o, uint32_t node_idx, const aabb_t* bb, std::vector<int>& face_seen)
+{
+    const octree_node_t* node = octree_node(o, node_idx);
+    if (octree_node_is_leaf(node) == 0)
+    {
+        ASSERT_THAT(node->first_child, Gt(node_idx));
+        ASSERT_THAT(node->first_child + 8, Le(vector_count(&o->nodes)));
+        for (int i = 0; i != 8; ++i)
+        {
+            aabb_t child_bb = octree_child_aabb(bb, i);
+            check_leaves(o, node->first_child + (uint32_t)i, &child_bb, face_seen);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i != node->face_count; ++i)
+    {
+        wsib_t face_id = *(wsib_t*)vector_get_element(&o->face_ids, node->face_offset + i);
+        face_t f = mesh_get_face(o->mesh, face_id);
+        aabb_t face_bb = aabb_from_3_points(f.vertices[0].position.xyz,
+                                            f.vertices[1].position.xyz,
+                                            f.vertices[2].position.xyz);
+        for (int a = 0; a != 3; ++a)
+        {
+            EXPECT_THAT(face_bb.xyzxyz[a+3], Ge(bb->xyzxyz[a]));
+            EXPECT_THAT(face_bb.xyzxyz[a], Le(bb->xyzxyz[a+3]));
+        }
+        face_seen[face_id] = 1;
+    }
+}
+
+TEST_F(NAME, nodes_and_face_ids_are_linearized)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+    ASSERT_THAT(vector_count(&o->nodes), Gt(1u));
+    EXPECT_THAT((vector_count(&o->nodes) - 1) % 8, Eq(0u));
+
+    /* Every face ends up in at least one leaf, and only in leaves it overlaps */
+    std::vector<int> face_seen(mesh_face_count(m), 0);
+    check_leaves(o, 0, &o->aabb, face_seen);
+    for (size_t f = 0; f != face_seen.size(); ++f)
+        EXPECT_THAT(face_seen[f], Eq(1)) << f;
+
+    octree_clear(o);
+    EXPECT_THAT(vector_count(&o->nodes), Eq(0u));
+    EXPECT_THAT(vector_count(&o->face_ids), Eq(0u));
+}
+
+TEST_F(NAME, query_returns_each_potential_face_once)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+
+    vector_t result;
+    vector_construct(&result, sizeof(wsib_t));
+    aabb_t query = aabb(-1.3, 0.7, -2.1, 2.4, 4.5, 0.3);
+
+    /* Repeating the query must not be affected by marks of the previous one */
+    for (int repeat = 0; repeat != 2; ++repeat)
+    {
+        vector_clear(&result);
+        ASSERT_THAT(octree_query_potential_faces(o, &result, query.xyzxyz), Ne(-1));
+
+        std::vector<int> found(mesh_face_count(m), 0);
+        for (size_t i = 0; i != vector_count(&result); ++i)
+        {
+            wsib_t face_id = *(wsib_t*)vector_get_element(&result, i);
+            EXPECT_THAT(found[face_id], Eq(0)) << "face " << face_id << " returned twice";
+            found[face_id] = 1;
+        }
+
+        /* Every face whose bounding box overlaps the query must be returned */
+        for (wsib_t f = 0; f != mesh_face_count(m); ++f)
+        {
+            face_t face = mesh_get_face(m, f);
+            aabb_t face_bb = aabb_from_3_points(face.vertices[0].position.xyz,
+                                                face.vertices[1].position.xyz,
+                                                face.vertices[2].position.xyz);
+            int overlaps = 1;
+            for (int a = 0; a != 3; ++a)
+                if (face_bb.xyzxyz[a+3] <= query.xyzxyz[a] || face_bb.xyzxyz[a] >= query.xyzxyz[a+3])
+                    overlaps = 0;
+            if (overlaps)
+                EXPECT_THAT(found[f], Eq(1)) << f;
+        }
+    }
+
+    vector_clear_free(&result);
+}
+
+static void
+expect_inside(octree_t* o, wsreal_t x, wsreal_t y, wsreal_t z, int expected)
+{
+    wsreal_t p[3] = {x, y, z};
+    uint8_t inside = 2;
+    ASSERT_THAT(octree_query_points_are_inside_mesh(o, &inside, p, 1), Eq(WS_OK));
+    EXPECT_THAT(inside, Eq(expected)) << x << " " << y << " " << z;
+    EXPECT_THAT(octree_query_point_is_inside_mesh(o, p) % 2, Eq(expected)) << x << " " << y << " " << z;
+}
+
+TEST_F(NAME, point_inside_cube)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+
+    /* Offsets keep the rays away from edges and vertices */
+    expect_inside(o, 0.13, 5.07, 0.21, 1);  /* Centre */
+    expect_inside(o, -4.87, 0.11, -4.93, 1); /* Near a corner */
+    expect_inside(o, 0.13, 5.07, -7.21, 0); /* Below the cube along the ray */
+    expect_inside(o, 0.13, 5.07, 7.21, 0);  /* Above the cube */
+    expect_inside(o, 7.13, 5.07, 0.21, 0);  /* Beside the cube */
+}
+
+TEST_F(NAME, point_inside_cube_with_interior)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+
+    /* The walls between the outer and the inner cube are inside the mesh */
+    expect_inside(o, 0.13, 0.47, 0.21, 1);  /* Floor */
+    expect_inside(o, 0.13, 4.07, 3.47, 1);  /* Wall the ray leaves through */
+    expect_inside(o, 0.13, 4.07, -3.47, 1); /* Wall the ray enters the cavity from */
+    expect_inside(o, 3.53, 4.07, 0.21, 1);  /* Wall parallel to the ray */
+    expect_inside(o, 0.13, 4.07, 0.21, 0);  /* Cavity */
+    expect_inside(o, 0.13, 4.07, 9.21, 0);  /* Outside of the AABB */
+    expect_inside(o, 0.13, -2.07, 0.21, 0); /* Outside of the AABB */
+}
+
+TEST_F(NAME, many_points_inside_cube_with_interior)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+
+    /*
+     * Columns of points reaching from below the mesh to above the tree, some
+     * of them next to the mesh. The spacing keeps the points off the faces
+     * and the columns away from edges and vertices.
+     */
+    std::vector<wsreal_t> points;
+    std::vector<int> expected;
+    uint64_t columns = 0;
+    for (wsreal_t x = -5.07; x < 5.5; x += 0.71)
+        for (wsreal_t y = -1.37; y < 9.5; y += 1.13, ++columns)
+            for (wsreal_t z = 6.19; z > -5.5; z -= 0.67)
+            {
+                int in_outer = std::fabs(x) < 4 && y > 0 && y < 8 && std::fabs(z) < 4;
+                int in_inner = std::fabs(x) < 3 && y > 1 && y < 7 && std::fabs(z) < 3;
+                points.push_back(x);
+                points.push_back(y);
+                points.push_back(z);
+                expected.push_back(in_outer && !in_inner);
+            }
+    size_t count = expected.size();
+
+    std::vector<uint8_t> inside(count, 2);
+    ASSERT_THAT(octree_query_points_are_inside_mesh(o, inside.data(), points.data(), count), Eq(WS_OK));
+
+    /* At most one ray per column */
+    octree_stats_t stats;
+    octree_stats(o, &stats);
+    EXPECT_THAT(stats.counters.queries, AllOf(Gt(0u), Le(columns)));
+
+    int inside_count = 0;
+    for (size_t i = 0; i != count; ++i)
+    {
+        const wsreal_t* p = &points[i*3];
+        EXPECT_THAT(inside[i], Eq(expected[i])) << p[0] << " " << p[1] << " " << p[2];
+        EXPECT_THAT(octree_query_point_is_inside_mesh(o, p) % 2, Eq(expected[i])) << p[0] << " " << p[1] << " " << p[2];
+        inside_count += expected[i];
+    }
+    EXPECT_THAT(inside_count, Gt(0));
+    EXPECT_THAT(inside_count, Lt((int)count));
+}
+
+static void
+collect_leaves(const octree_t* o, uint32_t node_idx, std::vector<std::vector<wsib_t> >& leaves)
+{
+    const octree_node_t* node = octree_node(o, node_idx);
+    if (octree_node_is_leaf(node) == 0)
+    {
+        for (uint32_t i = 0; i != 8; ++i)
+            collect_leaves(o, node->first_child + i, leaves);
+        return;
+    }
+
+    leaves.push_back(std::vector<wsib_t>());
+    for (uint32_t i = 0; i != node->face_count; ++i)
+        leaves.back().push_back(*(wsib_t*)vector_get_element(&o->face_ids, node->face_offset + i));
+}
+
+TEST_F(NAME, parallel_build_matches_serial_build)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 5), Eq(WS_OK));
+    std::vector<std::vector<wsib_t> > serial;
+    collect_leaves(o, 0, serial);
+    size_t node_count = vector_count(&o->nodes);
+    size_t face_id_count = vector_count(&o->face_ids);
+
+    /* Only the storage order of the nodes may differ, not the tree itself */
+    for (int parallel_depth = 0; parallel_depth != 3; ++parallel_depth)
+    {
+        octree_set_parallel_build(o, 4, parallel_depth);
+        ASSERT_THAT(octree_build_from_mesh(o, m, 5), Eq(WS_OK));
+        std::vector<std::vector<wsib_t> > parallel;
+        collect_leaves(o, 0, parallel);
+        EXPECT_THAT(vector_count(&o->nodes), Eq(node_count));
+        EXPECT_THAT(vector_count(&o->face_ids), Eq(face_id_count));
+        EXPECT_THAT(parallel, Eq(serial)) << parallel_depth;
+
+        std::vector<int> face_seen(mesh_face_count(m), 0);
+        check_leaves(o, 0, &o->aabb, face_seen);
+    }
+}
+
+static int
+max_leaf_depth(const octree_t* o, uint32_t node_idx)
+{
+    const octree_node_t* node = octree_node(o, node_idx);
+    int depth = 0;
+    if (octree_node_is_leaf(node))
+        return 0;
+    for (uint32_t i = 0; i != 8; ++i)
+        depth = std::max(depth, max_leaf_depth(o, node->first_child + i) + 1);
+    return depth;
+}
+
+TEST_F(NAME, default_params_grow_with_face_count)
+{
+    octree_build_params_t small, large;
+    mesh_create(&m);
+    mesh_cube(m, aabb(-1, -1, -1, 1, 1, 1));
+    octree_build_params_default(&small, m, 0.25);
+    EXPECT_THAT(small.min_node_extent, DoubleEq(0.25));
+    EXPECT_THAT(small.cost_heuristic, Ne(0));
+
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/high-ceiling.obj", m), Eq(WS_OK));
+    octree_build_params_default(&large, m, 0.25);
+    EXPECT_THAT(large.max_depth, Gt(small.max_depth));
+    EXPECT_THAT(large.max_faces_per_leaf, Eq(small.max_faces_per_leaf));
+}
+
+TEST_F(NAME, cube_is_not_subdivided_with_default_params)
+{
+    /* Every octant touches half of the faces, so splitting doesn't pay off */
+    octree_build_params_t params;
+    mesh_create(&m);
+    mesh_cube(m, aabb(-1, -1, -1, 1, 1, 1));
+    octree_build_params_default(&params, m, 0);
+    params.max_faces_per_leaf = 1;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(vector_count(&o->nodes), Eq(1u));
+    EXPECT_THAT(vector_count(&o->face_ids), Eq(12u));
+
+    params.cost_heuristic = 0;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(vector_count(&o->nodes), Gt(1u));
+}
+
+TEST_F(NAME, leaves_stop_at_max_faces_per_leaf)
+{
+    octree_build_params_t params;
+    mesh_create(&m);
+    mesh_cube(m, aabb(-1, -1, -1, 1, 1, 1));
+    octree_build_params_default(&params, m, 0);
+    params.cost_heuristic = 0;
+    params.max_faces_per_leaf = 12;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(vector_count(&o->nodes), Eq(1u));
+
+    params.max_faces_per_leaf = 11;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(vector_count(&o->nodes), Gt(1u));
+}
+
+TEST_F(NAME, nodes_are_not_smaller_than_min_node_extent)
+{
+    octree_build_params_t params;
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/high-ceiling.obj", m), Eq(WS_OK));
+    octree_build_params_default(&params, m, 0);
+    params.cost_heuristic = 0;
+    params.max_faces_per_leaf = 1;
+    params.max_depth = 4;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    int unlimited = max_leaf_depth(o, 0);
+
+    /* Nodes at depth d are extent/2^d large along the longest axis */
+    wsreal_t extent = 0;
+    for (int a = 0; a != 3; ++a)
+        extent = std::max(extent, m->aabb.xyzxyz[a+3] - m->aabb.xyzxyz[a]);
+    params.min_node_extent = extent / 8;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(max_leaf_depth(o, 0), Le(3));
+    EXPECT_THAT(max_leaf_depth(o, 0), Lt(unlimited));
+
+    std::vector<int> face_seen(mesh_face_count(m), 0);
+    check_leaves(o, 0, &o->aabb, face_seen);
+    for (size_t f = 0; f != face_seen.size(); ++f)
+        EXPECT_THAT(face_seen[f], Eq(1)) << f;
+}
+
+static void
+check_loose_nodes(const octree_t* o, uint32_t node_idx, const aabb_t* bb, std::vector<int>& face_count)
+{
+    const octree_node_t* node = octree_node(o, node_idx);
+    aabb_t loose_bb = octree_loose_aabb(bb, o->looseness);
+    for (uint32_t i = 0; i != node->face_count; ++i)
+    {
+        wsib_t face_id = *(wsib_t*)vector_get_element(&o->face_ids, node->face_offset + i);
+        face_t f = mesh_get_face(o->mesh, face_id);
+        aabb_t face_bb = aabb_from_3_points(f.vertices[0].position.xyz,
+                                            f.vertices[1].position.xyz,
+                                            f.vertices[2].position.xyz);
+        for (int a = 0; a != 3; ++a)
+        {
+            EXPECT_THAT(face_bb.xyzxyz[a], Ge(loose_bb.xyzxyz[a]));
+            EXPECT_THAT(face_bb.xyzxyz[a+3], Le(loose_bb.xyzxyz[a+3]));
+        }
+        face_count[face_id]++;
+    }
+
+    if (octree_node_is_leaf(node) == 0)
+        for (int i = 0; i != 8; ++i)
+        {
+            aabb_t child_bb = octree_child_aabb(bb, i);
+            check_loose_nodes(o, node->first_child + (uint32_t)i, &child_bb, face_count);
+        }
+}
+
+TEST_F(NAME, loose_octree_stores_every_face_once)
+{
+    octree_build_params_t params;
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/high-ceiling.obj", m), Eq(WS_OK));
+    octree_build_params_default(&params, m, 0);
+    params.cost_heuristic = 0;
+    params.max_faces_per_leaf = 1;
+    params.max_depth = 4;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    size_t tight_face_ids = vector_count(&o->face_ids);
+
+    params.looseness = 1;
+    ASSERT_THAT(octree_build_from_mesh_params(o, m, &params), Eq(WS_OK));
+    EXPECT_THAT(vector_count(&o->nodes), Gt(1u));
+    EXPECT_THAT(vector_count(&o->face_ids), Eq((size_t)mesh_face_count(m)));
+    EXPECT_THAT(vector_count(&o->face_ids), Lt(tight_face_ids));
+
+    /* Each face lives in exactly one node whose loose bounds contain it */
+    std::vector<int> face_count(mesh_face_count(m), 0);
+    check_loose_nodes(o, 0, &o->aabb, face_count);
+    for (size_t f = 0; f != face_count.size(); ++f)
+        EXPECT_THAT(face_count[f], Eq(1)) << f;
+
+    /* Queries find the same faces as a brute force search */
+    vector_t result;
+    vector_construct(&result, sizeof(wsib_t));
+    aabb_t query = aabb(-1.3, 0.7, -2.1, 2.4, 4.5, 0.3);
+    ASSERT_THAT(octree_query_potential_faces(o, &result, query.xyzxyz), Ne(-1));
+    std::vector<int> found(mesh_face_count(m), 0);
+    for (size_t i = 0; i != vector_count(&result); ++i)
+        found[*(wsib_t*)vector_get_element(&result, i)] = 1;
+    for (wsib_t f = 0; f != mesh_face_count(m); ++f)
+    {
+        face_t face = mesh_get_face(m, f);
+        aabb_t face_bb = aabb_from_3_points(face.vertices[0].position.xyz,
+                                            face.vertices[1].position.xyz,
+                                            face.vertices[2].position.xyz);
+        if (intersect_aabb_aabb_test(face_bb.xyzxyz, query.xyzxyz))
+            EXPECT_THAT(found[f], Eq(1)) << f;
+    }
+    vector_clear_free(&result);
+}
+
+TEST_F(NAME, loose_point_inside_mesh_matches_regular_octree)
+{
+    octree_t* loose;
+    octree_build_params_t params;
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+    ASSERT_THAT(octree_create(&loose), Eq(WS_OK));
+    octree_build_params_default(&params, m, 0);
+    params.cost_heuristic = 0;
+    params.max_faces_per_leaf = 1;
+    params.looseness = 1;
+    octree_set_parallel_build(loose, 4, 1);
+    ASSERT_THAT(octree_build_from_mesh_params(loose, m, &params), Eq(WS_OK));
+
+    for (wsreal_t x = -4.93; x < 5; x += 0.71)
+        for (wsreal_t y = -0.87; y < 9; y += 1.13)
+            for (wsreal_t z = -4.81; z < 5; z += 0.67)
+            {
+                vec3_t p = vec3(x, y, z);
+                EXPECT_THAT(octree_query_point_is_inside_mesh(loose, p.xyz),
+                            Eq(octree_query_point_is_inside_mesh(o, p.xyz)));
+            }
+
+    octree_destroy(loose);
+}
+
+TEST_F(NAME, stats_describe_tree_and_queries)
+{
+    octree_stats_t stats;
+    mesh_create(&m);
+    mesh_cube(m, aabb(-1, -1, -1, 1, 1, 1));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 2), Eq(WS_OK));
+    octree_stats(o, &stats);
+
+    /* Every octant of a cube touches faces, and the depth limit is hit */
+    EXPECT_THAT(stats.node_count, Eq(1u + 8u + 64u));
+    EXPECT_THAT(stats.leaf_count, Eq(64u));
+    EXPECT_THAT(stats.depth, Eq(3u));
+    EXPECT_THAT(stats.nodes_per_depth[0], Eq(1u));
+    EXPECT_THAT(stats.nodes_per_depth[1], Eq(8u));
+    EXPECT_THAT(stats.nodes_per_depth[2], Eq(64u));
+    EXPECT_THAT(stats.mesh_face_count, Eq(12u));
+    EXPECT_THAT(stats.face_references, Eq((uint64_t)vector_count(&o->face_ids)));
+    EXPECT_THAT(stats.duplication, DoubleEq((double)vector_count(&o->face_ids) / 12));
+    EXPECT_THAT(stats.memory_bytes, Ge(vector_count(&o->nodes) * sizeof(octree_node_t) +
+                                       vector_count(&o->face_ids) * sizeof(wsib_t)));
+
+    uint32_t leaves = 0;
+    for (int b = 0; b != OCTREE_STATS_FACE_BUCKETS; ++b)
+    {
+        leaves += stats.leaves_per_face_count[b];
+        if (stats.leaves_per_face_count[b])
+            EXPECT_THAT(stats.max_faces_per_leaf, Ge(b == 0 ? 0u : 1u << (b - 1)));
+    }
+    EXPECT_THAT(leaves, Eq(stats.leaf_count));
+    EXPECT_THAT(stats.counters.queries, Eq(0u));
+
+    /* Counters accumulate until they are reset */
+    vector_t result;
+    vector_construct(&result, sizeof(wsib_t));
+    aabb_t query = aabb(-0.9, -0.9, -0.9, 0.1, 0.1, 0.1);
+    EXPECT_THAT(octree_query_potential_faces(o, &result, query.xyzxyz), Ne(-1));
+    EXPECT_THAT(octree_query_potential_faces(o, &result, query.xyzxyz), Ne(-1));
+    vector_clear_free(&result);
+    octree_stats(o, &stats);
+    EXPECT_THAT(stats.counters.queries, Eq(2u));
+    EXPECT_THAT(stats.counters.nodes_visited, Gt(2u));
+    EXPECT_THAT(stats.counters.face_references, Ge(stats.counters.duplicates_skipped));
+    octree_reset_query_counters(o);
+    octree_stats(o, &stats);
+    EXPECT_THAT(stats.counters.queries, Eq(0u));
+    EXPECT_THAT(stats.counters.nodes_visited, Eq(0u));
+}
+
+struct visited_faces
+{
+    std::vector<wsib_t> faces;
+    size_t stop_after;
+};
+
+static int
+record_face(void* user_data, wsib_t face_id)
+{
+    visited_faces* visited = static_cast<visited_faces*>(user_data);
+    visited->faces.push_back(face_id);
+    return visited->faces.size() == visited->stop_after ? 42 : 0;
+}
+
+TEST_F(NAME, visitor_sees_same_faces_as_query_and_can_stop_early)
+{
+    mesh_create(&m);
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", m), Eq(WS_OK));
+    ASSERT_THAT(octree_build_from_mesh(o, m, 4), Eq(WS_OK));
+    aabb_t query = aabb(-1.3, 0.7, -2.1, 2.4, 4.5, 0.3);
+
+    vector_t result;
+    vector_construct(&result, sizeof(wsib_t));
+    ASSERT_THAT(octree_query_potential_faces(o, &result, query.xyzxyz), Eq(0));
+    ASSERT_THAT(vector_count(&result), Gt(1u));
+
+    visited_faces all;
+    all.stop_after = 0;
+    octree_reset_query_counters(o);
+    EXPECT_THAT(octree_visit_potential_faces(o, query.xyzxyz, record_face, &all), Eq(0));
+    uint64_t all_nodes_visited = o->counters.nodes_visited;
+    ASSERT_THAT(all.faces.size(), Eq(vector_count(&result)));
+    for (size_t i = 0; i != all.faces.size(); ++i)
+        EXPECT_THAT(all.faces[i], Eq(*(wsib_t*)vector_get_element(&result, i)));
+
+    octree_reset_query_counters(o);
+    visited_faces first;
+    first.stop_after = 1;
+    EXPECT_THAT(octree_visit_potential_faces(o, query.xyzxyz, record_face, &first), Eq(42));
+    EXPECT_THAT(first.faces.size(), Eq(1u));
+    EXPECT_THAT(o->counters.nodes_visited, Lt(all_nodes_visited));
+
+    /* Queries outside of the octree don't call the visitor */
+    aabb_t outside = aabb(100, 100, 100, 101, 101, 101);
+    visited_faces none;
+    none.stop_after = 1;
+    EXPECT_THAT(octree_visit_potential_faces(o, outside.xyzxyz, record_face, &none), Eq(0));
+    EXPECT_THAT(none.faces.size(), Eq(0u));
+
+    vector_clear_free(&result);
+}
@@ -0,0 +1,475 @@
+#include "gmock/gmock.h"
+#include "wavesim/simulation.h"
+#include "wavesim/mesh.h"
+#include "wavesim/obj.h"
+#include "utils.hpp"
+#include <cmath>
+
+#define NAME simulation
+
+using namespace ::testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        simulation_construct(&sim);
+    }
+
+    virtual void TearDown()
+    {
+        simulation_destruct(&sim);
+    }
+
+    /* Sets up a 2x1x1 box in cells of size 0.25 without any partitions */
+    void setup_medium()
+    {
+        sim.medium.boundary = aabb(0, 0, 0, 2, 1, 1);
+        sim.medium.grid_size = vec3(0.25, 0.25, 0.25);
+        sim.medium.grid_dims[0] = 8;
+        sim.medium.grid_dims[1] = 4;
+        sim.medium.grid_dims[2] = 4;
+    }
+
+    void add_partition(int32_t ax, int32_t ay, int32_t az, int32_t bx, int32_t by, int32_t bz, wsreal_t c)
+    {
+        int32_t box[6] = {ax, ay, az, bx, by, bz};
+        ASSERT_THAT(medium_add_partition(&sim.medium, box, 0, c), Eq(WS_OK));
+    }
+
+protected:
+    simulation_t sim;
+};
+
+static wsreal_t
+cosine_along_x(void* user_data, const wsreal_t position[3])
+{
+    wsreal_t length = *(wsreal_t*)user_data;
+    return std::cos(M_PI * position[0] / length);
+}
+
+TEST_F(NAME, prepare_lays_out_partitions)
+{
+    setup_medium();
+    add_partition(0, 0, 0, 4, 4, 4, 2);
+    add_partition(4, 0, 0, 8, 4, 2, 1);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+
+    ASSERT_THAT(vector_count(&sim.partitions), Eq(2u));
+    simulation_partition_t* first = (simulation_partition_t*)vector_get_element(&sim.partitions, 0);
+    simulation_partition_t* second = (simulation_partition_t*)vector_get_element(&sim.partitions, 1);
+    EXPECT_THAT(first->offset, Eq(0u));
+    EXPECT_THAT(first->count, Eq(64u));
+    EXPECT_THAT(second->offset, Eq(64u));
+    EXPECT_THAT(second->count, Eq(32u));
+    EXPECT_THAT(second->dims[2], Eq(2));
+    EXPECT_THAT(sim.cell_count, Eq(96u));
+
+    /* The fastest partition determines the time step */
+    EXPECT_THAT(sim.time_step, DoubleNear(2 * 0.25 / (2 * std::sqrt(3 * 1088.0 / 180)), 1e-12));
+}
+
+TEST_F(NAME, prepare_fails_on_empty_medium)
+{
+    setup_medium();
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_ERR_EMPTY_MEDIUM));
+    EXPECT_THAT(simulation_step(&sim, 1), Eq(WS_ERR_NOT_PREPARED));
+}
+
+TEST_F(NAME, prepare_rejects_non_positive_sound_speed)
+{
+    setup_medium();
+    add_partition(0, 0, 0, 4, 4, 4, 343);
+    add_partition(4, 0, 0, 8, 4, 4, 0);
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_ERR_INVALID_SOUND_SPEED));
+
+    ((medium_partition_t*)vector_get_element(&sim.medium.partitions, 1))->sound_speed = -343;
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_ERR_INVALID_SOUND_SPEED));
+}
+
+TEST_F(NAME, prepare_checks_grid_resolves_max_frequency)
+{
+    setup_medium();
+    add_partition(0, 0, 0, 8, 4, 4, 343);
+
+    /* A wavelength of 343/457 = 0.75 spans exactly 3 cells of 0.25 */
+    sim.max_frequency = 457;
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    sim.max_frequency = 458;
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_ERR_GRID_TOO_COARSE));
+    sim.spatial_samples = 2;
+    EXPECT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+}
+
+TEST_F(NAME, stepping_requires_prepare)
+{
+    wsreal_t p;
+    vec3_t pos = vec3(0.5, 0.5, 0.5);
+    setup_medium();
+    add_partition(0, 0, 0, 8, 4, 4, 1);
+    EXPECT_THAT(simulation_step(&sim, 1), Eq(WS_ERR_NOT_PREPARED));
+    EXPECT_THAT(simulation_add_impulse(&sim, pos.xyz, 1), Eq(WS_ERR_NOT_PREPARED));
+    EXPECT_THAT(simulation_pressure_at(&sim, pos.xyz, &p), Eq(WS_ERR_NOT_PREPARED));
+}
+
+TEST_F(NAME, single_mode_oscillates_at_its_eigenfrequency)
+{
+    wsreal_t length = 2;
+    wsreal_t c = 343;
+    setup_medium();
+    add_partition(0, 0, 0, 8, 4, 4, c);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    ASSERT_THAT(simulation_set_initial_pressure(&sim, cosine_along_x, &length), Eq(WS_OK));
+
+    /* The lowest mode along X has a frequency of c*pi/L and no dispersion */
+    wsreal_t w = c * M_PI / length;
+    for (int n = 1; n <= 20; ++n)
+    {
+        ASSERT_THAT(simulation_step(&sim, 1), Eq(WS_OK));
+        for (int32_t x = 0; x != 8; ++x)
+        {
+            vec3_t pos = vec3(0.125 + x * 0.25, 0.6, 0.3);
+            wsreal_t p;
+            ASSERT_THAT(simulation_pressure_at(&sim, pos.xyz, &p), Eq(WS_OK));
+            EXPECT_THAT(p, DoubleNear(std::cos(w * n * sim.time_step) * cosine_along_x(&length, pos.xyz), 1e-9))
+                << "step " << n << ", cell " << x;
+        }
+    }
+    EXPECT_THAT(sim.step_count, Eq(20u));
+}
+
+TEST_F(NAME, impulse_raises_mean_pressure_linearly)
+{
+    vec3_t pos = vec3(0.3, 0.7, 0.1);
+    wsreal_t amplitude = 5;
+    setup_medium();
+    add_partition(0, 0, 0, 8, 4, 4, 343);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    ASSERT_THAT(simulation_add_impulse(&sim, pos.xyz, amplitude), Eq(WS_OK));
+
+    /*
+     * The walls are rigid, so the volume injected by the source stays in the
+     * box and the mean pressure keeps growing at a constant rate
+     */
+    for (int n = 1; n <= 10; ++n)
+    {
+        ASSERT_THAT(simulation_step(&sim, 1), Eq(WS_OK));
+        double mean = 0;
+        for (size_t i = 0; i != sim.cell_count; ++i)
+            mean += sim.pressure[i];
+        mean /= sim.cell_count;
+        EXPECT_THAT(mean, DoubleNear(n * sim.time_step * sim.time_step * amplitude / sim.cell_count, 1e-15));
+    }
+}
+
+TEST_F(NAME, positions_outside_partitions_are_rejected)
+{
+    wsreal_t p;
+    vec3_t in_gap = vec3(1.5, 0.5, 0.5);
+    vec3_t outside = vec3(-0.1, 0.5, 0.5);
+    vec3_t beyond = vec3(0.5, 1.1, 0.5);
+    vec3_t far_beyond = vec3(0.5, 0.5, 1e12);
+    vec3_t inside = vec3(0.5, 0.5, 0.5);
+    setup_medium();
+    add_partition(0, 0, 0, 4, 4, 4, 1);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    EXPECT_THAT(simulation_pressure_at(&sim, in_gap.xyz, &p), Eq(WS_ERR_OUTSIDE_MEDIUM));
+    EXPECT_THAT(simulation_pressure_at(&sim, outside.xyz, &p), Eq(WS_ERR_OUTSIDE_MEDIUM));
+    EXPECT_THAT(simulation_pressure_at(&sim, beyond.xyz, &p), Eq(WS_ERR_OUTSIDE_MEDIUM));
+    EXPECT_THAT(simulation_pressure_at(&sim, far_beyond.xyz, &p), Eq(WS_ERR_OUTSIDE_MEDIUM));
+    EXPECT_THAT(simulation_add_impulse(&sim, outside.xyz, 1), Eq(WS_ERR_OUTSIDE_MEDIUM));
+    EXPECT_THAT(simulation_pressure_at(&sim, inside.xyz, &p), Eq(WS_OK));
+    EXPECT_THAT(p, DoubleEq(0));
+}
+
+TEST_F(NAME, interface_terms_cover_stencil_reach)
+{
+    setup_medium();
+    add_partition(0, 0, 0, 4, 4, 4, 1);
+    add_partition(4, 0, 0, 8, 4, 4, 1);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+
+    /* 16 columns cross the face, each with 6 terms per side */
+    EXPECT_THAT(sim.interface_terms.count, Eq(2u * 16u * 6u));
+    for (size_t i = 0; i != sim.interface_terms.count; ++i)
+    {
+        /* Sources lie across the face, mirrors on the target's side */
+        size_t target = sim.interface_terms.target[i];
+        EXPECT_THAT(sim.interface_terms.source[i] < 64, Ne(target < 64));
+        EXPECT_THAT(sim.interface_terms.mirror[i] < 64, Eq(target < 64));
+    }
+}
+
+TEST_F(NAME, split_box_behaves_like_single_box)
+{
+    wsreal_t length = 2;
+    simulation_t whole;
+    simulation_construct(&whole);
+    whole.medium.boundary = aabb(0, 0, 0, 2, 1, 1);
+    whole.medium.grid_size = vec3(0.25, 0.25, 0.25);
+    int32_t box[6] = {0, 0, 0, 8, 4, 4};
+    ASSERT_THAT(medium_add_partition(&whole.medium, box, 0, 343), Eq(WS_OK));
+
+    setup_medium();
+    add_partition(0, 0, 0, 3, 4, 4, 343);
+    add_partition(3, 0, 0, 8, 4, 4, 343);
+
+    ASSERT_THAT(simulation_prepare(&whole), Eq(WS_OK));
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    ASSERT_THAT(simulation_set_initial_pressure(&whole, cosine_along_x, &length), Eq(WS_OK));
+    ASSERT_THAT(simulation_set_initial_pressure(&sim, cosine_along_x, &length), Eq(WS_OK));
+
+    /*
+     * A quarter period of the lowest mode. The interface stencil is only an
+     * approximation, at 16 cells per wavelength it's good to a few percent
+     */
+    for (int n = 0; n != 20; ++n)
+    {
+        ASSERT_THAT(simulation_step(&whole, 1), Eq(WS_OK));
+        ASSERT_THAT(simulation_step(&sim, 1), Eq(WS_OK));
+        for (int32_t x = 0; x != 8; ++x)
+        {
+            vec3_t pos = vec3(0.125 + x * 0.25, 0.375, 0.625);
+            wsreal_t expected, actual;
+            ASSERT_THAT(simulation_pressure_at(&whole, pos.xyz, &expected), Eq(WS_OK));
+            ASSERT_THAT(simulation_pressure_at(&sim, pos.xyz, &actual), Eq(WS_OK));
+            EXPECT_THAT(actual, DoubleNear(expected, 0.025)) << "step " << n << ", cell " << x;
+        }
+    }
+
+    simulation_destruct(&whole);
+}
+
+TEST_F(NAME, impulse_crosses_interface)
+{
+    vec3_t source = vec3(0.125, 0.5, 0.5);
+    vec3_t listener = vec3(1.875, 0.5, 0.5);
+    wsreal_t p;
+    setup_medium();
+    add_partition(0, 0, 0, 4, 4, 4, 343);
+    add_partition(4, 0, 0, 8, 4, 4, 343);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    ASSERT_THAT(simulation_add_impulse(&sim, source.xyz, 1), Eq(WS_OK));
+    ASSERT_THAT(simulation_step(&sim, 40), Eq(WS_OK));
+    ASSERT_THAT(simulation_pressure_at(&sim, listener.xyz, &p), Eq(WS_OK));
+    EXPECT_THAT(p, Ne(0));
+}
+
+static wsreal_t
+gaussian_at_center(void* user_data, const wsreal_t position[3])
+{
+    (void)user_data;
+    wsreal_t dx = position[0] - 2, dy = position[1] - 2, dz = position[2] - 2;
+    return std::exp(-(dx * dx + dy * dy + dz * dz) / (2 * 0.4 * 0.4));
+}
+
+TEST_F(NAME, many_small_partitions_remain_stable)
+{
+    /* Cuts at uneven distances produce partitions down to a single cell */
+    int32_t cuts[] = {0, 1, 3, 6, 16};
+    sim.medium.boundary = aabb(0, 0, 0, 4, 4, 4);
+    sim.medium.grid_size = vec3(0.25, 0.25, 0.25);
+    for (int x = 0; x != 4; ++x)
+        for (int y = 0; y != 4; ++y)
+            for (int z = 0; z != 4; ++z)
+                add_partition(cuts[x], cuts[y], cuts[z], cuts[x + 1], cuts[y + 1], cuts[z + 1], 343);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    ASSERT_THAT(simulation_set_initial_pressure(&sim, gaussian_at_center, NULL), Eq(WS_OK));
+
+    ASSERT_THAT(simulation_step(&sim, 2000), Eq(WS_OK));
+    for (size_t i = 0; i != sim.cell_count; ++i)
+        ASSERT_THAT(std::fabs(sim.pressure[i]), Lt(2)) << "cell " << i;
+}
+
+static double
+pressure_energy(const simulation_t* sim)
+{
+    double sum = 0;
+    for (size_t i = 0; i != sim->cell_count; ++i)
+        sum += sim->pressure[i] * sim->pressure[i];
+    return sum;
+}
+
+TEST_F(NAME, pml_slabs_cover_shell_around_grid)
+{
+    simulation_pml_params_t params;
+    setup_medium();
+    add_partition(0, 0, 0, 8, 4, 4, 343);
+
+    simulation_pml_params_default(&params);
+    params.faces = SIMULATION_FACE_POS_X;
+    params.thickness = 6;
+    simulation_set_pml(&sim, &params);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    EXPECT_THAT(sim.pml.cell_count, Eq(6u * 4u * 4u));
+    EXPECT_THAT(sim.interface_terms.count, Eq(16u * 6u));
+
+    /* With all faces, the slabs fill the whole shell without overlapping */
+    params.faces = SIMULATION_FACE_ALL;
+    params.thickness = 2;
+    simulation_set_pml(&sim, &params);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    EXPECT_THAT(sim.pml.cell_count, Eq(12u * 8u * 8u - 8u * 4u * 4u));
+    for (size_t i = 0; i != 6 * sim.pml.cell_count; ++i)
+        ASSERT_THAT(sim.pml.neighbours[i], Lt(sim.cell_count + sim.pml.cell_count));
+}
+
+TEST_F(NAME, pml_absorbs_outgoing_waves)
+{
+    simulation_t rigid;
+    simulation_pml_params_t params;
+    simulation_t* sims[2] = {&sim, &rigid};
+    simulation_construct(&rigid);
+    simulation_pml_params_default(&params);
+    simulation_set_pml(&sim, &params);
+
+    for (int i = 0; i != 2; ++i)
+    {
+        int32_t box[6] = {0, 0, 0, 16, 16, 16};
+        sims[i]->medium.boundary = aabb(0, 0, 0, 4, 4, 4);
+        sims[i]->medium.grid_size = vec3(0.25, 0.25, 0.25);
+        sims[i]->medium.grid_dims[0] = sims[i]->medium.grid_dims[1] = sims[i]->medium.grid_dims[2] = 16;
+        ASSERT_THAT(medium_add_partition(&sims[i]->medium, box, 0, 343), Eq(WS_OK));
+        ASSERT_THAT(simulation_prepare(sims[i]), Eq(WS_OK));
+        ASSERT_THAT(simulation_set_initial_pressure(sims[i], gaussian_at_center, NULL), Eq(WS_OK));
+    }
+
+    double initial = pressure_energy(&sim);
+    ASSERT_THAT(simulation_step(&sim, 200), Eq(WS_OK));
+    ASSERT_THAT(simulation_step(&rigid, 200), Eq(WS_OK));
+    EXPECT_THAT(pressure_energy(&sim), Lt(0.01 * initial));
+    EXPECT_THAT(pressure_energy(&rigid), Gt(0.1 * initial));
+
+    /* Stays stable long after the wave has left */
+    ASSERT_THAT(simulation_step(&sim, 2000), Eq(WS_OK));
+    EXPECT_THAT(pressure_energy(&sim), Lt(0.01 * initial));
+
+    simulation_destruct(&rigid);
+}
+
+TEST_F(NAME, mesh_built_medium_uses_speed_of_sound_in_air)
+{
+    mesh_t* mesh;
+    vec3_t grid_size = vec3(0.5, 0.5, 0.5);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube-with-interior.obj", mesh), Eq(WS_OK));
+    ASSERT_THAT(medium_build_from_mesh(&sim.medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+    VECTOR_FOR_EACH(&sim.medium.partitions, medium_partition_t, partition)
+        ASSERT_THAT(partition->sound_speed, DoubleEq(343));
+    VECTOR_END_EACH
+
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    EXPECT_THAT(sim.time_step, DoubleNear(2 * 0.5 / (343 * std::sqrt(3 * 1088.0 / 180)), 1e-12));
+
+    /* Twice the speed halves the step */
+    medium_set_sound_speed(&sim.medium, 686);
+    ASSERT_THAT(medium_build_from_mesh(&sim.medium, NULL, mesh, grid_size.xyz), Eq(WS_OK));
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+    EXPECT_THAT(sim.time_step, DoubleNear(0.5 / (343 * std::sqrt(3 * 1088.0 / 180)), 1e-12));
+
+    mesh_destroy(mesh);
+}
+
+static wsreal_t
+gaussian_beside_cube(void* user_data, const wsreal_t position[3])
+{
+    (void)user_data;
+    wsreal_t dx = position[0] + 7, dy = position[1] - 5, dz = position[2];
+    return std::exp(-(dx * dx + dy * dy + dz * dz) / (2 * 1.0 * 1.0));
+}
+
+TEST_F(NAME, pml_absorbs_waves_around_mesh)
+{
+    mesh_t* mesh;
+    medium_t def;
+    simulation_t rigid;
+    simulation_pml_params_t params;
+    simulation_t* sims[2] = {&sim, &rigid};
+    vec3_t grid_size = vec3(1, 1, 1);
+    ASSERT_THAT(mesh_create(&mesh), Eq(WS_OK));
+    ASSERT_THAT(obj_import_mesh("../wavesim/models/cube.obj", mesh), Eq(WS_OK));
+    medium_construct(&def);
+    def.boundary = aabb(-9, -4, -9, 9, 14, 9);
+    simulation_construct(&rigid);
+    medium_set_keep_exterior_air(&sim.medium, 1);
+    medium_set_keep_exterior_air(&rigid.medium, 1);
+    simulation_pml_params_default(&params);
+    simulation_set_pml(&sim, &params);
+
+    /* The cube is solid, the pulse starts in the air between it and the boundary */
+    for (int i = 0; i != 2; ++i)
+    {
+        ASSERT_THAT(medium_build_from_mesh(&sims[i]->medium, &def, mesh, grid_size.xyz), Eq(WS_OK));
+        ASSERT_THAT(sims[i]->medium.excluded_cell_count, Gt(0u));
+        ASSERT_THAT(simulation_prepare(sims[i]), Eq(WS_OK));
+        ASSERT_THAT(simulation_set_initial_pressure(sims[i], gaussian_beside_cube, NULL), Eq(WS_OK));
+    }
+    EXPECT_THAT(sim.pml.cell_count, Gt(0u));
+
+    double initial = pressure_energy(&sim);
+    ASSERT_THAT(simulation_step(&sim, 200), Eq(WS_OK));
+    ASSERT_THAT(simulation_step(&rigid, 200), Eq(WS_OK));
+    EXPECT_THAT(pressure_energy(&sim), Lt(0.01 * initial));
+    EXPECT_THAT(pressure_energy(&rigid), Gt(0.1 * initial));
+
+    simulation_destruct(&rigid);
+    medium_destruct(&def);
+    mesh_destroy(mesh);
+}
+
+TEST_F(NAME, threads_split_large_partitions_into_slabs)
+{
+    sim.medium.boundary = aabb(0, 0, 0, 16, 4, 4);
+    sim.medium.grid_size = vec3(0.25, 0.25, 0.25);
+    sim.medium.grid_dims[0] = 64;
+    sim.medium.grid_dims[1] = sim.medium.grid_dims[2] = 16;
+    add_partition(0, 0, 0, 64, 16, 16, 343);
+    simulation_set_thread_count(&sim, 4);
+    ASSERT_THAT(simulation_prepare(&sim), Eq(WS_OK));
+
+    /* 16384 cells are too few for 8 tasks per worker, tasks have at least 4096 cells */
+    EXPECT_THAT(vector_count(&sim.tasks[SIMULATION_PHASE_INTERFACES]), Eq(0u));
+    EXPECT_THAT(vector_count(&sim.tasks[SIMULATION_PHASE_FORWARD]), Eq(4u));
+    EXPECT_THAT(vector_count(&sim.tasks[SIMULATION_PHASE_MODES]), Eq(4u));
+    EXPECT_THAT(vector_count(&sim.tasks[SIMULATION_PHASE_INVERSE]), Eq(4u));
+    VECTOR_FOR_EACH(&sim.tasks[SIMULATION_PHASE_MODES], simulation_task_t, task)
+        EXPECT_THAT(task->end - task->begin, Eq(16u));
+    VECTOR_END_EACH
+}
+
+TEST_F(NAME, results_do_not_depend_on_thread_count)
+{
+    simulation_t threaded;
+    simulation_pml_params_t params;
+    simulation_t* sims[2] = {&sim, &threaded};
+    simulation_construct(&threaded);
+    simulation_pml_params_default(&params);
+    params.faces = SIMULATION_FACE_POS_X | SIMULATION_FACE_NEG_Z;
+    params.thickness = 4;
+
+    for (int i = 0; i != 2; ++i)
+    {
+        simulation_t* s = sims[i];
+        int32_t big[6] = {0, 0, 0, 24, 16, 16};
+        int32_t small[6] = {24, 0, 0, 32, 16, 16};
+        s->medium.boundary = aabb(0, 0, 0, 8, 4, 4);
+        s->medium.grid_size = vec3(0.25, 0.25, 0.25);
+        s->medium.grid_dims[0] = 32;
+        s->medium.grid_dims[1] = s->medium.grid_dims[2] = 16;
+        ASSERT_THAT(medium_add_partition(&s->medium, big, 0, 343), Eq(WS_OK));
+        ASSERT_THAT(medium_add_partition(&s->medium, small, 0, 343), Eq(WS_OK));
+        simulation_set_pml(s, &params);
+        simulation_set_thread_count(s, i == 0 ? 1 : 4);
+        ASSERT_THAT(simulation_prepare(s), Eq(WS_OK));
+        ASSERT_THAT(simulation_set_initial_pressure(s, gaussian_at_center, NULL), Eq(WS_OK));
+    }
+    ASSERT_THAT(vector_count(&threaded.tasks[SIMULATION_PHASE_MODES]), Gt(1u));
+
+    ASSERT_THAT(simulation_step(&sim, 50), Eq(WS_OK));
+    ASSERT_THAT(simulation_step(&threaded, 50), Eq(WS_OK));
+    for (size_t i = 0; i != sim.cell_count + sim.pml.cell_count; ++i)
+        ASSERT_THAT(threaded.pressure[i], DoubleEq(sim.pressure[i])) << "cell " << i;
+
+    simulation_destruct(&threaded);
+}
@@ -0,0 +1,99 @@
+#include "gmock/gmock.h"
+#include "wavesim/thread_pool.h"
+#include <vector>
+
+#define NAME thread_pool
+
+using namespace ::testing;
+
+struct counter_t
+{
+    int runs;
+    int worker;
+};
+
+static void
+count_run(void* arg, int worker)
+{
+    counter_t* counter = (counter_t*)arg;
+    counter->runs++;
+    counter->worker = worker;
+}
+
+/* Keeps its worker busy so the other tasks of the batch have to be stolen */
+static void
+spin(void* arg, int worker)
+{
+    volatile double* sum = (volatile double*)arg;
+    (void)worker;
+    for (int i = 0; i != 20000000; ++i)
+        *sum = *sum + 1e-9;
+}
+
+TEST(NAME, single_worker_runs_tasks_on_calling_thread)
+{
+    thread_pool_t* pool;
+    std::vector<counter_t> counters(100, counter_t{0, -1});
+    ASSERT_THAT(thread_pool_create(&pool, 1), Eq(WS_OK));
+
+    for (size_t i = 0; i != counters.size(); ++i)
+        ASSERT_THAT(thread_pool_submit(pool, count_run, &counters[i]), Eq(WS_OK));
+    thread_pool_wait(pool);
+
+    for (size_t i = 0; i != counters.size(); ++i)
+    {
+        EXPECT_THAT(counters[i].runs, Eq(1));
+        EXPECT_THAT(counters[i].worker, Eq(0));
+    }
+    thread_pool_destroy(pool);
+}
+
+TEST(NAME, every_task_runs_exactly_once_per_batch)
+{
+    thread_pool_t* pool;
+    std::vector<counter_t> counters(1000, counter_t{0, -1});
+    ASSERT_THAT(thread_pool_create(&pool, 4), Eq(WS_OK));
+
+    for (int batch = 1; batch <= 10; ++batch)
+    {
+        for (size_t i = 0; i != counters.size(); ++i)
+            ASSERT_THAT(thread_pool_submit(pool, count_run, &counters[i]), Eq(WS_OK));
+        thread_pool_wait(pool);
+
+        /* Waiting is a barrier, all tasks of the batch must be done */
+        for (size_t i = 0; i != counters.size(); ++i)
+        {
+            ASSERT_THAT(counters[i].runs, Eq(batch));
+            ASSERT_THAT(counters[i].worker, AllOf(Ge(0), Lt(4)));
+        }
+    }
+    thread_pool_destroy(pool);
+}
+
+TEST(NAME, idle_workers_steal_from_busy_ones)
+{
+    thread_pool_t* pool;
+    volatile double sum = 0;
+    std::vector<counter_t> counters(60, counter_t{0, -1});
+    int stolen = 0;
+    ASSERT_THAT(thread_pool_create(&pool, 4), Eq(WS_OK));
+
+    /*
+     * Tasks are dealt out round robin. The long task is the last one in the
+     * queue of worker 0, which runs it first, so the short tasks queued
+     * before it are left to the other workers.
+     */
+    for (size_t i = 0; i != counters.size(); ++i)
+        ASSERT_THAT(thread_pool_submit(pool, count_run, &counters[i]), Eq(WS_OK));
+    ASSERT_THAT(thread_pool_submit(pool, spin, (void*)&sum), Eq(WS_OK));
+    thread_pool_wait(pool);
+
+    for (size_t i = 0; i != counters.size(); ++i)
+    {
+        EXPECT_THAT(counters[i].runs, Eq(1));
+        if (i % 4 == 0 && counters[i].worker != 0)
+            ++stolen;
+    }
+    EXPECT_THAT(stolen, Gt(0));
+    thread_pool_destroy(pool);
+}